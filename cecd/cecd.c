@@ -35,11 +35,11 @@
 
 #include "libcec.h"
 #include "decoder.h"
+#include "builder.h"
 #include "libcec_version.h"
 #include "profile.h"
 #include "profile_helpers.h"
 
-#define BROADCAST (logical_address<<4 | 0x0F)
 #define MIN(X,Y) ((X) < (Y) ? (X) : (Y))
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
@@ -48,6 +48,7 @@ static char LOCK_FILE[] = "/var/lock/cecd.lock";
 static char LOG_FILE[] = "/var/log/cecd.log";
 static char CEC_DEVICE[] = "/dev/cec/0";
 static char CONF_FILE[] = "/etc/cecd.conf";
+static char STATE_FILE[] = "/var/lib/cecd.state";
 static char DEFAULT_DEVICE_NAME[] = "Unidentified";
 
 char* running_dir = RUNNING_DIR;
@@ -55,6 +56,7 @@ char* lock_file = LOCK_FILE;
 char* log_file = LOG_FILE;
 char* cec_device = CEC_DEVICE;
 char* conf_file = CONF_FILE;
+char* state_file = STATE_FILE;
 unsigned int device_type = CEC_DEVTYPE_PLAYBACK;
 
 static FILE *log_fd = NULL, *target_fd = NULL;
@@ -70,6 +72,8 @@ static libcec_device_handle* handle;
 
 /* command translation */
 static int target_packet_size, target_repeat;
+// opcodes we have a use for, when receive filtering is enabled
+static uint8_t rx_opcodes[LIBCEC_RX_FILTER_SIZE];
 typedef struct seq {
 	uint8_t  len;
 	uint16_t* data;		// hash values (for CEC commands) or simple bytes (UI codes)
@@ -482,6 +486,9 @@ static uint16_t cmdstr_to_hash(char* cmdstr, hash_table *htab) {
 		cmd_data[cmd_len] = byte;
 		str = strtok_r(NULL, ",", &saveptr);
 	}
+	if (cmd_len > 0) {
+		LIBCEC_RX_FILTER_SET(rx_opcodes, cmd_data[0]);
+	}
 
 	return htab_hash(cmd_data, cmd_len, htab, 1);
 }
@@ -553,6 +560,53 @@ static uint8_t cmd_process(seq** seq_table, uint16_t* buffer, uint8_t len, uint8
 	return 0;
 }
 
+// Read the logical and physical addresses we claimed last time, if any
+static void state_load(uint8_t* logical_address, uint16_t* physical_address)
+{
+	FILE* fd;
+	unsigned int la, pa;
+
+	*logical_address = 15;
+	*physical_address = 0xFFFF;
+	fd = fopen(state_file, "r");
+	if (fd == NULL) {
+		return;
+	}
+	if ((fscanf(fd, "%u %x", &la, &pa) == 2) && (la < 15) && (pa <= 0xFFFF)) {
+		*logical_address = (uint8_t)la;
+		*physical_address = (uint16_t)pa;
+	}
+	fclose(fd);
+}
+
+static void state_save(uint8_t logical_address, uint16_t physical_address)
+{
+	FILE* fd;
+
+	fd = fopen(state_file, "w");
+	if (fd == NULL) {
+		cecd_log("could not save state to %s\n", state_file);
+		return;
+	}
+	fprintf(fd, "%u %04X\n", logical_address, physical_address);
+	fclose(fd);
+}
+
+// Called by libcec once one of our replies has been sent
+static void tx_done(libcec_device_handle* h, const uint8_t* buffer, size_t length,
+	const libcec_tx_status* status, void* user_data)
+{
+	static const char* tx_result_str[] = { "OK", "NACK", "arbitration lost", "timeout", "error" };
+
+	if (status->result != LIBCEC_TX_OK) {
+		cecd_log("could not send message %02X %02X: %s (%d retries)\n", buffer[0],
+			(length > 1) ? buffer[1] : 0, tx_result_str[status->result], status->retries);
+	} else {
+		cecd_dbg("sent message %02X %02X - queued %d us, transmitted in %d us\n", buffer[0],
+			(length > 1) ? buffer[1] : 0, status->queued_time, status->wire_time);
+	}
+}
+
 static void cecd_exit(int ret_val)
 {
 	// All these calls properly handle a NULL parameter
@@ -598,14 +652,19 @@ int main(int argc, char** argv)
 	const char* ucp_commands_node[3] = {"translate", "ucp_commands", 0};
 	const char* cec_commands_node[3] = {"translate", "cec_commands", 0};
 	long r;
-	int c, len, target_timeout, logical_address = 15, physical_address_changed = -1;
+	int c, len, target_timeout, rx_buffer, rx_filter, logical_address = 15, physical_address_changed = -1;
+	int i, nb_frames = 0, frame_index = 0;
 	uint32_t size, device_oui;
-	uint16_t physical_address = 0xFFFF;
+	uint16_t physical_address = 0xFFFF, last_physical_address;
+	uint8_t last_logical_address;
 	// TODO: check for seq_data overflow
 	uint16_t seq_data[CEC_MAX_COMMAND_SIZE], seq_len, ucp_unprocessed[CEC_MAX_COMMAND_SIZE], cec_unprocessed[CEC_MAX_COMMAND_SIZE];
-	uint8_t i, byte, buffer[CEC_MAX_COMMAND_SIZE], opcode = 0;
+	uint8_t reason, byte, buffer[CEC_MAX_COMMAND_SIZE], opcode = 0;
+	libcec_frame frames[16];
+	cec_parsed_message msg;
 	uint8_t ucp_unprocessed_len = 0, ucp_processed_len, cec_unprocessed_len = 0, cec_processed_len;
-	char *target_device, *device_name, *str = NULL, *saveptr = NULL, **key, *val;
+	char *target_device, *device_name, *edid_cache, *str = NULL, *saveptr = NULL, **key, *val;
+	char text[LIBCEC_MAX_FORMAT_SIZE];
 
 	static struct option long_options[] = {
 		{"daemon", no_argument, 0, 'D'},
@@ -724,6 +783,22 @@ int main(int argc, char** argv)
 		cecd_log("error reading device.name: %s\n", profile_errtostr(r));
 		cecd_exit(EXIT_FAILURE);
 	}
+	if ((r = profile_get_string(profile, "device", "edid_cache", NULL, NULL, &edid_cache))) {
+		cecd_log("error reading device.edid_cache: %s\n", profile_errtostr(r));
+		cecd_exit(EXIT_FAILURE);
+	}
+	if ((r = profile_get_string(profile, "device", "state_file", NULL, STATE_FILE, &state_file))) {
+		cecd_log("error reading device.state_file: %s\n", profile_errtostr(r));
+		cecd_exit(EXIT_FAILURE);
+	}
+	if ((r = profile_get_integer(profile, "device", "rx_buffer", NULL, 32, &rx_buffer))) {
+		cecd_log("error reading device.rx_buffer: %s\n", profile_errtostr(r));
+		cecd_exit(EXIT_FAILURE);
+	}
+	if ((r = profile_get_boolean(profile, "device", "rx_filter", NULL, 0, &rx_filter))) {
+		cecd_log("error reading device.rx_filter: %s\n", profile_errtostr(r));
+		cecd_exit(EXIT_FAILURE);
+	}
 	if ((device_name == NULL) || (strlen(device_name) < 1) || (strlen(device_name) > 14)) {
 		cecd_log("invalid device.name: '%s' - ignored\n", device_name);
 		device_name = DEFAULT_DEVICE_NAME;
@@ -759,6 +834,13 @@ int main(int argc, char** argv)
 		cecd_log("cannot open CEC device %s\n", cec_device);
 		cecd_exit(EXIT_FAILURE);
 	}
+	libcec_set_tx_callback(handle, tx_done, NULL);
+	if ((edid_cache != NULL) && (libcec_set_edid_cache_path(handle, edid_cache) != LIBCEC_SUCCESS)) {
+		cecd_log("could not set EDID cache - the EDID will be read on every start\n");
+	}
+	if ((rx_buffer > 0) && (libcec_set_rx_buffering(handle, rx_buffer) != LIBCEC_SUCCESS)) {
+		cecd_log("could not set up receive buffering - messages will be read unbuffered\n");
+	}
 
 	/*
 	 * Process the translation sequences
@@ -847,6 +929,23 @@ int main(int argc, char** argv)
 		}
 	}
 
+	// Only get woken up for the broadcasts we act upon, and those from the cec_commands
+	// table. Any opcode that can be directed to us must still get through, including
+	// unknown ones and <Abort>, so that we can answer them with a <Feature Abort>.
+	if (rx_filter) {
+		buffer[0] = 0x01;
+		for (i=0; i<256; i++) {
+			buffer[1] = (uint8_t)i;
+			if (libcec_validate_message(buffer, 2) != LIBCEC_ERROR_OTHER) {
+				LIBCEC_RX_FILTER_SET(rx_opcodes, i);
+			}
+		}
+		LIBCEC_RX_FILTER_SET(rx_opcodes, CEC_OP_SET_STREAM_PATH);
+		if (libcec_set_rx_filter(handle, rx_opcodes, 0xFFFF) != LIBCEC_SUCCESS) {
+			cecd_log("could not set receive filter - all messages will be processed\n");
+		}
+	}
+
 	// Open translation target, if provided
 	if (target_device != NULL) {
 		target_fd = fopen(target_device, "w");
@@ -865,16 +964,34 @@ int main(int argc, char** argv)
 	// TODO: handle physical address loss (re-routing)
 	while(1) {
 		if (physical_address_changed) {
-			logical_address = libcec_allocate_logical_address(handle, device_type, &physical_address);
+			// start with the address we had last time
+			state_load(&last_logical_address, &last_physical_address);
+			logical_address = libcec_allocate_logical_address_ex(handle, device_type, &physical_address,
+				last_logical_address, last_physical_address);
 			if (logical_address < 0) {
 				cecd_log("failed to set logical address: %s\n", libcec_strerror(logical_address));
 				cecd_exit(EXIT_FAILURE);
 			}
 			cecd_log("logical address set to %d\n", logical_address);
+			if ((logical_address != last_logical_address) || (physical_address != last_physical_address)) {
+				state_save((uint8_t)logical_address, physical_address);
+			}
 			physical_address_changed = 0;
 		}
 		// TODO: don't use timeout if no target
-		len = libcec_read_message(handle, buffer, ARRAY_SIZE(buffer), target_timeout);
+		if (frame_index >= nb_frames) {
+			// fetch all the pending messages at once
+			nb_frames = libcec_read_messages(handle, frames, ARRAY_SIZE(frames), target_timeout);
+			frame_index = 0;
+		}
+		if (nb_frames > 0) {
+			len = frames[frame_index].length;
+			memcpy(buffer, frames[frame_index].data, len);
+			frame_index++;
+		} else {
+			len = nb_frames;
+			nb_frames = 0;
+		}
 		if (len == LIBCEC_ERROR_TIMEOUT) {
 			if ((ucp_unprocessed_len == 0) && (cec_unprocessed_len == 0)) {
 				continue;
@@ -891,74 +1008,54 @@ int main(int argc, char** argv)
 			cecd_log("could not read message (error %d)\n", len);
 			continue;
 		}
-		r = libcec_decode_message(buffer, len);
+		// decode the message once, and only format it if it gets logged
+		r = libcec_parse_message(buffer, len, &msg);
+		if (log_level <= LIBCEC_LOG_LEVEL_INFO) {
+			libcec_format_message(buffer, len, text, sizeof(text));
+			cecd_log("received %s\n", text);
+		}
 		if (len <= 1) {
 			// Ignore ACK, etc.
 			continue;
 		}
+		opcode = msg.opcode;
 		if (r != LIBCEC_SUCCESS) {
-			opcode = buffer[1];
-			buffer[1] = CEC_OP_ABORT;
+			opcode = CEC_OP_ABORT;
 		}
 
-		buffer[0] >>= 4;	// Set whoever was talking to us as dest
-		buffer[0] |= logical_address << 4;
-		switch(buffer[1]) {
+		// Replies go to whoever was talking to us, and overwrite the message
+		switch(opcode) {
 		case CEC_OP_GIVE_OSD_NAME:
-			buffer[1] = CEC_OP_SET_OSD_NAME;
-			for (i=0; i<strlen(device_name); i++) {
-				buffer[i+2] = device_name[i];
-			}
-			len = i+2;
+			len = libcec_build_set_osd_name(buffer, logical_address, msg.initiator, device_name);
 			break;
 		case CEC_OP_GIVE_DEVICE_VENDOR_ID:
-			buffer[0] = BROADCAST;
-			buffer[1] = CEC_OP_DEVICE_VENDOR_ID;
-			buffer[2] = (device_oui>>16)&0xFF;
-			buffer[3] = (device_oui>>8)&0xFF;
-			buffer[4] = device_oui & 0xFF;
-			len = 5;
+			len = libcec_build_device_vendor_id(buffer, logical_address, device_oui);
 			break;
 		case CEC_OP_MENU_REQUEST:
-			buffer[1] = CEC_OP_MENU_STATUS;
-			buffer[2] = CEC_MENUSTATE_ACTIVATED;
-			len = 3;
+			len = libcec_build_menu_status(buffer, logical_address, msg.initiator, CEC_MENUSTATE_ACTIVATED);
 			break;
 		case CEC_OP_GIVE_DEVICE_POWER_STATUS:
-			buffer[1] = CEC_OP_REPORT_POWER_STATUS;
-			buffer[2] = CEC_POWERSTATUS_ON;
-			len = 3;
+			len = libcec_build_report_power_status(buffer, logical_address, msg.initiator, CEC_POWERSTATUS_ON);
 			break;
 		case CEC_OP_GET_CEC_VERSION:
-			buffer[1] = CEC_OP_CEC_VERSION;
-			buffer[2] = CEC_VERSION_V1_3A;
-			len = 3;
+			len = libcec_build_cec_version(buffer, logical_address, msg.initiator, CEC_VERSION_V1_3A);
 			break;
 		case CEC_OP_GIVE_PHYSICAL_ADDRESS:
-			buffer[0] = BROADCAST;
-			buffer[1] = CEC_OP_REPORT_PHYSICAL_ADDRESS;
-			buffer[2] = physical_address >> 8;
-			buffer[3] = physical_address & 0xFF;
-			buffer[4] = device_type;
-			len = 5;
+			len = libcec_build_report_physical_address(buffer, logical_address, physical_address, device_type);
 			break;
 		case CEC_OP_SET_STREAM_PATH:
 			// Ignore if request is for a different phys_addr
-			if ((buffer[2] != (physical_address >> 8)) || (buffer[3] != (physical_address & 0xFF)))
+			if (msg.op.physical_address != physical_address) {
+				len = 0;
 				break;
-			buffer[0] = BROADCAST;
-			buffer[1] = CEC_OP_ACTIVE_SOURCE;
-			buffer[2] = physical_address >> 8;
-			buffer[3] = physical_address & 0xFF;
-			len = 4;
+			}
+			len = libcec_build_active_source(buffer, logical_address, physical_address);
 			break;
 		case CEC_OP_GIVE_DECK_STATUS:
-			buffer[1] = CEC_OP_DECK_STATUS;
-			buffer[2] = CEC_DECKINFO_PLAY;
-			len = 3;
+			len = libcec_build_deck_status(buffer, logical_address, msg.initiator, CEC_DECKINFO_PLAY);
 			break;
 		case CEC_OP_USER_CONTROL_PRESSED:
-			ucp_unprocessed[ucp_unprocessed_len++] = buffer[2];
+			ucp_unprocessed[ucp_unprocessed_len++] = msg.op.ui_command;
 			ucp_processed_len = cmd_process(seq_ucp, ucp_unprocessed, ucp_unprocessed_len, 0xFF);
 			ucp_unprocessed_len -= ucp_processed_len;
 			if (ucp_processed_len && ucp_unprocessed_len) {
@@ -967,24 +1064,23 @@ int main(int argc, char** argv)
 			len = 0;
 			break;
 		case CEC_OP_ABORT:
-			// Only answer to abort if initiator address is not broadcast
-			if ((buffer[0] & 0x0f) == 0x0f)
+			// Never answer broadcasts, unregistered initiators or misaddressed messages
+			if ((msg.destination == 0x0f) || (msg.initiator == 0x0f) || (r == LIBCEC_ERROR_OTHER)) {
+				len = 0;
 				break;
-			buffer[1] = CEC_OP_FEATURE_ABORT;
-			buffer[2] = opcode;
+			}
 			switch (r) {
 			case LIBCEC_ERROR_NOT_SUPPORTED:
-				buffer[3] = CEC_ABORT_UNRECOGNIZED;
+				reason = CEC_ABORT_UNRECOGNIZED;
 				break;
 			case LIBCEC_ERROR_INVALID_PARAM:
-			case LIBCEC_ERROR_OTHER:
-				len = 0;
+				reason = CEC_ABORT_INVALID_OPERAND;
 				break;
 			default:
-				buffer[3] = CEC_ABORT_REFUSED;
+				reason = CEC_ABORT_REFUSED;
 				break;
 			}
-			len = 4;
+			len = libcec_build_feature_abort(buffer, logical_address, msg.initiator, msg.opcode, reason);
 			break;
 
 		default:
@@ -1000,11 +1096,15 @@ int main(int argc, char** argv)
 		}
 
 		if (len) {
-			if (libcec_write_message(handle, buffer, len)) {
-				cecd_log("could not send message\n");
+			// queue the reply, so that we can go on processing what we receive
+			if (libcec_submit_message(handle, buffer, len)) {
+				cecd_log("could not queue message\n");
 				continue;
 			}
-			libcec_decode_message(buffer, len);
+			if (log_level <= LIBCEC_LOG_LEVEL_INFO) {
+				libcec_format_message(buffer, len, text, sizeof(text));
+				cecd_log("sent %s\n", text);
+			}
 		}
 	}
 	return EXIT_SUCCESS;
@@ -0,0 +1,778 @@
+/*
+ * builder - CEC message building
+ *
+ * Copyright (c) 2010-2011 Pete Batard <pete@akeo.ie>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LIBCEC_BUILDER_H__
+#define __LIBCEC_BUILDER_H__
+
+#include "decoder.h"
+
+/*
+ * Typed message builders, one per opcode of opcodes.def. Each of them writes
+ * a complete frame, header block included, to buf, which must be able to hold
+ * CEC_MAX_COMMAND_SIZE bytes, and returns the length of the frame. The
+ * addressing, the lengths and the operand ranges are checked against the same
+ * rules libcec_parse_message() applies, and 0 is returned, with the content of
+ * buf undefined, for any argument that would make the frame invalid.
+ *
+ * Builders of directed messages take a destination, which can't be 15, those
+ * of broadcast messages don't, and those that may be either take a destination
+ * that can be 15. Timers and services are given as the structures that
+ * libcec_parse_message() fills, with their times in binary rather than BCD.
+ */
+
+/*
+ * Internal helpers
+ */
+static inline int ceci_build_directed(uint8_t* buf, uint8_t src, uint8_t dst, uint8_t opcode)
+{
+	if ((src > 0x0F) || (dst >= 0x0F)) {
+		return 0;
+	}
+	buf[0] = (uint8_t)((src << 4) | dst);
+	buf[1] = opcode;
+	return 2;
+}
+
+static inline int ceci_build_broadcast(uint8_t* buf, uint8_t src, uint8_t opcode)
+{
+	if (src > 0x0F) {
+		return 0;
+	}
+	buf[0] = (uint8_t)((src << 4) | 0x0F);
+	buf[1] = opcode;
+	return 2;
+}
+
+static inline int ceci_build_any(uint8_t* buf, uint8_t src, uint8_t dst, uint8_t opcode)
+{
+	if ((src > 0x0F) || (dst > 0x0F)) {
+		return 0;
+	}
+	buf[0] = (uint8_t)((src << 4) | dst);
+	buf[1] = opcode;
+	return 2;
+}
+
+static inline void ceci_build_be16(uint8_t* p, uint16_t val)
+{
+	p[0] = (uint8_t)(val >> 8);
+	p[1] = (uint8_t)val;
+}
+
+static inline uint8_t ceci_build_bcd(uint8_t val)
+{
+	return (uint8_t)(((val / 10) << 4) | (val % 10));
+}
+
+/* A physical address can't have a non zero digit after a zero one. 0xFFFF means none */
+static inline int ceci_build_physical_address(uint8_t* p, uint16_t pa)
+{
+	int i;
+
+	if (pa != 0xFFFF) {
+		for (i=12; i>0; i-=4) {
+			if ( (((pa >> i) & 0x0F) == 0) && ((pa & ((1 << i) - 1)) != 0) ) {
+				return 0;
+			}
+		}
+	}
+	ceci_build_be16(p, pa);
+	return 2;
+}
+
+/* A NUL terminated string of [min, max] printable chars, returns its length */
+static inline int ceci_build_ascii(uint8_t* p, const char* str, size_t min, size_t max)
+{
+	size_t i;
+
+	if (str == NULL) {
+		return 0;
+	}
+	for (i=0; str[i] != 0; i++) {
+		if ((i >= max) || (str[i] < 0x20) || (str[i] > 0x7E)) {
+			return 0;
+		}
+		p[i] = (uint8_t)str[i];
+	}
+	return (i >= min) ? (int)i : 0;
+}
+
+/* [min, max] bytes, returns 0 if there are too few or too many of them */
+static inline int ceci_build_bytes(uint8_t* p, const uint8_t* data, size_t length, size_t min, size_t max)
+{
+	size_t i;
+
+	if ((length < min) || (length > max) || ((data == NULL) && (length != 0))) {
+		return 0;
+	}
+	for (i=0; i<length; i++) {
+		p[i] = data[i];
+	}
+	return 1;
+}
+
+static inline int ceci_build_analogue_service(uint8_t* p, const cec_op_analogue_service* service)
+{
+	if ( (service == NULL) || (service->broadcast_type > CEC_ANALOGTYPE_TERRESTRIAL)
+	  || (service->frequency == 0x0000) || (service->frequency == 0xFFFF)
+	  || ((service->broadcast_system > CEC_BCASTSYSTEM_PAL_DK) && (service->broadcast_system != CEC_BCASTSYSTEM_OTHER)) ) {
+		return 0;
+	}
+	p[0] = service->broadcast_type;
+	ceci_build_be16(&p[1], service->frequency);
+	p[3] = service->broadcast_system;
+	return 4;
+}
+
+static inline int ceci_build_digital_service(uint8_t* p, const cec_op_digital_service* service)
+{
+	uint16_t format;
+
+	if (service == NULL) {
+		return 0;
+	}
+	p[0] = service->method_and_broadcast;
+	if ((service->method_and_broadcast & CEC_DSRVCID_METHOD_MASK) == CEC_DSRVCID_METHOD_CHANNEL) {
+		format = service->service.channel.channel_number_high & CEC_CHANID_NUM_FORMAT_MASK;
+		if ((format != CEC_CHANID_1_PART_CHANNEL) && (format != CEC_CHANID_2_PART_CHANNEL)) {
+			return 0;
+		}
+		ceci_build_be16(&p[1], service->service.channel.channel_number_high);
+		ceci_build_be16(&p[3], service->service.channel.channel_number_low);
+		ceci_build_be16(&p[5], 0);
+		return 7;
+	}
+	switch (service->method_and_broadcast & CEC_DSRVCID_BCAST_MASK) {
+	case CEC_DSRVCID_BCAST_ARIB_GEN:
+	case CEC_DSRVCID_BCAST_ARIB_BS:
+	case CEC_DSRVCID_BCAST_ARIB_CS:
+	case CEC_DSRVCID_BCAST_ARIB_T:
+		ceci_build_be16(&p[1], service->service.arib.transport_stream_id);
+		ceci_build_be16(&p[3], service->service.arib.service_id);
+		ceci_build_be16(&p[5], service->service.arib.original_network_id);
+		return 7;
+	case CEC_DSRVCID_BCAST_ATSC_GEN:
+	case CEC_DSRVCID_BCAST_ATSC_CABL:
+	case CEC_DSRVCID_BCAST_ATSC_SAT:
+	case CEC_DSRVCID_BCAST_ATSC_TER:
+		ceci_build_be16(&p[1], service->service.atsc.transport_stream_id);
+		ceci_build_be16(&p[3], service->service.atsc.program_number);
+		ceci_build_be16(&p[5], service->service.atsc.reserved);
+		return 7;
+	case CEC_DSRVCID_BCAST_DVB_GEN:
+	case CEC_DSRVCID_BCAST_DVB_C:
+	case CEC_DSRVCID_BCAST_DVB_S:
+	case CEC_DSRVCID_BCAST_DVB_S2:
+	case CEC_DSRVCID_BCAST_DVB_T:
+		ceci_build_be16(&p[1], service->service.dvb.transport_stream_id);
+		ceci_build_be16(&p[3], service->service.dvb.service_id);
+		ceci_build_be16(&p[5], service->service.dvb.original_network_id);
+		return 7;
+	default:
+		return 0;
+	}
+}
+
+/* The date, start, duration and recording sequence that all the timers start with */
+static inline int ceci_build_timer(uint8_t* p, uint8_t day, uint8_t month, uint8_t hour, uint8_t minute,
+	uint8_t duration_hours, uint8_t duration_minutes, uint8_t recording_sequence)
+{
+	if ( (day < 1) || (day > 31) || (month < 1) || (month > 12) || (hour > 23) || (minute > 59)
+	  || (duration_hours > 99) || (duration_minutes > 59) || (recording_sequence & 0x80) ) {
+		return 0;
+	}
+	p[0] = day;
+	p[1] = month;
+	p[2] = ceci_build_bcd(hour);
+	p[3] = ceci_build_bcd(minute);
+	p[4] = ceci_build_bcd(duration_hours);
+	p[5] = ceci_build_bcd(duration_minutes);
+	p[6] = recording_sequence;
+	return 7;
+}
+
+static inline int ceci_build_analogue_timer(uint8_t* buf, uint8_t src, uint8_t dst, uint8_t opcode,
+	const cec_op_analogue_timer* timer)
+{
+	if ( (timer == NULL) || !ceci_build_directed(buf, src, dst, opcode)
+	  || !ceci_build_timer(&buf[2], timer->day, timer->month, timer->start_time.hour, timer->start_time.minute,
+		timer->duration.hours, timer->duration.minutes, timer->recording_sequence)
+	  || !ceci_build_analogue_service(&buf[9], &timer->analogue) ) {
+		return 0;
+	}
+	return 13;
+}
+
+static inline int ceci_build_digital_timer(uint8_t* buf, uint8_t src, uint8_t dst, uint8_t opcode,
+	const cec_op_digital_timer* timer)
+{
+	if ( (timer == NULL) || !ceci_build_directed(buf, src, dst, opcode)
+	  || !ceci_build_timer(&buf[2], timer->day, timer->month, timer->start_time.hour, timer->start_time.minute,
+		timer->duration.hours, timer->duration.minutes, timer->recording_sequence)
+	  || !ceci_build_digital_service(&buf[9], &timer->digital) ) {
+		return 0;
+	}
+	return 16;
+}
+
+static inline int ceci_build_external_timer(uint8_t* buf, uint8_t src, uint8_t dst, uint8_t opcode,
+	const cec_op_external_timer* timer)
+{
+	if ( (timer == NULL) || !ceci_build_directed(buf, src, dst, opcode)
+	  || !ceci_build_timer(&buf[2], timer->day, timer->month, timer->start_time.hour, timer->start_time.minute,
+		timer->duration.hours, timer->duration.minutes, timer->recording_sequence) ) {
+		return 0;
+	}
+	buf[9] = timer->source_specifier;
+	switch (timer->source_specifier) {
+	case CEC_EXTSRC_PLUG:
+		if (timer->source.plug == 0) {
+			return 0;
+		}
+		buf[10] = timer->source.plug;
+		return 11;
+	case CEC_EXTSRC_PHYSICAL_ADDRESS:
+		if (!ceci_build_physical_address(&buf[10], timer->source.physical_address)) {
+			return 0;
+		}
+		return 12;
+	default:
+		return 0;
+	}
+}
+
+/* RC Profile or Device Features: bit 7 set on all the bytes but the last */
+static inline int ceci_build_features(uint8_t* p, const uint8_t* features, size_t max)
+{
+	size_t i;
+
+	for (i=0; i<max; i++) {
+		p[i] = features[i];
+		if (!(features[i] & 0x80)) {
+			return (int)(i + 1);
+		}
+	}
+	return 0;
+}
+
+static inline int ceci_build_u8(uint8_t* buf, int length, uint8_t val, uint8_t min, uint8_t max)
+{
+	if ((length == 0) || (val < min) || (val > max)) {
+		return 0;
+	}
+	buf[length] = val;
+	return length + 1;
+}
+
+/*
+ * Messages without operands
+ */
+#define CECI_BUILD_DIRECTED(name, opcode) \
+static inline int libcec_build_##name(uint8_t* buf, uint8_t src, uint8_t dst) \
+{ \
+	return ceci_build_directed(buf, src, dst, opcode); \
+}
+
+CECI_BUILD_DIRECTED(image_view_on, CEC_OP_IMAGE_VIEW_ON)
+CECI_BUILD_DIRECTED(tuner_step_increment, CEC_OP_TUNER_STEP_INCREMENT)
+CECI_BUILD_DIRECTED(tuner_step_decrement, CEC_OP_TUNER_STEP_DECREMENT)
+CECI_BUILD_DIRECTED(record_off, CEC_OP_RECORD_OFF)
+CECI_BUILD_DIRECTED(text_view_on, CEC_OP_TEXT_VIEW_ON)
+CECI_BUILD_DIRECTED(record_tv_screen, CEC_OP_RECORD_TV_SCREEN)
+CECI_BUILD_DIRECTED(user_control_released, CEC_OP_USER_CONTROL_RELEASED)
+CECI_BUILD_DIRECTED(give_osd_name, CEC_OP_GIVE_OSD_NAME)
+CECI_BUILD_DIRECTED(give_audio_status, CEC_OP_GIVE_AUDIO_STATUS)
+CECI_BUILD_DIRECTED(give_system_audio_mode_status, CEC_OP_GIVE_SYSTEM_AUDIO_MODE_STATUS)
+CECI_BUILD_DIRECTED(give_physical_address, CEC_OP_GIVE_PHYSICAL_ADDRESS)
+CECI_BUILD_DIRECTED(give_device_vendor_id, CEC_OP_GIVE_DEVICE_VENDOR_ID)
+CECI_BUILD_DIRECTED(give_device_power_status, CEC_OP_GIVE_DEVICE_POWER_STATUS)
+CECI_BUILD_DIRECTED(get_menu_language, CEC_OP_GET_MENU_LANGUAGE)
+CECI_BUILD_DIRECTED(get_cec_version, CEC_OP_GET_CEC_VERSION)
+CECI_BUILD_DIRECTED(give_features, CEC_OP_GIVE_FEATURES)
+CECI_BUILD_DIRECTED(initiate_arc, CEC_OP_INITIATE_ARC)
+CECI_BUILD_DIRECTED(report_arc_initiated, CEC_OP_REPORT_ARC_INITIATED)
+CECI_BUILD_DIRECTED(report_arc_terminated, CEC_OP_REPORT_ARC_TERMINATED)
+CECI_BUILD_DIRECTED(request_arc_initiation, CEC_OP_REQUEST_ARC_INITIATION)
+CECI_BUILD_DIRECTED(request_arc_termination, CEC_OP_REQUEST_ARC_TERMINATION)
+CECI_BUILD_DIRECTED(terminate_arc, CEC_OP_TERMINATE_ARC)
+CECI_BUILD_DIRECTED(abort, CEC_OP_ABORT)
+
+static inline int libcec_build_standby(uint8_t* buf, uint8_t src, uint8_t dst)
+{
+	return ceci_build_any(buf, src, dst, CEC_OP_STANDBY);
+}
+
+static inline int libcec_build_vendor_remote_button_up(uint8_t* buf, uint8_t src, uint8_t dst)
+{
+	return ceci_build_any(buf, src, dst, CEC_OP_VENDOR_REMOTE_BUTTON_UP);
+}
+
+static inline int libcec_build_request_active_source(uint8_t* buf, uint8_t src)
+{
+	return ceci_build_broadcast(buf, src, CEC_OP_REQUEST_ACTIVE_SOURCE);
+}
+
+/*
+ * Messages with single byte operands
+ */
+static inline int libcec_build_feature_abort(uint8_t* buf, uint8_t src, uint8_t dst,
+	uint8_t feature_opcode, uint8_t abort_reason)
+{
+	return ceci_build_u8(buf, ceci_build_u8(buf, ceci_build_directed(buf, src, dst, CEC_OP_FEATURE_ABORT),
+		feature_opcode, 0x00, 0xFF), abort_reason, 0x00, CEC_ABORT_UNABLE_TO_DETERMINE);
+}
+
+static inline int libcec_build_give_tuner_device_status(uint8_t* buf, uint8_t src, uint8_t dst, cec_op_status_request request)
+{
+	return ceci_build_u8(buf, ceci_build_directed(buf, src, dst, CEC_OP_GIVE_TUNER_DEVICE_STATUS),
+		request, CEC_STATUSREPORT_ON, CEC_STATUSREPORT_ONCE);
+}
+
+static inline int libcec_build_record_status(uint8_t* buf, uint8_t src, uint8_t dst, uint8_t status)
+{
+	return ceci_build_u8(buf, ceci_build_directed(buf, src, dst, CEC_OP_RECORD_STATUS),
+		status, CEC_RECORDING_CURRENT, CEC_NO_RECORD_OTHER);
+}
+
+static inline int libcec_build_give_deck_status(uint8_t* buf, uint8_t src, uint8_t dst, cec_op_status_request request)
+{
+	return ceci_build_u8(buf, ceci_build_directed(buf, src, dst, CEC_OP_GIVE_DECK_STATUS),
+		request, CEC_STATUSREPORT_ON, CEC_STATUSREPORT_ONCE);
+}
+
+static inline int libcec_build_deck_status(uint8_t* buf, uint8_t src, uint8_t dst, cec_op_deck_info info)
+{
+	return ceci_build_u8(buf, ceci_build_directed(buf, src, dst, CEC_OP_DECK_STATUS),
+		info, CEC_DECKINFO_PLAY, CEC_DECKINFO_OTHER_STATUS);
+}
+
+static inline int libcec_build_play(uint8_t* buf, uint8_t src, uint8_t dst, cec_op_play_mode mode)
+{
+	return ceci_build_u8(buf, ceci_build_directed(buf, src, dst, CEC_OP_PLAY),
+		mode, CEC_PLAYMODE_FF_MIN_SPEED, CEC_PLAYMODE_PLAY_STILL);
+}
+
+static inline int libcec_build_deck_control(uint8_t* buf, uint8_t src, uint8_t dst, cec_op_deck_control_mode mode)
+{
+	return ceci_build_u8(buf, ceci_build_directed(buf, src, dst, CEC_OP_DECK_CONTROL),
+		mode, CEC_DECKCTRL_FORWARD, CEC_DECKCTRL_EJECT);
+}
+
+static inline int libcec_build_timer_cleared_status(uint8_t* buf, uint8_t src, uint8_t dst, uint8_t status)
+{
+	return ceci_build_u8(buf, ceci_build_directed(buf, src, dst, CEC_OP_TIMER_CLEARED_STATUS),
+		status, CEC_TIMERCLR_RECORDING, CEC_TIMERCLR_CLEARED);
+}
+
+static inline int libcec_build_user_control_pressed(uint8_t* buf, uint8_t src, uint8_t dst, cec_op_ui_command command)
+{
+	return ceci_build_u8(buf, ceci_build_directed(buf, src, dst, CEC_OP_USER_CONTROL_PRESSED),
+		command, 0x00, 0xFF);
+}
+
+static inline int libcec_build_set_system_audio_mode(uint8_t* buf, uint8_t src, uint8_t dst, cec_op_system_audio_status status)
+{
+	return ceci_build_u8(buf, ceci_build_any(buf, src, dst, CEC_OP_SET_SYSTEM_AUDIO_MODE),
+		status, CEC_SYSAUDIO_OFF, CEC_SYSAUDIO_ON);
+}
+
+static inline int libcec_build_report_audio_status(uint8_t* buf, uint8_t src, uint8_t dst, cec_op_audio_status status)
+{
+	return ceci_build_u8(buf, ceci_build_directed(buf, src, dst, CEC_OP_REPORT_AUDIO_STATUS),
+		status, 0x00, 0xFF);
+}
+
+static inline int libcec_build_system_audio_mode_status(uint8_t* buf, uint8_t src, uint8_t dst, cec_op_system_audio_status status)
+{
+	return ceci_build_u8(buf, ceci_build_directed(buf, src, dst, CEC_OP_SYSTEM_AUDIO_MODE_STATUS),
+		status, CEC_SYSAUDIO_OFF, CEC_SYSAUDIO_ON);
+}
+
+static inline int libcec_build_menu_request(uint8_t* buf, uint8_t src, uint8_t dst, cec_op_menu_request_type type)
+{
+	return ceci_build_u8(buf, ceci_build_directed(buf, src, dst, CEC_OP_MENU_REQUEST),
+		type, CEC_MENUREQUEST_ACTIVATE, CEC_MENUREQUEST_QUERY);
+}
+
+static inline int libcec_build_menu_status(uint8_t* buf, uint8_t src, uint8_t dst, cec_op_menu_state state)
+{
+	return ceci_build_u8(buf, ceci_build_directed(buf, src, dst, CEC_OP_MENU_STATUS),
+		state, CEC_MENUSTATE_ACTIVATED, CEC_MENUSTATE_DEACTIVATED);
+}
+
+static inline int libcec_build_report_power_status(uint8_t* buf, uint8_t src, uint8_t dst, cec_op_power_status status)
+{
+	return ceci_build_u8(buf, ceci_build_directed(buf, src, dst, CEC_OP_REPORT_POWER_STATUS),
+		status, CEC_POWERSTATUS_ON, CEC_POWERSTATUS_ON_TO_STDBY);
+}
+
+static inline int libcec_build_set_audio_rate(uint8_t* buf, uint8_t src, uint8_t dst, cec_op_audio_rate rate)
+{
+	return ceci_build_u8(buf, ceci_build_directed(buf, src, dst, CEC_OP_SET_AUDIO_RATE),
+		rate, CEC_AUDIORATE_CONTROL_OFF, CEC_AUDIORATE_NARROW_SLOW);
+}
+
+static inline int libcec_build_cec_version(uint8_t* buf, uint8_t src, uint8_t dst, cec_op_cec_version version)
+{
+	return ceci_build_u8(buf, ceci_build_directed(buf, src, dst, CEC_OP_CEC_VERSION),
+		version, 0x00, 0xFF);
+}
+
+/*
+ * Messages with physical addresses
+ */
+static inline int libcec_build_system_audio_mode_request(uint8_t* buf, uint8_t src, uint8_t dst, cec_op_physical_address pa)
+{
+	if (!ceci_build_directed(buf, src, dst, CEC_OP_SYSTEM_AUDIO_MODE_REQUEST)) {
+		return 0;
+	}
+	/* without a physical address, the request turns the system audio mode off */
+	if (pa == 0xFFFF) {
+		return 2;
+	}
+	return ceci_build_physical_address(&buf[2], pa) ? 4 : 0;
+}
+
+static inline int libcec_build_routing_change(uint8_t* buf, uint8_t src,
+	cec_op_physical_address original_address, cec_op_physical_address new_address)
+{
+	if ( !ceci_build_broadcast(buf, src, CEC_OP_ROUTING_CHANGE)
+	  || !ceci_build_physical_address(&buf[2], original_address)
+	  || !ceci_build_physical_address(&buf[4], new_address) ) {
+		return 0;
+	}
+	return 6;
+}
+
+static inline int libcec_build_routing_information(uint8_t* buf, uint8_t src, cec_op_physical_address pa)
+{
+	return (ceci_build_broadcast(buf, src, CEC_OP_ROUTING_INFORMATION) && ceci_build_physical_address(&buf[2], pa)) ? 4 : 0;
+}
+
+static inline int libcec_build_active_source(uint8_t* buf, uint8_t src, cec_op_physical_address pa)
+{
+	return (ceci_build_broadcast(buf, src, CEC_OP_ACTIVE_SOURCE) && ceci_build_physical_address(&buf[2], pa)) ? 4 : 0;
+}
+
+static inline int libcec_build_report_physical_address(uint8_t* buf, uint8_t src, cec_op_physical_address pa, uint8_t device_type)
+{
+	if ( !ceci_build_broadcast(buf, src, CEC_OP_REPORT_PHYSICAL_ADDRESS)
+	  || !ceci_build_physical_address(&buf[2], pa) ) {
+		return 0;
+	}
+	return ceci_build_u8(buf, 4, device_type, CEC_DEVTYPE_TV, 0x07);
+}
+
+static inline int libcec_build_set_stream_path(uint8_t* buf, uint8_t src, cec_op_physical_address pa)
+{
+	return (ceci_build_broadcast(buf, src, CEC_OP_SET_STREAM_PATH) && ceci_build_physical_address(&buf[2], pa)) ? 4 : 0;
+}
+
+static inline int libcec_build_inactive_source(uint8_t* buf, uint8_t src, uint8_t dst, cec_op_physical_address pa)
+{
+	return (ceci_build_directed(buf, src, dst, CEC_OP_INACTIVE_SOURCE) && ceci_build_physical_address(&buf[2], pa)) ? 4 : 0;
+}
+
+static inline int libcec_build_request_current_latency(uint8_t* buf, uint8_t src, cec_op_physical_address pa)
+{
+	return (ceci_build_broadcast(buf, src, CEC_OP_REQUEST_CURRENT_LATENCY) && ceci_build_physical_address(&buf[2], pa)) ? 4 : 0;
+}
+
+static inline int libcec_build_report_current_latency(uint8_t* buf, uint8_t src, const cec_op_current_latency* latency)
+{
+	int length;
+
+	if ( (latency == NULL) || !ceci_build_broadcast(buf, src, CEC_OP_REPORT_CURRENT_LATENCY)
+	  || !ceci_build_physical_address(&buf[2], latency->physical_address) ) {
+		return 0;
+	}
+	length = ceci_build_u8(buf, ceci_build_u8(buf, 4, latency->video_latency, 0x01, 0xFB), latency->latency_flags, 0x00, 0xFF);
+	/* the audio output delay is only sent when it is known */
+	if (latency->audio_output_delay == 0) {
+		return length;
+	}
+	return ceci_build_u8(buf, length, latency->audio_output_delay, 0x01, 0xFB);
+}
+
+/*
+ * Messages with strings or raw data
+ */
+static inline int libcec_build_set_menu_language(uint8_t* buf, uint8_t src, const char* language)
+{
+	if (!ceci_build_broadcast(buf, src, CEC_OP_SET_MENU_LANGUAGE) || !ceci_build_ascii(&buf[2], language, 3, 3)) {
+		return 0;
+	}
+	return 5;
+}
+
+static inline int libcec_build_set_osd_name(uint8_t* buf, uint8_t src, uint8_t dst, const char* name)
+{
+	int length;
+
+	if ( !ceci_build_directed(buf, src, dst, CEC_OP_SET_OSD_NAME)
+	  || !(length = ceci_build_ascii(&buf[2], name, 1, 14)) ) {
+		return 0;
+	}
+	return length + 2;
+}
+
+static inline int libcec_build_set_osd_string(uint8_t* buf, uint8_t src, uint8_t dst, uint8_t display_control, const char* str)
+{
+	int length;
+
+	/* Display Control is a value in the top 2 bits, the last of which is reserved */
+	if ( (display_control & 0x3F) || (display_control == CEC_DISPLAY_RESERVED)
+	  || !ceci_build_directed(buf, src, dst, CEC_OP_SET_OSD_STRING)
+	  || !(length = ceci_build_ascii(&buf[3], str, 1, 13)) ) {
+		return 0;
+	}
+	buf[2] = display_control;
+	return length + 3;
+}
+
+static inline int libcec_build_set_timer_program_title(uint8_t* buf, uint8_t src, uint8_t dst, const char* title)
+{
+	int length;
+
+	if ( !ceci_build_directed(buf, src, dst, CEC_OP_SET_TIMER_PROGRAM_TITLE)
+	  || !(length = ceci_build_ascii(&buf[2], title, 1, 14)) ) {
+		return 0;
+	}
+	return length + 2;
+}
+
+static inline int libcec_build_device_vendor_id(uint8_t* buf, uint8_t src, uint32_t vendor_id)
+{
+	if ((vendor_id > 0xFFFFFF) || !ceci_build_broadcast(buf, src, CEC_OP_DEVICE_VENDOR_ID)) {
+		return 0;
+	}
+	buf[2] = (uint8_t)(vendor_id >> 16);
+	buf[3] = (uint8_t)(vendor_id >> 8);
+	buf[4] = (uint8_t)vendor_id;
+	return 5;
+}
+
+static inline int libcec_build_vendor_command(uint8_t* buf, uint8_t src, uint8_t dst, const uint8_t* data, size_t length)
+{
+	if ( !ceci_build_directed(buf, src, dst, CEC_OP_VENDOR_COMMAND)
+	  || !ceci_build_bytes(&buf[2], data, length, 1, 14) ) {
+		return 0;
+	}
+	return (int)length + 2;
+}
+
+static inline int libcec_build_vendor_remote_button_down(uint8_t* buf, uint8_t src, uint8_t dst, const uint8_t* rc_code, size_t length)
+{
+	if ( !ceci_build_any(buf, src, dst, CEC_OP_VENDOR_REMOTE_BUTTON_DOWN)
+	  || !ceci_build_bytes(&buf[2], rc_code, length, 1, 14) ) {
+		return 0;
+	}
+	return (int)length + 2;
+}
+
+static inline int libcec_build_vendor_command_with_id(uint8_t* buf, uint8_t src, uint8_t dst,
+	uint32_t vendor_id, const uint8_t* data, size_t length)
+{
+	if ( (vendor_id > 0xFFFFFF) || !ceci_build_any(buf, src, dst, CEC_OP_VENDOR_COMMAND_WITH_ID)
+	  || !ceci_build_bytes(&buf[5], data, length, 0, 11) ) {
+		return 0;
+	}
+	buf[2] = (uint8_t)(vendor_id >> 16);
+	buf[3] = (uint8_t)(vendor_id >> 8);
+	buf[4] = (uint8_t)vendor_id;
+	return (int)length + 5;
+}
+
+/* count descriptors of 3 bytes each */
+static inline int libcec_build_report_short_audio_descriptor(uint8_t* buf, uint8_t src, uint8_t dst,
+	const uint8_t* descriptors, size_t count)
+{
+	if ( !ceci_build_directed(buf, src, dst, CEC_OP_REPORT_SHORT_AUDIO_DESCRIPTOR)
+	  || !ceci_build_bytes(&buf[2], descriptors, 3 * count, 3, 12) ) {
+		return 0;
+	}
+	return (int)(3 * count) + 2;
+}
+
+static inline int libcec_build_request_short_audio_descriptor(uint8_t* buf, uint8_t src, uint8_t dst,
+	const uint8_t* audio_format_ids, size_t count)
+{
+	if ( !ceci_build_directed(buf, src, dst, CEC_OP_REQUEST_SHORT_AUDIO_DESCRIPTOR)
+	  || !ceci_build_bytes(&buf[2], audio_format_ids, count, 1, 4) ) {
+		return 0;
+	}
+	return (int)count + 2;
+}
+
+/* data starts with the initiator's physical address and the CDC opcode */
+static inline int libcec_build_cdc_message(uint8_t* buf, uint8_t src, const uint8_t* data, size_t length)
+{
+	if (!ceci_build_broadcast(buf, src, CEC_OP_CDC_MESSAGE) || !ceci_build_bytes(&buf[2], data, length, 3, 14)) {
+		return 0;
+	}
+	return (int)length + 2;
+}
+
+/*
+ * Messages with structured operands
+ */
+static inline int libcec_build_report_features(uint8_t* buf, uint8_t src, const cec_op_features* features)
+{
+	int length, n;
+
+	if ((features == NULL) || !ceci_build_broadcast(buf, src, CEC_OP_REPORT_FEATURES)) {
+		return 0;
+	}
+	buf[2] = features->cec_version;
+	buf[3] = features->all_device_types;
+	length = 4;
+	if (!(n = ceci_build_features(&buf[length], features->rc_profile, sizeof(features->rc_profile)))) {
+		return 0;
+	}
+	length += n;
+	if (!(n = ceci_build_features(&buf[length], features->device_features, sizeof(features->device_features)))) {
+		return 0;
+	}
+	return length + n;
+}
+
+/*
+ * The display field of the tuner info tells which service is sent, except
+ * when no tuner is displayed, where digital selects the member of the union.
+ */
+static inline int libcec_build_tuner_device_status(uint8_t* buf, uint8_t src, uint8_t dst,
+	const cec_op_tuner_device_info* info, int digital)
+{
+	if ((info == NULL) || !ceci_build_directed(buf, src, dst, CEC_OP_TUNER_DEVICE_STATUS)) {
+		return 0;
+	}
+	buf[2] = info->tuner_info;
+	switch (info->tuner_info & CEC_TUNINFO_DISPLAY_MASK) {
+	case CEC_TUNINFO_DISPLAY_DTUNER:
+		digital = 1;
+		break;
+	case CEC_TUNINFO_DISPLAY_ATUNER:
+		digital = 0;
+		break;
+	case CEC_TUNINFO_DISPLAY_NOTUNER:
+		break;
+	default:
+		return 0;
+	}
+	if (digital) {
+		return ceci_build_digital_service(&buf[3], &info->source.digital) ? 10 : 0;
+	}
+	return ceci_build_analogue_service(&buf[3], &info->source.analogue) ? 7 : 0;
+}
+
+static inline int libcec_build_record_on(uint8_t* buf, uint8_t src, uint8_t dst, const cec_op_record_source* source)
+{
+	if ((source == NULL) || !ceci_build_directed(buf, src, dst, CEC_OP_RECORD_ON)) {
+		return 0;
+	}
+	buf[2] = source->record_source_type;
+	switch (source->record_source_type) {
+	case CEC_RECORDSRC_OWN_SOURCE:
+		return 3;
+	case CEC_RECORDSRC_DIGITAL:
+		return ceci_build_digital_service(&buf[3], &source->source.digital) ? 10 : 0;
+	case CEC_RECORDSRC_ANALOGUE:
+		return ceci_build_analogue_service(&buf[3], &source->source.analogue) ? 7 : 0;
+	case CEC_RECORDSRC_EXT_PLUG:
+		if (source->source.plug == 0) {
+			return 0;
+		}
+		buf[3] = source->source.plug;
+		return 4;
+	case CEC_RECORDSRC_EXT_ADDRESS:
+		return ceci_build_physical_address(&buf[3], source->source.physical_address) ? 5 : 0;
+	default:
+		return 0;
+	}
+}
+
+static inline int libcec_build_select_analogue_service(uint8_t* buf, uint8_t src, uint8_t dst,
+	const cec_op_analogue_service* service)
+{
+	if ( !ceci_build_directed(buf, src, dst, CEC_OP_SELECT_ANALOGUE_SERVICE)
+	  || !ceci_build_analogue_service(&buf[2], service) ) {
+		return 0;
+	}
+	return 6;
+}
+
+static inline int libcec_build_select_digital_service(uint8_t* buf, uint8_t src, uint8_t dst,
+	const cec_op_digital_service* service)
+{
+	if ( !ceci_build_directed(buf, src, dst, CEC_OP_SELECT_DIGITAL_SERVICE)
+	  || !ceci_build_digital_service(&buf[2], service) ) {
+		return 0;
+	}
+	return 9;
+}
+
+/* The duration available (in minutes) is only sent when it isn't 0 */
+static inline int libcec_build_timer_status(uint8_t* buf, uint8_t src, uint8_t dst, const cec_op_timer_status_data* status)
+{
+	if ((status == NULL) || !ceci_build_directed(buf, src, dst, CEC_OP_TIMER_STATUS)) {
+		return 0;
+	}
+	buf[2] = status->info;
+	if (status->duration_available == 0) {
+		return 3;
+	}
+	if (status->duration_available > 99 * 60 + 59) {
+		return 0;
+	}
+	buf[3] = ceci_build_bcd((uint8_t)(status->duration_available / 60));
+	buf[4] = ceci_build_bcd((uint8_t)(status->duration_available % 60));
+	return 5;
+}
+
+static inline int libcec_build_clear_analogue_timer(uint8_t* buf, uint8_t src, uint8_t dst, const cec_op_analogue_timer* timer)
+{
+	return ceci_build_analogue_timer(buf, src, dst, CEC_OP_CLEAR_ANALOGUE_TIMER, timer);
+}
+
+static inline int libcec_build_set_analogue_timer(uint8_t* buf, uint8_t src, uint8_t dst, const cec_op_analogue_timer* timer)
+{
+	return ceci_build_analogue_timer(buf, src, dst, CEC_OP_SET_ANALOGUE_TIMER, timer);
+}
+
+static inline int libcec_build_set_digital_timer(uint8_t* buf, uint8_t src, uint8_t dst, const cec_op_digital_timer* timer)
+{
+	return ceci_build_digital_timer(buf, src, dst, CEC_OP_SET_DIGITAL_TIMER, timer);
+}
+
+static inline int libcec_build_clear_digital_timer(uint8_t* buf, uint8_t src, uint8_t dst, const cec_op_digital_timer* timer)
+{
+	return ceci_build_digital_timer(buf, src, dst, CEC_OP_CLEAR_DIGITAL_TIMER, timer);
+}
+
+static inline int libcec_build_clear_external_timer(uint8_t* buf, uint8_t src, uint8_t dst, const cec_op_external_timer* timer)
+{
+	return ceci_build_external_timer(buf, src, dst, CEC_OP_CLEAR_EXTERNAL_TIMER, timer);
+}
+
+static inline int libcec_build_set_external_timer(uint8_t* buf, uint8_t src, uint8_t dst, const cec_op_external_timer* timer)
+{
+	return ceci_build_external_timer(buf, src, dst, CEC_OP_SET_EXTERNAL_TIMER, timer);
+}
+
+#endif
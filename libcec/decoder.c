@@ -18,217 +18,727 @@
  */
 
 #include <config.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define CECI_BATCH_SIMD
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CECI_BATCH_SIMD
+#endif
 
 #include "libceci.h"
 #include "decoder.h"
 
-static uint8_t msg_min_max[16][2] = {
-	{ 0, 0},	// 0
-	{ 1, 1},	// 1
-	{ 2, 2},	// 2
-	{ 3, 3},	// 3
-	{ 4, 4},	// 4
-	{ 5, 8},	// 5
-	{ 1, 3},	// 6
-	{ 7, 7},	// 7
-	{ 4, 8},	// 8
-	{ 9, 10},	// 9
-	{ 2, 14},	// A
-	{ 11, 11},	// B
-	{ 1, 14},	// C
-	{ 3, 17},	// D
-	{ 14, 14},	// E
-	{ 3, 14},	// F
+/*
+ * Operand layouts. Each operand is parsed from the frame in turn, validated,
+ * and stored at its offset in the op union of a cec_parsed_message. Operands
+ * beyond the layout are ignored, as the specs require for forward compatibility.
+ */
+enum ceci_operand_type {
+	OPND_END = 0,
+	OPND_U8,				/* one byte in [min, max] */
+	OPND_PHYS_ADDR,
+	OPND_VENDOR_ID,
+	OPND_ASCII,				/* [min, max] printable chars, to the end of the frame */
+	OPND_BYTES,				/* [min, max] bytes, to the end of the frame */
+	OPND_ANALOGUE_SERVICE,
+	OPND_DIGITAL_SERVICE,
+	OPND_RECORD_SOURCE,
+	OPND_TUNER_INFO,
+	OPND_TIMER,				/* date, start, duration and recording sequence of any timer */
+	OPND_EXT_SOURCE,		/* of an external timer */
+	OPND_TIMER_STATUS,
+	OPND_FEATURES,			/* bytes up to the first without bit 7, the first max of them kept */
+	OPND_DISPLAY_CONTROL,	/* one of the CEC_DISPLAY_ values, bar the reserved one */
+	OPND_OPTIONAL = 0x80	/* flag: the frame may end before this operand */
 };
 
+typedef struct {
+	uint8_t type;
+	uint8_t offset;
+	uint8_t min;
+	uint8_t max;
+} ceci_operand;
+
+#define CECI_MAX_OPERANDS	4
+#define OPND(type, field, min, max)	{ type, offsetof(cec_parsed_message, op.field) - offsetof(cec_parsed_message, op), min, max }
+#define U8(field, min, max)			OPND(OPND_U8, field, min, max)
+#define PHYS_ADDR(field)			OPND(OPND_PHYS_ADDR, field, 2, 2)
+#define NONE						{ OPND_END, 0, 0, 0 }
+#define CECI_UNPAREN(...)			__VA_ARGS__
+
+/* Addressing of an opcode. Unknown opcodes have neither. */
+#define DIRECTED					0x01
+#define BROADCAST					0x02
+#define BOTH						(DIRECTED | BROADCAST)
+
 /*
- * bit[0-4] = msg_min_max index
- * bit[5] = directly addressed
- * bit[6] = broadcast
- * bit[7] = reserved
- * NB: bits 5,6 = 00 => invalid opcode
+ * The tables below are all expanded from opcodes.def. The names are packed
+ * into a single struct of strings, so that descriptors can refer to them by
+ * offset, and only the opcodes that exist get an operand layout.
  */
-static uint8_t msg_props[256] = {
-//	 0    1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
-	0x22,0x00,0x00,0x00,0x20,0x20,0x20,0x25,0x21,0x28,0x21,0x20,0x00,0x20,0x00,0x20,  //  0
-	0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x21,0x21,0x00,0x00,0x00,0x00,  //  1
-	0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,  //  2
-	0x00,0x00,0x43,0x2b,0x2b,0x26,0x60,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,  //  3
-	0x00,0x21,0x21,0x21,0x21,0x20,0x20,0x2c,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,  //  4
-	0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,  //  5
-	0x00,0x00,0x00,0x00,0x2a,0x00,0x00,0x2c,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,  //  6
-	0x22,0x20,0x61,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x21,0x00,0x00,0x20,0x21,0x00,  //  7
-	0x44,0x42,0x42,0x20,0x43,0x40,0x42,0x43,0x00,0x2c,0x6c,0x60,0x20,0x21,0x21,0x20,  //  8
-	0x21,0x20,0x24,0x27,0x00,0x00,0x00,0x2e,0x00,0x2e,0x21,0x00,0x00,0x22,0x21,0x20,  //  9
-	0x6d,0x29,0x29,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,  //  A
-	0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,  //  B
-	0x20,0x20,0x20,0x20,0x20,0x20,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,  //  C
-	0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,  //  D
-	0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,  //  E
-	0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x4f,0x00,0x00,0x00,0x00,0x00,0x00,0x20,  //  F
+static const struct ceci_opcode_names {
+#define CEC_OPCODE(sym, opcode, name, ...)	char sym[sizeof(name)];
+#include "opcodes.def"
+#undef CEC_OPCODE
+} ceci_opcode_names = {
+#define CEC_OPCODE(sym, opcode, name, ...)	name,
+#include "opcodes.def"
+#undef CEC_OPCODE
+};
+
+enum ceci_layout_index {
+#define CEC_OPCODE(sym, ...)	CECI_LAYOUT_##sym,
+#include "opcodes.def"
+#undef CEC_OPCODE
 };
 
-// TODO: add an option to not include these messages
-static char* msg_description[70] = {
-	"*Unsupported Opcode*",			// N/A		0
-	"Feature Abort",				// 0x00		1
-	"Image View On",				// 0x04		2
-	"Tuner Step Increment",			// 0x05		3
-	"Tuner Step Decrement",			// 0x06		4
-	"Tuner Device Status",			// 0x07		5
-	"Give Tuner Device Status",		// 0x08		6
-	"Record On",					// 0x09		7
-	"Record Status",				// 0x0A		8
-	"Record Off",					// 0x0B		9
-	"Text View On",					// 0x0D		10
-	"Record TV Screen",				// 0x0F		11
-	"Give Deck Status",				// 0x1A		12
-	"Deck Status",					// 0x1B		13
-	"Set Menu Language",			// 0x32		14
-	"Clear Analogue Timer",			// 0x33		15
-	"Set Analogue Timer",			// 0x34		16
-	"Timer Status",					// 0x35		17
-	"Standby",						// 0x36		18
-	"Play",							// 0x41		19
-	"Deck Control",					// 0x42		20
-	"Timer Cleared Status",			// 0x43		21
-	"User Control Pressed",			// 0x44		22
-	"User Control Released",		// 0x45		23
-	"Give OSD Name",				// 0x46		24
-	"Set OSD Name",					// 0x47		25
-	"Set OSD String",				// 0x64		26
-	"Set Timer Program Title",		// 0x67		27
-	"System Audio Mode Request",	// 0x70		28
-	"Give Audio Status",			// 0x71		29
-	"Set System Audio Mode",		// 0x72		30
-	"Report Audio Status",			// 0x7A		31
-	"Give System Audio Mode Status",// 0x7D		32
-	"System Audio Mode Status",		// 0x7E		33
-	"Routing Change",				// 0x80		34
-	"Routing Information",			// 0x81		35
-	"Active Source",				// 0x82		36
-	"Give Physical Address",		// 0x83		37
-	"Report Physical Address",		// 0x84		38
-	"Request Active Source",		// 0x85		39
-	"Set Stream Path",				// 0x86		40
-	"Device Vendor ID",				// 0x87		41
-	"Vendor Command",				// 0x89		42
-	"Vendor Remote Button Down",	// 0x8A		43
-	"Vendor Remote Button Up",		// 0x8B		44
-	"Give Device Vendor ID",		// 0x8C		45
-	"Menu Request",					// 0x8D		46
-	"Menu Status",					// 0x8E		47
-	"Give Device Power Status",		// 0x8F		48
-	"Report Power Status",			// 0x90		49
-	"Get Menu Language",			// 0x91		50
-	"Select Analogue Service",		// 0x92		51
-	"Select Digital Service",		// 0x93		52
-	"Set Digital Timer",			// 0x97		53
-	"Clear Digital Timer",			// 0x99		54
-	"Set Audio Rate",				// 0x9A		55
-	"Inactive Source",				// 0x9D		56
-	"CEC Version",					// 0x9E		57
-	"Get CEC Version",				// 0x9F		58
-	"Vendor Command With ID",		// 0xA0		59
-	"Clear External Timer",			// 0xA1		60
-	"Set External Timer",			// 0xA2		61
-	"Initiate ARC",					// 0xC0		62
-	"Report ARC Initiated",			// 0xC1		63
-	"Report ARC Terminated",		// 0xC2		64
-	"Request ARC Initiation",		// 0xC3		65
-	"Request ARC Termination",		// 0xC4		66
-	"Terminate ARC",				// 0xC5		67
-	"CDC Message",					// 0xF8		68
-	"Abort",						// 0xFF		69
+static const ceci_operand ceci_layouts[][CECI_MAX_OPERANDS] = {
+#define CEC_OPCODE(sym, opcode, name, addressing, min, max, operands)	{ CECI_UNPAREN operands },
+#include "opcodes.def"
+#undef CEC_OPCODE
 };
 
-static uint8_t msg_index[256] = {
-//	 0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
-	01,00,00,00,02,03,04,05,06,07, 8, 9,00,10,00,11,  //  0
-	00,00,00,00,00,00,00,00,00,00,12,13,00,00,00,00,  //  1
-	00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,  //  2
-	00,00,14,15,16,17,18,00,00,00,00,00,00,00,00,00,  //  3
-	00,19,20,21,22,23,24,25,00,00,00,00,00,00,00,00,  //  4
-	00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,  //  5
-	00,00,00,00,26,00,00,27,00,00,00,00,00,00,00,00,  //  6
-	28,29,31,00,00,00,00,00,00,00,31,00,00,32,33,00,  //  7
-	34,35,36,37,38,39,40,41,00,42,43,44,45,46,47,48,  //  8
-	49,50,51,52,00,00,00,53,00,54,55,00,00,56,57,58,  //  9
-	59,60,61,00,00,00,00,00,00,00,00,00,00,00,00,00,  //  A
-	00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,  //  B
-	62,63,64,65,66,67,00,00,00,00,00,00,00,00,00,00,  //  C
-	00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,  //  D
-	00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,  //  E
-	00,00,00,00,00,00,00,00,68,00,00,00,00,00,00,69,  //  F
+/*
+ * One 8 byte descriptor per opcode, so that validating a message only takes
+ * a single lookup, and a cache line covers 8 consecutive opcodes. The lengths
+ * are those of the operands. Unknown opcodes are left zeroed.
+ */
+typedef struct {
+	uint8_t		addressing;
+	uint8_t		min_length;
+	uint8_t		max_length;
+	uint8_t		layout;			/* index in ceci_layouts */
+	uint32_t	name;			/* offset in ceci_opcode_names */
+} ceci_opcode_desc;
+
+static const ceci_opcode_desc ceci_opcodes[256] = {
+#define CEC_OPCODE(sym, opcode, name, addressing, min, max, operands) \
+	[opcode] = { addressing, min, max, CECI_LAYOUT_##sym, offsetof(struct ceci_opcode_names, sym) },
+#include "opcodes.def"
+#undef CEC_OPCODE
 };
 
-static void display_buffer_hex(uint8_t *buffer, size_t length)
+/* Fail the build if the spec and the CEC_OP_ constants of decoder.h disagree */
+#define CEC_OPCODE(sym, opcode, ...)	typedef char ceci_check_##sym[(CEC_OP_##sym == (opcode)) ? 1 : -1];
+#include "opcodes.def"
+#undef CEC_OPCODE
+
+#define OPCODE_NAME(desc)	((const char*)&ceci_opcode_names + (desc)->name)
+
+/*
+ * Check the addressing and the length of a message against its opcode,
+ * without logging anything. Returns LIBCEC_SUCCESS, LIBCEC_ERROR_NOT_SUPPORTED
+ * for an unknown opcode, LIBCEC_ERROR_OTHER for a message sent with the wrong
+ * addressing, or LIBCEC_ERROR_INVALID_PARAM for a payload of the wrong length.
+ * Operand values are only checked by libcec_parse_message().
+ */
+DEFAULT_VISIBILITY
+int libcec_validate_message(const uint8_t* message, size_t length)
 {
-	size_t i;
+	const ceci_opcode_desc* desc;
 
-	if (ceci_global_log_level > LIBCEC_LOG_LEVEL_INFO) {
-		return;
+	if ((message == NULL) || (length < 1) || (length > CEC_MAX_COMMAND_SIZE)) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	// Polling Message
+	if (length == 1) {
+		return LIBCEC_SUCCESS;
 	}
 
-	for (i=0; i<length; i++) {
-		if (!(i%0x10))
-			fprintf(ceci_logger, "                                                               ");
-		fprintf(ceci_logger, " %02X", buffer[i]);
+	desc = &ceci_opcodes[message[1]];
+	if (desc->addressing == 0) {
+		return LIBCEC_ERROR_NOT_SUPPORTED;
+	}
+	if (!(desc->addressing & (((message[0] & 0x0F) == 0x0F) ? BROADCAST : DIRECTED))) {
+		return LIBCEC_ERROR_OTHER;
 	}
-	fprintf(ceci_logger, "\n");
-	fflush(ceci_logger);
+	if ((length-2 < desc->min_length) || (length-2 > desc->max_length)) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	return LIBCEC_SUCCESS;
 }
 
+#ifdef CECI_BATCH_SIMD
+/*
+ * Batch validation processes frames by groups of CECI_BATCH_LANES. The bytes
+ * a verdict depends on are first gathered from the frames and from their
+ * descriptors, which are scattered and can't be loaded as vectors, and the
+ * checks are then done for the whole group at once. The lengths compared are
+ * those of the frames, so that polling messages can't underflow.
+ */
+#define CECI_BATCH_LANES	16
+
+typedef struct {
+	uint8_t header[CECI_BATCH_LANES];
+	uint8_t length[CECI_BATCH_LANES];
+	uint8_t addressing[CECI_BATCH_LANES];
+	uint8_t min_length[CECI_BATCH_LANES];
+	uint8_t max_length[CECI_BATCH_LANES];
+} ceci_batch_lanes;
+
+static void batch_gather(const libcec_frame* frames, ceci_batch_lanes* lanes)
+{
+	const ceci_opcode_desc* desc;
+	int i;
+
+	for (i=0; i<CECI_BATCH_LANES; i++) {
+		desc = &ceci_opcodes[frames[i].data[1]];
+		lanes->header[i] = frames[i].data[0];
+		lanes->length[i] = frames[i].length;
+		lanes->addressing[i] = desc->addressing;
+		lanes->min_length[i] = desc->min_length + 2;
+		lanes->max_length[i] = desc->max_length + 2;
+	}
+}
 
 /*
- * Display a human readable version of a message in the log
+ * Compute the verdicts of a group, with the same precedence as the checks of
+ * libcec_validate_message(). The error codes all fit in a signed byte.
+ */
+#if defined(__SSE2__)
+static void batch_classify(const ceci_batch_lanes* lanes, int8_t* verdicts)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i header = _mm_loadu_si128((const __m128i*)lanes->header);
+	__m128i length = _mm_loadu_si128((const __m128i*)lanes->length);
+	__m128i addressing = _mm_loadu_si128((const __m128i*)lanes->addressing);
+	__m128i min_length = _mm_loadu_si128((const __m128i*)lanes->min_length);
+	__m128i max_length = _mm_loadu_si128((const __m128i*)lanes->max_length);
+	__m128i broadcast, needed, known, addressed, sized, polling, valid, r;
+
+	// the addressing bit of the descriptor that the destination requires
+	broadcast = _mm_cmpeq_epi8(_mm_and_si128(header, _mm_set1_epi8(0x0F)), _mm_set1_epi8(0x0F));
+	needed = _mm_or_si128(_mm_and_si128(broadcast, _mm_set1_epi8(BROADCAST)),
+		_mm_andnot_si128(broadcast, _mm_set1_epi8(DIRECTED)));
+	known = _mm_xor_si128(_mm_cmpeq_epi8(addressing, zero), _mm_set1_epi8(-1));
+	addressed = _mm_xor_si128(_mm_cmpeq_epi8(_mm_and_si128(addressing, needed), zero), _mm_set1_epi8(-1));
+	// unsigned comparisons: a >= b when max(a, b) == a
+	sized = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(length, min_length), length),
+		_mm_cmpeq_epi8(_mm_min_epu8(length, max_length), length));
+	polling = _mm_cmpeq_epi8(length, _mm_set1_epi8(1));
+	valid = _mm_andnot_si128(_mm_cmpeq_epi8(length, zero),
+		_mm_cmpeq_epi8(_mm_min_epu8(length, _mm_set1_epi8(CEC_MAX_COMMAND_SIZE)), length));
+
+	r = _mm_andnot_si128(sized, _mm_set1_epi8(LIBCEC_ERROR_INVALID_PARAM));
+	r = _mm_or_si128(_mm_and_si128(addressed, r), _mm_andnot_si128(addressed, _mm_set1_epi8(LIBCEC_ERROR_OTHER)));
+	r = _mm_or_si128(_mm_and_si128(known, r), _mm_andnot_si128(known, _mm_set1_epi8(LIBCEC_ERROR_NOT_SUPPORTED)));
+	r = _mm_andnot_si128(polling, r);
+	r = _mm_or_si128(_mm_and_si128(valid, r), _mm_andnot_si128(valid, _mm_set1_epi8(LIBCEC_ERROR_INVALID_PARAM)));
+	_mm_storeu_si128((__m128i*)verdicts, r);
+}
+#else
+static void batch_classify(const ceci_batch_lanes* lanes, int8_t* verdicts)
+{
+	uint8x16_t header = vld1q_u8(lanes->header);
+	uint8x16_t length = vld1q_u8(lanes->length);
+	uint8x16_t addressing = vld1q_u8(lanes->addressing);
+	uint8x16_t broadcast, needed, known, addressed, sized, polling, valid;
+	int8x16_t r;
+
+	// the addressing bit of the descriptor that the destination requires
+	broadcast = vceqq_u8(vandq_u8(header, vdupq_n_u8(0x0F)), vdupq_n_u8(0x0F));
+	needed = vbslq_u8(broadcast, vdupq_n_u8(BROADCAST), vdupq_n_u8(DIRECTED));
+	known = vtstq_u8(addressing, addressing);
+	addressed = vtstq_u8(addressing, needed);
+	sized = vandq_u8(vcgeq_u8(length, vld1q_u8(lanes->min_length)), vcleq_u8(length, vld1q_u8(lanes->max_length)));
+	polling = vceqq_u8(length, vdupq_n_u8(1));
+	valid = vandq_u8(vtstq_u8(length, length), vcleq_u8(length, vdupq_n_u8(CEC_MAX_COMMAND_SIZE)));
+
+	r = vbslq_s8(sized, vdupq_n_s8(LIBCEC_SUCCESS), vdupq_n_s8(LIBCEC_ERROR_INVALID_PARAM));
+	r = vbslq_s8(addressed, r, vdupq_n_s8(LIBCEC_ERROR_OTHER));
+	r = vbslq_s8(known, r, vdupq_n_s8(LIBCEC_ERROR_NOT_SUPPORTED));
+	r = vbslq_s8(polling, vdupq_n_s8(LIBCEC_SUCCESS), r);
+	r = vbslq_s8(valid, r, vdupq_n_s8(LIBCEC_ERROR_INVALID_PARAM));
+	vst1q_s8(verdicts, r);
+}
+#endif
+#endif
+
+/*
+ * Validate count frames, such as those of a bus capture, as if by calling
+ * libcec_validate_message() on each of them, and store the verdicts in
+ * results. Returns the number of valid frames, or LIBCEC_ERROR_INVALID_PARAM.
  */
 DEFAULT_VISIBILITY
-int libcec_decode_message(uint8_t* message, size_t length)
+int libcec_validate_batch(const libcec_frame* frames, size_t count, int* results)
 {
-	uint8_t src, dst;
+	size_t i = 0;
+	int nb_valid = 0;
+#ifdef CECI_BATCH_SIMD
+	ceci_batch_lanes lanes;
+	int8_t verdicts[CECI_BATCH_LANES];
+	int j;
+#endif
 
-	if ((message == NULL) || (length < 1)) {
+	if (((count != 0) && ((frames == NULL) || (results == NULL))) || (count > INT_MAX)) {
 		return LIBCEC_ERROR_INVALID_PARAM;
 	}
 
-	src = message[0] >> 4;
-	dst = message[0] & 0x0F;
+#ifdef CECI_BATCH_SIMD
+	for (; i + CECI_BATCH_LANES <= count; i += CECI_BATCH_LANES) {
+		batch_gather(&frames[i], &lanes);
+		batch_classify(&lanes, verdicts);
+		for (j=0; j<CECI_BATCH_LANES; j++) {
+			results[i+j] = verdicts[j];
+			nb_valid += (verdicts[j] == LIBCEC_SUCCESS);
+		}
+	}
+#endif
+	// whatever doesn't fill a group, or everything without SIMD support
+	for (; i < count; i++) {
+		results[i] = libcec_validate_message(frames[i].data, frames[i].length);
+		nb_valid += (results[i] == LIBCEC_SUCCESS);
+	}
+	return nb_valid;
+}
 
-	// Polling Message
+/*
+ * Copy as much of str as fits in out from pos. Returns the position past str,
+ * which is beyond outlen once out is full.
+ */
+static size_t format_append(char* out, size_t outlen, size_t pos, const char* str, size_t len)
+{
+	if (pos < outlen) {
+		memcpy(&out[pos], str, MIN(len, outlen - pos));
+	}
+	return pos + len;
+}
+
+/*
+ * Render a message as its addresses and opcode name, followed by the hex
+ * bytes of the opcode and the operands, e.g. "4->F: <Active Source> 82 10 00".
+ * The text is built in a single pass into the caller's buffer, without any
+ * stdio call, and unknown or invalid messages are rendered all the same.
+ * Returns the length of the text, or LIBCEC_ERROR_OVERFLOW if it had to be
+ * truncated, which LIBCEC_MAX_FORMAT_SIZE bytes always avoid.
+ */
+DEFAULT_VISIBILITY
+int libcec_format_message(const uint8_t* message, size_t length, char* out, size_t outlen)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	const ceci_opcode_desc* desc;
+	const char* name;
+	char chunk[8];
+	size_t pos, i;
+
+	if ( (message == NULL) || (length < 1) || (length > CEC_MAX_COMMAND_SIZE)
+	  || (out == NULL) || (outlen == 0) ) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+
+	chunk[0] = hex[message[0] >> 4];
+	chunk[1] = '-';
+	chunk[2] = '>';
+	chunk[3] = hex[message[0] & 0x0F];
+	chunk[4] = ':';
+	chunk[5] = ' ';
+	chunk[6] = '<';
+	pos = format_append(out, outlen, 0, chunk, 7);
 	if (length == 1) {
-		ceci_info("  o %1X->%1X: <Polling Message>", src, dst);
-		return LIBCEC_SUCCESS;
+		name = "Polling Message";
+	} else {
+		desc = &ceci_opcodes[message[1]];
+		name = (desc->addressing != 0) ? OPCODE_NAME(desc) : "Unknown Opcode";
+	}
+	pos = format_append(out, outlen, pos, name, strlen(name));
+	pos = format_append(out, outlen, pos, ">", 1);
+	chunk[0] = ' ';
+	for (i=1; i<length; i++) {
+		chunk[1] = hex[message[i] >> 4];
+		chunk[2] = hex[message[i] & 0x0F];
+		pos = format_append(out, outlen, pos, chunk, 3);
 	}
 
-	if ((msg_props[message[1]] & 0x60) == 0) {
-		ceci_warn("unsupported Opcode: %02X", message[1]);
-		return LIBCEC_ERROR_NOT_SUPPORTED;
+	if (pos >= outlen) {
+		out[outlen-1] = 0;
+		return LIBCEC_ERROR_OVERFLOW;
 	}
+	out[pos] = 0;
+	return (int)pos;
+}
 
-	// Broadcasted messages received as directed messages
-	if ((dst == 0x0F) && ((msg_props[message[1]] & 0x40) == 0)) {
-		ceci_warn("broadcast message received as directed: %02X", message[1]);
-		return LIBCEC_ERROR_OTHER;
+/*
+ * Display a human readable version of a message in the log
+ */
+DEFAULT_VISIBILITY
+int libcec_decode_message(uint8_t* message, size_t length)
+{
+	char text[LIBCEC_MAX_FORMAT_SIZE];
+	int r;
+
+	r = libcec_validate_message(message, length);
+	switch (r) {
+	case LIBCEC_SUCCESS:
+		if (ceci_get_context(NULL)->log_level <= LIBCEC_LOG_LEVEL_INFO) {
+			libcec_format_message(message, length, text, sizeof(text));
+			ceci_info(NULL, "  o %s", text);
+		}
+		break;
+	case LIBCEC_ERROR_NOT_SUPPORTED:
+		ceci_warn(NULL, "unsupported Opcode: %02X", message[1]);
+		break;
+	case LIBCEC_ERROR_OTHER:
+		if ((message[0] & 0x0F) == 0x0F) {
+			ceci_warn(NULL, "directed message received as broadcast: %02X", message[1]);
+		} else {
+			ceci_warn(NULL, "broadcast message received as directed: %02X", message[1]);
+		}
+		break;
+	case LIBCEC_ERROR_INVALID_PARAM:
+		if ((message != NULL) && (length >= 2) && (length <= CEC_MAX_COMMAND_SIZE)) {
+			ceci_warn(NULL, "invalid payload length for opcode: %02X", message[1]);
+		}
+		break;
 	}
+	return r;
+}
 
-	if ((dst != 0x0F) && ((msg_props[message[1]] & 0x20) == 0)) {
-		ceci_warn("directed message received as broadcast: %02X", message[1]);
-		return LIBCEC_ERROR_OTHER;
+static uint16_t get_be16(const uint8_t* p)
+{
+	return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+/* Decode a 2 digits BCD byte, returns -1 if it isn't one or is above max */
+static int get_bcd(uint8_t byte, int max)
+{
+	int val;
+
+	if (((byte >> 4) > 9) || ((byte & 0x0F) > 9)) {
+		return -1;
 	}
+	val = (byte >> 4) * 10 + (byte & 0x0F);
+	return (val <= max) ? val : -1;
+}
 
-	if ( (length-2 < msg_min_max[msg_props[message[1]]&0x1F][0])
-	  || (length-2 > msg_min_max[msg_props[message[1]]&0x1F][1]) ) {
-		  ceci_warn("invalid payload length for opcode: %02X", message[1]);
-		  return LIBCEC_ERROR_INVALID_PARAM;
+/* A physical address can't have a non zero digit after a zero one. 0xFFFF means none */
+static int is_valid_physical_address(uint16_t pa)
+{
+	int i;
+
+	if (pa == 0xFFFF) {
+		return 1;
 	}
-	ceci_info("  o %1X->%1X: <%s>", src, dst,
-			  msg_description[msg_index[message[1]]]);
-	display_buffer_hex(message+1, length-1);
+	for (i=12; i>0; i-=4) {
+		if ( (((pa >> i) & 0x0F) == 0) && ((pa & ((1 << i) - 1)) != 0) ) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int parse_analogue_service(const uint8_t* data, cec_op_analogue_service* service)
+{
+	service->broadcast_type = data[0];
+	service->frequency = get_be16(&data[1]);
+	service->broadcast_system = data[3];
+	return (service->broadcast_type <= CEC_ANALOGTYPE_TERRESTRIAL)
+		&& (service->frequency != 0x0000) && (service->frequency != 0xFFFF)
+		&& ((service->broadcast_system <= CEC_BCASTSYSTEM_PAL_DK) || (service->broadcast_system == CEC_BCASTSYSTEM_OTHER));
+}
 
+static int parse_digital_service(const uint8_t* data, cec_op_digital_service* service)
+{
+	uint16_t format;
+
+	service->method_and_broadcast = data[0];
+	if ((data[0] & CEC_DSRVCID_METHOD_MASK) == CEC_DSRVCID_METHOD_CHANNEL) {
+		service->service.channel.channel_number_high = get_be16(&data[1]);
+		service->service.channel.channel_number_low = get_be16(&data[3]);
+		format = service->service.channel.channel_number_high & CEC_CHANID_NUM_FORMAT_MASK;
+		return (format == CEC_CHANID_1_PART_CHANNEL) || (format == CEC_CHANID_2_PART_CHANNEL);
+	}
+	switch (data[0] & CEC_DSRVCID_BCAST_MASK) {
+	case CEC_DSRVCID_BCAST_ARIB_GEN:
+	case CEC_DSRVCID_BCAST_ARIB_BS:
+	case CEC_DSRVCID_BCAST_ARIB_CS:
+	case CEC_DSRVCID_BCAST_ARIB_T:
+		service->service.arib.transport_stream_id = get_be16(&data[1]);
+		service->service.arib.service_id = get_be16(&data[3]);
+		service->service.arib.original_network_id = get_be16(&data[5]);
+		return 1;
+	case CEC_DSRVCID_BCAST_ATSC_GEN:
+	case CEC_DSRVCID_BCAST_ATSC_CABL:
+	case CEC_DSRVCID_BCAST_ATSC_SAT:
+	case CEC_DSRVCID_BCAST_ATSC_TER:
+		service->service.atsc.transport_stream_id = get_be16(&data[1]);
+		service->service.atsc.program_number = get_be16(&data[3]);
+		service->service.atsc.reserved = get_be16(&data[5]);
+		return 1;
+	case CEC_DSRVCID_BCAST_DVB_GEN:
+	case CEC_DSRVCID_BCAST_DVB_C:
+	case CEC_DSRVCID_BCAST_DVB_S:
+	case CEC_DSRVCID_BCAST_DVB_S2:
+	case CEC_DSRVCID_BCAST_DVB_T:
+		service->service.dvb.transport_stream_id = get_be16(&data[1]);
+		service->service.dvb.service_id = get_be16(&data[3]);
+		service->service.dvb.original_network_id = get_be16(&data[5]);
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Parse and validate one operand, from data[*pos] up to data[length].
+ * Returns 0 if it is invalid or doesn't fit, and advances pos otherwise.
+ */
+static int parse_operand(const ceci_operand* operand, const uint8_t* data, size_t length, size_t* pos, uint8_t* dest)
+{
+	const uint8_t* p = &data[*pos];
+	size_t left = length - *pos, size, i;
+	cec_op_record_source* record_source;
+	cec_op_tuner_device_info* tuner;
+	cec_op_analogue_timer* timer;
+	cec_op_external_timer* ext;
+	cec_op_timer_status_data* status;
+	int hours, minutes;
+
+	switch (operand->type & ~OPND_OPTIONAL) {
+	case OPND_U8:
+		if ((left < 1) || (p[0] < operand->min) || (p[0] > operand->max)) {
+			return 0;
+		}
+		*dest = p[0];
+		size = 1;
+		break;
+	case OPND_DISPLAY_CONTROL:
+		if ((left < 1) || (p[0] & 0x3F) || (p[0] == CEC_DISPLAY_RESERVED)) {
+			return 0;
+		}
+		*dest = p[0];
+		size = 1;
+		break;
+	case OPND_PHYS_ADDR:
+		if ((left < 2) || !is_valid_physical_address(get_be16(p))) {
+			return 0;
+		}
+		*(uint16_t*)dest = get_be16(p);
+		size = 2;
+		break;
+	case OPND_VENDOR_ID:
+		if (left < 3) {
+			return 0;
+		}
+		memcpy(dest, p, 3);
+		size = 3;
+		break;
+	case OPND_ASCII:
+		size = MIN(left, operand->max);
+		if (size < operand->min) {
+			return 0;
+		}
+		for (i=0; i<size; i++) {
+			if ((p[i] < 0x20) || (p[i] > 0x7E)) {
+				return 0;
+			}
+			dest[i] = p[i];
+		}
+		dest[size] = 0;
+		break;
+	case OPND_BYTES:
+		size = MIN(left, operand->max);
+		if (size < operand->min) {
+			return 0;
+		}
+		memcpy(dest, p, size);
+		break;
+	case OPND_ANALOGUE_SERVICE:
+		if ((left < 4) || !parse_analogue_service(p, (cec_op_analogue_service*)dest)) {
+			return 0;
+		}
+		size = 4;
+		break;
+	case OPND_DIGITAL_SERVICE:
+		if ((left < 7) || !parse_digital_service(p, (cec_op_digital_service*)dest)) {
+			return 0;
+		}
+		size = 7;
+		break;
+	case OPND_RECORD_SOURCE:
+		record_source = (cec_op_record_source*)dest;
+		if (left < 1) {
+			return 0;
+		}
+		record_source->record_source_type = p[0];
+		switch (p[0]) {
+		case CEC_RECORDSRC_OWN_SOURCE:
+			size = 1;
+			break;
+		case CEC_RECORDSRC_DIGITAL:
+			if ((left < 8) || !parse_digital_service(&p[1], &record_source->source.digital)) {
+				return 0;
+			}
+			size = 8;
+			break;
+		case CEC_RECORDSRC_ANALOGUE:
+			if ((left < 5) || !parse_analogue_service(&p[1], &record_source->source.analogue)) {
+				return 0;
+			}
+			size = 5;
+			break;
+		case CEC_RECORDSRC_EXT_PLUG:
+			if ((left < 2) || (p[1] == 0)) {
+				return 0;
+			}
+			record_source->source.plug = p[1];
+			size = 2;
+			break;
+		case CEC_RECORDSRC_EXT_ADDRESS:
+			if ((left < 3) || !is_valid_physical_address(get_be16(&p[1]))) {
+				return 0;
+			}
+			record_source->source.physical_address = get_be16(&p[1]);
+			size = 3;
+			break;
+		default:
+			return 0;
+		}
+		break;
+	case OPND_TUNER_INFO:
+		tuner = (cec_op_tuner_device_info*)dest;
+		if (left < 1) {
+			return 0;
+		}
+		tuner->tuner_info = p[0];
+		switch (p[0] & CEC_TUNINFO_DISPLAY_MASK) {
+		case CEC_TUNINFO_DISPLAY_DTUNER:
+			size = 7;
+			break;
+		case CEC_TUNINFO_DISPLAY_ATUNER:
+			size = 4;
+			break;
+		case CEC_TUNINFO_DISPLAY_NOTUNER:
+			/* the service that would be displayed, of either kind */
+			size = (left >= 8) ? 7 : 4;
+			break;
+		default:
+			return 0;
+		}
+		if ( (left < size + 1)
+		  || ((size == 7) && !parse_digital_service(&p[1], &tuner->source.digital))
+		  || ((size == 4) && !parse_analogue_service(&p[1], &tuner->source.analogue)) ) {
+			return 0;
+		}
+		size++;
+		break;
+	case OPND_TIMER:
+		/* the timers all start alike, so any of them can be filled through this one */
+		timer = (cec_op_analogue_timer*)dest;
+		if ( (left < 7) || (p[0] < 1) || (p[0] > 31) || (p[1] < 1) || (p[1] > 12) || (p[6] & 0x80)
+		  || ((hours = get_bcd(p[2], 23)) < 0) || ((minutes = get_bcd(p[3], 59)) < 0) ) {
+			return 0;
+		}
+		timer->day = p[0];
+		timer->month = p[1];
+		timer->start_time.hour = (uint8_t)hours;
+		timer->start_time.minute = (uint8_t)minutes;
+		if (((hours = get_bcd(p[4], 99)) < 0) || ((minutes = get_bcd(p[5], 59)) < 0)) {
+			return 0;
+		}
+		timer->duration.hours = (uint8_t)hours;
+		timer->duration.minutes = (uint8_t)minutes;
+		timer->recording_sequence = p[6];
+		size = 7;
+		break;
+	case OPND_EXT_SOURCE:
+		ext = (cec_op_external_timer*)dest;
+		if (left < 1) {
+			return 0;
+		}
+		ext->source_specifier = p[0];
+		if ((p[0] == CEC_EXTSRC_PLUG) && (left >= 2) && (p[1] != 0)) {
+			ext->source.plug = p[1];
+			size = 2;
+		} else if ( (p[0] == CEC_EXTSRC_PHYSICAL_ADDRESS) && (left >= 3)
+		  && is_valid_physical_address(get_be16(&p[1])) ) {
+			ext->source.physical_address = get_be16(&p[1]);
+			size = 3;
+		} else {
+			return 0;
+		}
+		break;
+	case OPND_FEATURES:
+		for (size=0; (size<left) && (p[size] & 0x80); size++);
+		if (size++ == left) {
+			return 0;
+		}
+		memcpy(dest, p, MIN(size, operand->max));
+		break;
+	case OPND_TIMER_STATUS:
+		status = (cec_op_timer_status_data*)dest;
+		if (left < 1) {
+			return 0;
+		}
+		status->info = p[0];
+		status->duration_available = 0;
+		size = 1;
+		/* the duration available only comes with some of the statuses */
+		if (left >= 3) {
+			if (((hours = get_bcd(p[1], 99)) < 0) || ((minutes = get_bcd(p[2], 59)) < 0)) {
+				return 0;
+			}
+			status->duration_available = (uint16_t)(hours * 60 + minutes);
+			size = 3;
+		}
+		break;
+	default:
+		return 0;
+	}
+	*pos += size;
+	return 1;
+}
+
+/*
+ * Parse a message into its header and its operands, with full validation
+ * of the addressing, the length and the operand values, without allocating
+ * anything. Returns LIBCEC_SUCCESS, LIBCEC_ERROR_NOT_SUPPORTED for an unknown
+ * opcode, LIBCEC_ERROR_OTHER for a message sent with the wrong addressing, or
+ * LIBCEC_ERROR_INVALID_PARAM for a malformed one.
+ */
+DEFAULT_VISIBILITY
+int libcec_parse_message(const uint8_t* message, size_t length, cec_parsed_message* parsed)
+{
+	const ceci_opcode_desc* desc;
+	const ceci_operand* operand;
+	size_t pos = 2;
+	int i;
+
+	if ((message == NULL) || (parsed == NULL) || (length < 1) || (length > CEC_MAX_COMMAND_SIZE)) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	memset(parsed, 0, sizeof(*parsed));
+	parsed->initiator = message[0] >> 4;
+	parsed->destination = message[0] & 0x0F;
+	parsed->length = (uint8_t)length;
+	if (length == 1) {
+		return LIBCEC_SUCCESS;
+	}
+	parsed->opcode = message[1];
+
+	desc = &ceci_opcodes[message[1]];
+	if (desc->addressing == 0) {
+		return LIBCEC_ERROR_NOT_SUPPORTED;
+	}
+	if ( ((parsed->destination == 0x0F) && !(desc->addressing & BROADCAST))
+	  || ((parsed->destination != 0x0F) && !(desc->addressing & DIRECTED)) ) {
+		return LIBCEC_ERROR_OTHER;
+	}
+
+	operand = ceci_layouts[desc->layout];
+	for (i=0; (i<CECI_MAX_OPERANDS) && (operand[i].type != OPND_END); i++) {
+		if ((pos == length) && (operand[i].type & OPND_OPTIONAL)) {
+			if ((operand[i].type & ~OPND_OPTIONAL) == OPND_PHYS_ADDR) {
+				*(uint16_t*)((uint8_t*)&parsed->op + operand[i].offset) = 0xFFFF;
+			}
+			break;
+		}
+		if (!parse_operand(&operand[i], message, length, &pos, (uint8_t*)&parsed->op + operand[i].offset)) {
+			return LIBCEC_ERROR_INVALID_PARAM;
+		}
+	}
 	return LIBCEC_SUCCESS;
 }
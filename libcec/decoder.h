@@ -20,6 +20,7 @@
 #ifndef __LIBCEC_DECODER_H__
 #define __LIBCEC_DECODER_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
 /*
@@ -182,6 +183,79 @@ typedef struct {
 	uint8_t abort_reason;
 } cec_op_abort;
 
+/* RC Profile and Device Features hold bit 7 set on all but their last byte */
+typedef struct {
+	cec_op_cec_version cec_version;
+	uint8_t all_device_types;
+	uint8_t rc_profile[4];
+	uint8_t device_features[4];
+} cec_op_features;
+
+typedef struct {
+	cec_op_physical_address physical_address;
+	uint8_t video_latency;
+	uint8_t latency_flags;
+	uint8_t audio_output_delay;		/* 0 if absent */
+} cec_op_current_latency;
+
+/*
+ * A message, as filled by libcec_parse_message(). The member of the op union
+ * that is valid depends on the opcode, as listed below. A polling message
+ * has a length of 1 and no opcode. Times from timers are binary (the frames
+ * hold them as BCD), and timer_status.duration_available is in minutes.
+ */
+typedef struct {
+	uint8_t initiator;
+	uint8_t destination;
+	uint8_t opcode;
+	uint8_t length;		/* of the whole frame, so operands take length-2 bytes */
+	union {
+		cec_op_abort					abort;				/* Feature Abort */
+		cec_op_tuner_device_info		tuner_device_info;	/* Tuner Device Status */
+		cec_op_status_request			status_request;		/* Give Tuner Device Status, Give Deck Status */
+		cec_op_record_source			record_source;		/* Record On */
+		uint8_t							record_status;		/* Record Status */
+		cec_op_deck_info				deck_info;			/* Deck Status */
+		cec_op_menu_language			menu_language;		/* Set Menu Language */
+		cec_op_analogue_timer			analogue_timer;		/* Set/Clear Analogue Timer */
+		cec_op_timer_status_data		timer_status;		/* Timer Status */
+		cec_op_play_mode				play_mode;			/* Play */
+		cec_op_deck_control_mode		deck_control_mode;	/* Deck Control */
+		uint8_t							timer_cleared_status;	/* Timer Cleared Status */
+		cec_op_ui_command				ui_command;			/* User Control Pressed */
+		cec_op_osd_name					osd_name;			/* Set OSD Name */
+		cec_op_osd_string				osd_string;			/* Set OSD String */
+		cec_op_program_title			program_title;		/* Set Timer Program Title */
+		cec_op_system_audio_status		system_audio_status;	/* Set System Audio Mode, System Audio Mode Status */
+		cec_op_audio_status				audio_status;		/* Report Audio Status */
+		cec_op_routing_change_addresses	routing_change;		/* Routing Change */
+		/* Routing Information, Active Source, Set Stream Path, Inactive Source,
+		   Request Current Latency, System Audio Mode Request (0xFFFF if absent) */
+		cec_op_physical_address			physical_address;
+		cec_op_physical_address_report	physical_address_report;	/* Report Physical Address */
+		cec_op_vendor_id				vendor_id;			/* Device Vendor ID */
+		/* Vendor Command, Vendor Remote Button Down, CDC Message: length-2 bytes */
+		cec_op_vendor_specific			vendor_specific;
+		cec_op_menu_request_type		menu_request_type;	/* Menu Request */
+		cec_op_menu_state				menu_state;			/* Menu Status */
+		cec_op_power_status				power_status;		/* Report Power Status */
+		cec_op_analogue_service			analogue_service;	/* Select Analogue Service */
+		cec_op_digital_service			digital_service;	/* Select Digital Service */
+		cec_op_digital_timer			digital_timer;		/* Set/Clear Digital Timer */
+		cec_op_audio_rate				audio_rate;			/* Set Audio Rate */
+		cec_op_cec_version				cec_version;		/* CEC Version */
+		/* Vendor Command With ID: length-5 bytes of data */
+		cec_op_vendor_command_with_id	vendor_command_with_id;
+		cec_op_external_timer			external_timer;		/* Set/Clear External Timer */
+		/* Report Short Audio Descriptor: (length-2)/3 descriptors of 3 bytes */
+		uint8_t							short_audio_descriptors[12];
+		/* Request Short Audio Descriptor: length-2 audio format IDs and codes */
+		uint8_t							audio_format_ids[4];
+		cec_op_features					features;			/* Report Features */
+		cec_op_current_latency			current_latency;	/* Report Current Latency */
+	} op;
+} cec_parsed_message;
+
 /*
  * Feature Opcode / CEC commands
  */
@@ -246,6 +320,19 @@ typedef struct {
 #define CEC_OP_VENDOR_COMMAND_WITH_ID		0xA0
 #define CEC_OP_CLEAR_EXTERNAL_TIMER			0xA1
 #define CEC_OP_SET_EXTERNAL_TIMER			0xA2
+#define CEC_OP_REPORT_SHORT_AUDIO_DESCRIPTOR	0xA3
+#define CEC_OP_REQUEST_SHORT_AUDIO_DESCRIPTOR	0xA4
+#define CEC_OP_GIVE_FEATURES				0xA5
+#define CEC_OP_REPORT_FEATURES				0xA6
+#define CEC_OP_REQUEST_CURRENT_LATENCY		0xA7
+#define CEC_OP_REPORT_CURRENT_LATENCY		0xA8
+#define CEC_OP_INITIATE_ARC					0xC0
+#define CEC_OP_REPORT_ARC_INITIATED			0xC1
+#define CEC_OP_REPORT_ARC_TERMINATED		0xC2
+#define CEC_OP_REQUEST_ARC_INITIATION		0xC3
+#define CEC_OP_REQUEST_ARC_TERMINATION		0xC4
+#define CEC_OP_TERMINATE_ARC				0xC5
+#define CEC_OP_CDC_MESSAGE					0xF8
 #define CEC_OP_ABORT						0xFF
 
 /* Abort Reason */
@@ -298,6 +385,7 @@ typedef struct {
 #define CEC_VERSION_V1_3			0x03
 #define CEC_VERSION_V1_3A			0x04
 #define CEC_VERSION_V1_4			0x05
+#define CEC_VERSION_V2_0			0x06
 
 /* Channel Identifier */
 #define CEC_CHANID_NUM_FORMAT_MASK	0xFC00
@@ -358,9 +446,9 @@ typedef struct {
 
 /* Display Control */
 #define CEC_DISPLAY_DEFAULT_TIME	0x00
-#define CEC_DISPLAY_UNTIL_CLEARED	0x01
-#define CEC_DISPLAY_CLEAR_PREVIOUS	0x02
-#define CEC_DISPLAY_RESERVED		0x03
+#define CEC_DISPLAY_UNTIL_CLEARED	0x40
+#define CEC_DISPLAY_CLEAR_PREVIOUS	0x80
+#define CEC_DISPLAY_RESERVED		0xC0
 
 /* External Source Specifier */
 #define CEC_EXTSRC_PLUG				0x04
@@ -573,4 +661,14 @@ typedef struct {
 #define CEC_UI_F5					0x75
 #define CEC_UI_DATA					0x76
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int libcec_parse_message(const uint8_t* message, size_t length, cec_parsed_message* parsed);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,172 @@
+/*
+ * libcec - EDID and CTA-861 extension parsing
+ *
+ * Copyright (c) 2010-2011 Pete Batard <pete@akeo.ie>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libceci.h"
+
+#define EDID_DESCRIPTOR_MONITOR_NAME	0xFC
+#define CTA_EXTENSION_TAG				0x02
+#define CTA_DATA_BLOCK_VENDOR			3
+
+/* IEEE Registration Identifiers, as they appear in a VSDB (LSB first) */
+static const uint8_t hdmi_oui[3] = {0x03, 0x0c, 0x00};
+static const uint8_t hdmi_forum_oui[3] = {0xd8, 0x5d, 0xc4};
+
+/* Blocks are valid if all their bytes add up to zero */
+static int ceci_edid_checksum(const uint8_t* block)
+{
+	uint8_t checksum = 0;
+	int i;
+
+	for (i=0; i<CECI_EDID_BLOCK_SIZE; i++) {
+		checksum += block[i];
+	}
+	return (checksum == 0) ? LIBCEC_SUCCESS : LIBCEC_ERROR_IO;
+}
+
+/* Parse the base EDID block */
+int ceci_edid_parse_base(libcec_context* ctx, const uint8_t* block, libcec_edid_info* info)
+{
+	const uint8_t edid_marker[] = {0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00};
+	const uint8_t* desc;
+	int i, j;
+
+	memset(info, 0, sizeof(*info));
+	info->physical_address = 0xFFFF;
+
+	/* Check the header for EDID signature */
+	if (memcmp(block, edid_marker, sizeof(edid_marker)) != 0) {
+		ceci_error(ctx, "invalid EDID header");
+		return LIBCEC_ERROR_IO;
+	}
+	if (ceci_edid_checksum(block) != LIBCEC_SUCCESS) {
+		ceci_error(ctx, "invalid EDID checksum");
+		return LIBCEC_ERROR_IO;
+	}
+
+	/* Manufacturer ID: 3 compressed ASCII letters, big endian */
+	info->manufacturer[0] = '@' + ((block[0x08] >> 2) & 0x1f);
+	info->manufacturer[1] = '@' + (((block[0x08] & 0x03) << 3) | (block[0x09] >> 5));
+	info->manufacturer[2] = '@' + (block[0x09] & 0x1f);
+	info->product_code = block[0x0a] | (block[0x0b] << 8);
+	info->serial_number = block[0x0c] | (block[0x0d] << 8) | (block[0x0e] << 16) | ((uint32_t)block[0x0f] << 24);
+	info->version = block[0x12];
+	info->revision = block[0x13];
+	info->nb_extensions = block[0x7e];
+
+	/* Look for the monitor name in the 4 display descriptors */
+	for (desc = &block[0x36]; desc < &block[0x7e]; desc += 18) {
+		if ( (desc[0] != 0) || (desc[1] != 0) || (desc[2] != 0)
+		  || (desc[3] != EDID_DESCRIPTOR_MONITOR_NAME) ) {
+			continue;
+		}
+		for (i=0; (i<13) && (desc[5+i] != 0x0a); i++) {
+			info->monitor_name[i] = desc[5+i];
+		}
+		/* trim the padding */
+		for (j=i-1; (j>=0) && (info->monitor_name[j] == ' '); j--) {
+			info->monitor_name[j] = 0;
+		}
+		break;
+	}
+	return LIBCEC_SUCCESS;
+}
+
+/* Parse the HDMI Vendor Specific Data Block, where p points to its header */
+static void ceci_edid_parse_hdmi_vsdb(const uint8_t* p, int len, libcec_edid_info* info)
+{
+	int i = 9;
+
+	if (len < 5) {
+		return;
+	}
+	info->flags |= LIBCEC_EDID_HDMI;
+	info->physical_address = (p[4]<<8) + p[5];
+	if (len >= 6) {
+		if (p[6] & 0x80) {
+			info->flags |= LIBCEC_EDID_SUPPORTS_AI;
+		}
+		if (p[6] & 0x01) {
+			info->flags |= LIBCEC_EDID_DVI_DUAL;
+		}
+	}
+	if (len >= 7) {
+		info->max_tmds_clock = p[7] * 5;
+	}
+	if (len < 8) {
+		return;
+	}
+	/* the latency fields that are present come after the flags, in that order */
+	if ((p[8] & 0x80) && (len >= i+1)) {
+		info->flags |= LIBCEC_EDID_LATENCY;
+		info->video_latency = p[i++];
+		info->audio_latency = p[i++];
+		if ((p[8] & 0x40) && (len >= i+1)) {
+			info->flags |= LIBCEC_EDID_I_LATENCY;
+			info->interlaced_video_latency = p[i++];
+			info->interlaced_audio_latency = p[i++];
+		}
+	}
+}
+
+/*
+ * Parse a CTA-861 extension block. Blocks of other types are checked and
+ * ignored. Returns LIBCEC_SUCCESS even if there is no HDMI VSDB.
+ */
+int ceci_edid_parse_extension(libcec_context* ctx, const uint8_t* block, libcec_edid_info* info)
+{
+	int i, len, data_end;
+
+	if (ceci_edid_checksum(block) != LIBCEC_SUCCESS) {
+		ceci_error(ctx, "invalid EDID extension checksum");
+		return LIBCEC_ERROR_IO;
+	}
+	if (block[0] != CTA_EXTENSION_TAG) {
+		return LIBCEC_SUCCESS;
+	}
+	if (block[3] & 0x40) {
+		info->flags |= LIBCEC_EDID_BASIC_AUDIO;
+	}
+
+	/* Data blocks go from byte 4 up to the first detailed timing descriptor */
+	data_end = block[2];
+	if ((data_end == 0) || (data_end > CECI_EDID_BLOCK_SIZE-1)) {
+		return LIBCEC_SUCCESS;
+	}
+	for (i=4; i<data_end; i+=len+1) {
+		len = block[i] & 0x1f;
+		if (i+len >= data_end) {
+			ceci_warn(ctx, "truncated CTA-861 data block at 0x%02x", i);
+			break;
+		}
+		if ((((block[i]>>5)&7) != CTA_DATA_BLOCK_VENDOR) || (len < 3)) {
+			continue;
+		}
+		if (memcmp(&block[i+1], hdmi_oui, sizeof(hdmi_oui)) == 0) {
+			ceci_edid_parse_hdmi_vsdb(&block[i], len, info);
+		} else if (memcmp(&block[i+1], hdmi_forum_oui, sizeof(hdmi_forum_oui)) == 0) {
+			info->flags |= LIBCEC_EDID_HDMI_FORUM;
+		}
+	}
+	return LIBCEC_SUCCESS;
+}
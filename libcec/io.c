@@ -0,0 +1,1018 @@
+/*
+ * libcec - asynchronous I/O helpers
+ *
+ * Copyright (c) 2010-2011 Pete Batard <pete@akeo.ie>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "libceci.h"
+
+static void ceci_cond_init(pthread_cond_t* cond)
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+/* Compute an absolute CLOCK_MONOTONIC deadline, timeout in ms */
+static void ceci_deadline(struct timespec* ts, int32_t timeout)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	ts->tv_sec += timeout / 1000;
+	ts->tv_nsec += (timeout % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+void ceci_io_init(libcec_device_handle* handle)
+{
+	pthread_mutex_init(&handle->rx.lock, NULL);
+	ceci_cond_init(&handle->rx.cond);
+	handle->rx.event_fd = -1;
+	pthread_mutex_init(&handle->tx.lock, NULL);
+	ceci_cond_init(&handle->tx.cond);
+}
+
+/*
+ * Wake up and turn away the callers of both paths, wait for the readers
+ * to leave, then stop the reader and let the transmit worker drain the
+ * queue. Synchronous writers are released as their frames complete, and
+ * must be gone too before the queue can be torn down.
+ * This uses the backend, so it is only for a handle that was opened.
+ */
+void ceci_io_stop(libcec_device_handle* handle)
+{
+	pthread_mutex_lock(&handle->rx.lock);
+	handle->rx.closing = 1;
+	handle->rx.stop = 1;
+	pthread_cond_broadcast(&handle->rx.cond);
+	pthread_mutex_unlock(&handle->rx.lock);
+	pthread_mutex_lock(&handle->tx.lock);
+	handle->tx.stop = 1;
+	pthread_cond_broadcast(&handle->tx.cond);
+	pthread_mutex_unlock(&handle->tx.lock);
+
+	/* readers blocked in the driver notice within CECI_RX_POLL_TIMEOUT, unless it can cancel */
+	if (handle->backend->cancel != NULL) {
+		handle->backend->cancel(handle);
+	}
+	pthread_mutex_lock(&handle->rx.lock);
+	while (handle->rx.readers != 0) {
+		pthread_cond_wait(&handle->rx.cond, &handle->rx.lock);
+	}
+	pthread_mutex_unlock(&handle->rx.lock);
+
+	if (handle->rx.running) {
+		pthread_join(handle->rx.thread, NULL);
+		handle->rx.running = 0;
+	}
+	if (handle->tx.running) {
+		pthread_join(handle->tx.thread, NULL);
+		handle->tx.running = 0;
+	}
+	pthread_mutex_lock(&handle->tx.lock);
+	while (handle->tx.writers != 0) {
+		pthread_cond_wait(&handle->tx.cond, &handle->tx.lock);
+	}
+	pthread_mutex_unlock(&handle->tx.lock);
+}
+
+/* Release what ceci_io_init() and the I/O paths set up, once nobody uses them */
+void ceci_io_exit(libcec_device_handle* handle)
+{
+	if (handle->rx.event_fd >= 0) {
+		close(handle->rx.event_fd);
+	}
+	if (handle->rx.dropped != 0) {
+		ceci_warn(HANDLE_CTX(handle), "%d received messages were dropped", handle->rx.dropped);
+	}
+	ceci_free(HANDLE_CTX(handle), handle->rx.slots);
+	ceci_free(HANDLE_CTX(handle), handle->rx.slot_info);
+	if (handle->rx.filter_dropped != 0) {
+		ceci_dbg(HANDLE_CTX(handle), "%d received messages were dropped by the filter", handle->rx.filter_dropped);
+	}
+	if (handle->tx.coalesced != 0) {
+		ceci_dbg(HANDLE_CTX(handle), "%d transmitted messages were merged with a pending duplicate", handle->tx.coalesced);
+	}
+	pthread_cond_destroy(&handle->rx.cond);
+	pthread_mutex_destroy(&handle->rx.lock);
+	pthread_cond_destroy(&handle->tx.cond);
+	pthread_mutex_destroy(&handle->tx.lock);
+}
+
+/*
+ * Whether a frame passes a receive filter: its initiator must be set in
+ * initiators and its opcode, if it has one, in the opcodes bitmap
+ */
+int ceci_rx_filter_match(const uint8_t* opcodes, uint16_t initiators, const uint8_t* frame, size_t length)
+{
+	if ((length == 0) || !(initiators & (1 << (frame[0] >> 4)))) {
+		return 0;
+	}
+	if ((length == 1) || (opcodes == NULL)) {
+		return 1;
+	}
+	return (opcodes[frame[1] >> 3] >> (frame[1] & 7)) & 1;
+}
+
+int ceci_rx_set_filter(libcec_device_handle* handle, const uint8_t* opcodes, uint16_t initiators)
+{
+	ceci_rx_state* rx = &handle->rx;
+	int r = LIBCEC_SUCCESS;
+
+	pthread_mutex_lock(&rx->lock);
+	rx->filtered = (opcodes != NULL) || (initiators != 0xFFFF);
+	if (opcodes != NULL) {
+		memcpy(rx->filter_opcodes, opcodes, sizeof(rx->filter_opcodes));
+	} else {
+		memset(rx->filter_opcodes, 0xFF, sizeof(rx->filter_opcodes));
+	}
+	rx->filter_initiators = initiators;
+	pthread_mutex_unlock(&rx->lock);
+
+	if (handle->backend->set_rx_filter != NULL) {
+		r = handle->backend->set_rx_filter(handle, opcodes, initiators);
+		if (r == LIBCEC_SUCCESS) {
+			ceci_dbg(HANDLE_CTX(handle), "receive filter set in the driver");
+		} else {
+			ceci_dbg(HANDLE_CTX(handle), "driver cannot filter - filtering in libcec");
+			r = LIBCEC_SUCCESS;
+		}
+	}
+	return r;
+}
+
+/* Set the flags and the timestamp of a frame, 0 for when the driver has none */
+static void ceci_frame_classify(libcec_frame* frame, uint64_t timestamp)
+{
+	struct timespec now;
+
+	frame->flags = 0;
+	if (timestamp != 0) {
+		frame->flags |= LIBCEC_FRAME_DRIVER_TIMESTAMP;
+	} else {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		timestamp = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+	}
+	frame->timestamp = timestamp;
+	if (frame->length > 0) {
+		frame->flags |= ((frame->data[0] & 0x0F) == 0x0F) ? LIBCEC_FRAME_BROADCAST : LIBCEC_FRAME_DIRECTED;
+	}
+}
+
+/*
+ * Hand a frame over to the transactions it answers: the ones that wait for
+ * its opcode from its initiator, or that it turns down with a Feature Abort.
+ * Returns 1 if the frame was taken. Must be called with the lock held.
+ */
+static int ceci_rx_route(libcec_device_handle* handle, uint8_t* buffer, int length, uint64_t timestamp)
+{
+	ceci_rx_state* rx = &handle->rx;
+	ceci_rx_waiter* waiter;
+	uint8_t initiator;
+	int aborted, taken = 0;
+
+	if (length < 2) {
+		return 0;
+	}
+	initiator = buffer[0] >> 4;
+	for (waiter = rx->transactions; waiter != NULL; waiter = waiter->next) {
+		if ( (waiter->done) || (waiter->initiator != initiator)
+		  || (((buffer[0] & 0x0F) != waiter->destination) && ((buffer[0] & 0x0F) != 0x0F)) ) {
+			continue;
+		}
+		aborted = (buffer[1] == 0x00) && (length >= 3) && (buffer[2] == waiter->request_opcode);
+		if ((buffer[1] != waiter->opcode) && !aborted) {
+			continue;
+		}
+		memcpy(waiter->reply->data, buffer, length);
+		waiter->reply->length = (uint8_t)length;
+		ceci_frame_classify(waiter->reply, timestamp);
+		waiter->result = aborted ? LIBCEC_ERROR_NOT_SUPPORTED : length;
+		waiter->done = 1;
+		taken = 1;
+	}
+	if (taken) {
+		pthread_cond_broadcast(&rx->cond);
+	}
+	return taken;
+}
+
+/*
+ * Whether a frame read from the backend is for the readers: it must not
+ * answer a pending transaction, and it must pass the receive filter
+ */
+static int ceci_rx_accept(libcec_device_handle* handle, uint8_t* buffer, int length, uint64_t timestamp)
+{
+	ceci_rx_state* rx = &handle->rx;
+	int r = 1;
+
+	pthread_mutex_lock(&rx->lock);
+	if ((rx->transactions != NULL) && ceci_rx_route(handle, buffer, length, timestamp)) {
+		r = 0;
+	} else if ( (rx->filtered) && (length > 0)
+	  && !ceci_rx_filter_match(rx->filter_opcodes, rx->filter_initiators, buffer, length) ) {
+		rx->filter_dropped++;
+		r = 0;
+	}
+	pthread_mutex_unlock(&rx->lock);
+	return r;
+}
+
+/* A single timed backend read */
+static int ceci_backend_read_message(libcec_device_handle* handle, uint8_t* buffer, size_t length,
+	int32_t timeout, uint64_t* timestamp)
+{
+	uint64_t start;
+	int r;
+
+	start = ceci_stats_start();
+	r = handle->backend->read_message(handle, buffer, length, timeout, timestamp);
+	ceci_stats_record(handle, LIBCEC_STATS_READ_MESSAGE, start, r);
+	if (r > 0) {
+		ceci_stats_frame(handle, 0, r);
+	}
+	return r;
+}
+
+/*
+ * Read from the backend. If the backend cannot cancel a blocked read, long
+ * waits are split into slices, so that libcec_close() doesn't have to wait
+ * for the full timeout.
+ */
+static int ceci_backend_read_sliced(libcec_device_handle* handle, uint8_t* buffer, size_t length,
+	int32_t timeout, uint64_t* timestamp)
+{
+	int32_t slice;
+	int r, closing;
+
+	if (handle->backend->cancel != NULL) {
+		return ceci_backend_read_message(handle, buffer, length, timeout, timestamp);
+	}
+	while (1) {
+		slice = ((timeout < 0) || (timeout > CECI_RX_POLL_TIMEOUT)) ? CECI_RX_POLL_TIMEOUT : timeout;
+		r = ceci_backend_read_message(handle, buffer, length, slice, timestamp);
+		if ((r != LIBCEC_ERROR_TIMEOUT) || (slice == timeout)) {
+			return r;
+		}
+		pthread_mutex_lock(&handle->rx.lock);
+		closing = handle->rx.closing;
+		pthread_mutex_unlock(&handle->rx.lock);
+		if (closing) {
+			return LIBCEC_ERROR_INTERRUPTED;
+		}
+		if (timeout > 0) {
+			timeout -= slice;
+		}
+	}
+}
+
+/*
+ * Read a frame that passes the receive filter from the backend. Frames that
+ * don't, and the answers to pending transactions, are taken out here, before
+ * they reach the ring or wake any reader up.
+ */
+static int ceci_backend_read(libcec_device_handle* handle, uint8_t* buffer, size_t length,
+	int32_t timeout, uint64_t* timestamp)
+{
+	struct timespec deadline, now;
+	int64_t left;
+	int r;
+
+	if (timeout > 0) {
+		ceci_deadline(&deadline, timeout);
+	}
+	while (1) {
+		r = ceci_backend_read_sliced(handle, buffer, length, timeout, timestamp);
+		if ((r < 0) || ceci_rx_accept(handle, buffer, r, *timestamp)) {
+			return r;
+		}
+		*timestamp = 0;
+		if (timeout > 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			left = (int64_t)(deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+			if (left <= 0) {
+				return LIBCEC_ERROR_TIMEOUT;
+			}
+			timeout = (int32_t)left;
+		}
+	}
+}
+
+/*
+ * Read a frame from the backend, and timestamp and classify it.
+ * Returns the frame length or a negative error code.
+ */
+static int ceci_read_frame(libcec_device_handle* handle, libcec_frame* frame, int32_t timeout)
+{
+	uint64_t timestamp = 0;
+	int r;
+
+	r = ceci_backend_read(handle, frame->data, LIBCEC_MAX_FRAME_SIZE, timeout, &timestamp);
+	if (r < 0) {
+		return r;
+	}
+	frame->length = (uint8_t)r;
+	ceci_frame_classify(frame, timestamp);
+	return r;
+}
+
+/* Copy a frame in or out of a ring slot. Must be called with the lock held */
+static void ceci_rx_store(ceci_rx_state* rx, unsigned int slot, const libcec_frame* frame)
+{
+	memcpy(rx->slots[slot], frame->data, frame->length);
+	rx->slot_info[slot].length = frame->length;
+	rx->slot_info[slot].flags = frame->flags;
+	rx->slot_info[slot].timestamp = frame->timestamp;
+}
+
+static void ceci_rx_load(ceci_rx_state* rx, unsigned int slot, libcec_frame* frame)
+{
+	memcpy(frame->data, rx->slots[slot], rx->slot_info[slot].length);
+	frame->length = rx->slot_info[slot].length;
+	frame->flags = rx->slot_info[slot].flags;
+	frame->timestamp = rx->slot_info[slot].timestamp;
+}
+
+/*
+ * Receive side: a reader thread drains the backend into a ring of fixed
+ * LIBCEC_MAX_FRAME_SIZE byte slots, while an eventfd reflects whether the
+ * ring is empty. Lengths, flags and timestamps are kept in a separate array.
+ */
+static void* ceci_rx_thread(void* arg)
+{
+	libcec_device_handle* handle = (libcec_device_handle*)arg;
+	ceci_rx_state* rx = &handle->rx;
+	libcec_frame batch[CECI_RX_BATCH];
+	unsigned int i, n, was_empty;
+	uint64_t one = 1;
+	int r;
+
+	pthread_mutex_lock(&rx->lock);
+	while (!rx->stop) {
+		pthread_mutex_unlock(&rx->lock);
+		r = ceci_read_frame(handle, &batch[0], CECI_RX_POLL_TIMEOUT);
+		if ((r == LIBCEC_ERROR_TIMEOUT) || (r == LIBCEC_ERROR_INTERRUPTED)) {
+			pthread_mutex_lock(&rx->lock);
+			continue;
+		}
+		if (r < 0) {
+			ceci_error(HANDLE_CTX(handle), "reader failed to receive message: %s", libcec_strerror(r));
+			/* don't spin on a persistent error */
+			usleep(CECI_RX_POLL_TIMEOUT * 1000);
+			pthread_mutex_lock(&rx->lock);
+			continue;
+		}
+		/* pick up whatever else is already waiting, if the backend can tell without blocking */
+		for (n=1; (n<CECI_RX_BATCH) && (handle->backend->get_pollfd != NULL); n++) {
+			if (ceci_read_frame(handle, &batch[n], 0) < 0) {
+				break;
+			}
+		}
+
+		pthread_mutex_lock(&rx->lock);
+		was_empty = (rx->count == 0);
+		for (i=0; i<n; i++) {
+			if (rx->count >= rx->size) {
+				rx->head = (rx->head + 1) % rx->size;
+				rx->count--;
+				if (rx->dropped++ == 0) {
+					ceci_warn(HANDLE_CTX(handle), "receive ring full - dropping oldest messages");
+				}
+			}
+			ceci_rx_store(rx, (rx->head + rx->count) % rx->size, &batch[i]);
+			rx->count++;
+		}
+		if (was_empty) {
+			if (write(rx->event_fd, &one, sizeof(one)) != sizeof(one)) {
+				ceci_warn(HANDLE_CTX(handle), "could not signal eventfd - errno: %d", errno);
+			}
+		}
+		pthread_cond_broadcast(&rx->cond);
+	}
+	pthread_mutex_unlock(&rx->lock);
+	return NULL;
+}
+
+int ceci_rx_start(libcec_device_handle* handle, unsigned int slots)
+{
+	ceci_rx_state* rx = &handle->rx;
+	int r = LIBCEC_SUCCESS;
+
+	pthread_mutex_lock(&rx->lock);
+	if (rx->closing) {
+		r = LIBCEC_ERROR_INTERRUPTED;
+		goto out;
+	}
+	if (rx->running) {
+		goto out;
+	}
+	/* the application polls the backend, which would no longer report the frames */
+	if (rx->pollfd_lent) {
+		ceci_error(HANDLE_CTX(handle), "cannot start the reader once the device's descriptor is polled");
+		r = LIBCEC_ERROR_BUSY;
+		goto out;
+	}
+	rx->slots = ceci_calloc(HANDLE_CTX(handle), slots, sizeof(*rx->slots));
+	rx->slot_info = ceci_calloc(HANDLE_CTX(handle), slots, sizeof(*rx->slot_info));
+	if ((rx->slots == NULL) || (rx->slot_info == NULL)) {
+		r = LIBCEC_ERROR_RESOURCE;
+		goto err;
+	}
+	rx->size = slots;
+	rx->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (rx->event_fd < 0) {
+		ceci_error(HANDLE_CTX(handle), "could not create eventfd - errno: %d", errno);
+		r = LIBCEC_ERROR_RESOURCE;
+		goto err;
+	}
+	if (pthread_create(&rx->thread, NULL, ceci_rx_thread, handle) != 0) {
+		ceci_error(HANDLE_CTX(handle), "could not create reader thread");
+		close(rx->event_fd);
+		rx->event_fd = -1;
+		r = LIBCEC_ERROR_RESOURCE;
+		goto err;
+	}
+	rx->running = 1;
+	ceci_dbg(HANDLE_CTX(handle), "started reader thread with %d slots", slots);
+	goto out;
+err:
+	ceci_free(HANDLE_CTX(handle), rx->slots);
+	ceci_free(HANDLE_CTX(handle), rx->slot_info);
+	rx->slots = NULL;
+	rx->slot_info = NULL;
+out:
+	pthread_mutex_unlock(&rx->lock);
+	return r;
+}
+
+/*
+ * Wait for the ring to be non empty. Must be called with the lock held.
+ * A zero timeout never blocks, a negative one waits forever.
+ */
+static int ceci_rx_wait(ceci_rx_state* rx, int32_t timeout)
+{
+	struct timespec deadline;
+
+	ceci_deadline(&deadline, (timeout > 0) ? timeout : 0);
+	while (rx->count == 0) {
+		if (rx->closing) {
+			return LIBCEC_ERROR_INTERRUPTED;
+		}
+		if (timeout == 0) {
+			return LIBCEC_ERROR_TIMEOUT;
+		}
+		if (timeout < 0) {
+			pthread_cond_wait(&rx->cond, &rx->lock);
+		} else if (pthread_cond_timedwait(&rx->cond, &rx->lock, &deadline) == ETIMEDOUT) {
+			if (rx->count == 0) {
+				return LIBCEC_ERROR_TIMEOUT;
+			}
+		}
+	}
+	return LIBCEC_SUCCESS;
+}
+
+/* Release the n oldest slots. Must be called with the lock held */
+static void ceci_rx_consume(libcec_device_handle* handle, unsigned int n)
+{
+	ceci_rx_state* rx = &handle->rx;
+	uint64_t count;
+
+	rx->head = (rx->head + n) % rx->size;
+	rx->count -= n;
+	if (rx->count == 0) {
+		/* clear readiness */
+		if (read(rx->event_fd, &count, sizeof(count)) != sizeof(count)) {
+			ceci_dbg(HANDLE_CTX(handle), "eventfd was not signaled");
+		}
+	}
+}
+
+/*
+ * Register a caller on the receive path, so that libcec_close() can wait
+ * for it to leave. Must be called with the lock held.
+ */
+static int ceci_rx_enter(ceci_rx_state* rx)
+{
+	if (rx->closing) {
+		return LIBCEC_ERROR_INTERRUPTED;
+	}
+	rx->readers++;
+	return LIBCEC_SUCCESS;
+}
+
+/* Must be called with the lock held */
+static void ceci_rx_leave(ceci_rx_state* rx)
+{
+	rx->readers--;
+	if (rx->closing) {
+		pthread_cond_broadcast(&rx->cond);
+	}
+}
+
+/* Read a message, from the reader if it runs, or straight from the backend */
+int ceci_rx_read(libcec_device_handle* handle, uint8_t* buffer, size_t length, int32_t timeout)
+{
+	ceci_rx_state* rx = &handle->rx;
+	uint64_t timestamp = 0;
+	int r;
+
+	pthread_mutex_lock(&rx->lock);
+	r = ceci_rx_enter(rx);
+	if (r != LIBCEC_SUCCESS) {
+		pthread_mutex_unlock(&rx->lock);
+		return r;
+	}
+	if (!rx->running) {
+		/* don't hold the lock while blocking in the driver */
+		pthread_mutex_unlock(&rx->lock);
+		r = ceci_backend_read(handle, buffer, length, timeout, &timestamp);
+		pthread_mutex_lock(&rx->lock);
+		goto out;
+	}
+	r = ceci_rx_wait(rx, timeout);
+	if (r != LIBCEC_SUCCESS) {
+		goto out;
+	}
+	r = rx->slot_info[rx->head].length;
+	if ((size_t)r > length) {
+		r = LIBCEC_ERROR_OVERFLOW;
+	} else {
+		memcpy(buffer, rx->slots[rx->head], r);
+	}
+	ceci_rx_consume(handle, 1);
+out:
+	ceci_rx_leave(rx);
+	pthread_mutex_unlock(&rx->lock);
+	return r;
+}
+
+/*
+ * Read up to max frames, returns the number of frames. Without a reader,
+ * only backends that can poll can tell what else is pending without blocking.
+ */
+int ceci_rx_read_batch(libcec_device_handle* handle, libcec_frame* frames, int max, int32_t timeout)
+{
+	ceci_rx_state* rx = &handle->rx;
+	unsigned int i, n = 0;
+	int r;
+
+	pthread_mutex_lock(&rx->lock);
+	r = ceci_rx_enter(rx);
+	if (r != LIBCEC_SUCCESS) {
+		pthread_mutex_unlock(&rx->lock);
+		return r;
+	}
+	if (!rx->running) {
+		pthread_mutex_unlock(&rx->lock);
+		for (n=0; n<(unsigned int)max; n++) {
+			r = ceci_read_frame(handle, &frames[n], (n == 0) ? timeout : 0);
+			if (r < 0) {
+				break;
+			}
+			if (handle->backend->get_pollfd == NULL) {
+				n++;
+				break;
+			}
+		}
+		pthread_mutex_lock(&rx->lock);
+		goto out;
+	}
+	r = ceci_rx_wait(rx, timeout);
+	if (r != LIBCEC_SUCCESS) {
+		goto out;
+	}
+	n = MIN(rx->count, (unsigned int)max);
+	for (i=0; i<n; i++) {
+		ceci_rx_load(rx, (rx->head + i) % rx->size, &frames[i]);
+	}
+	ceci_rx_consume(handle, n);
+out:
+	ceci_rx_leave(rx);
+	pthread_mutex_unlock(&rx->lock);
+	return (n == 0) ? r : (int)n;
+}
+
+/* Elapsed time since start, in us */
+static uint32_t ceci_elapsed_us(struct timespec* start, struct timespec* end)
+{
+	return (uint32_t)((end->tv_sec - start->tv_sec) * 1000000 + (end->tv_nsec - start->tv_nsec) / 1000);
+}
+
+/* Complete a transmission status when the backend left the result to the core */
+static void ceci_tx_set_result(libcec_tx_status* status, int r)
+{
+	if ((r == LIBCEC_SUCCESS) || (status->result != LIBCEC_TX_OK)) {
+		return;
+	}
+	switch (r) {
+	case LIBCEC_ERROR_BUSY:
+		status->result = LIBCEC_TX_ARB_LOST;
+		break;
+	case LIBCEC_ERROR_TIMEOUT:
+		status->result = LIBCEC_TX_TIMEOUT;
+		break;
+	default:
+		status->result = LIBCEC_TX_ERROR;
+		break;
+	}
+}
+
+/*
+ * Transmit side: a FIFO of frames drained by a worker thread. A frame that
+ * is identical to one still waiting in the queue is merged with it, rather
+ * than queued again, and everybody waiting on either gets the same result.
+ */
+static void* ceci_tx_thread(void* arg)
+{
+	libcec_device_handle* handle = (libcec_device_handle*)arg;
+	ceci_tx_state* tx = &handle->tx;
+	ceci_tx_entry* entry;
+	ceci_tx_waiter* waiter;
+	libcec_tx_callback callback;
+	void* callback_data;
+	libcec_tx_status status;
+	struct timespec start, end;
+	uint8_t buffer[LIBCEC_MAX_FRAME_SIZE];
+	size_t length;
+	int r;
+
+	pthread_mutex_lock(&tx->lock);
+	while (1) {
+		while ((tx->count == 0) && !tx->stop) {
+			pthread_cond_wait(&tx->cond, &tx->lock);
+		}
+		/* drain the queue before stopping */
+		if (tx->count == 0) {
+			break;
+		}
+		entry = &tx->entries[tx->head];
+		memcpy(buffer, entry->frame, entry->length);
+		length = entry->length;
+		/* the head frame can no longer be merged with */
+		tx->sending = 1;
+		pthread_mutex_unlock(&tx->lock);
+
+		memset(&status, 0, sizeof(status));
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		r = handle->backend->write_message(handle, buffer, length, &status);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ceci_stats_record(handle, LIBCEC_STATS_WRITE_MESSAGE,
+			(uint64_t)start.tv_sec * 1000000ULL + start.tv_nsec / 1000, r);
+		if (r == LIBCEC_SUCCESS) {
+			ceci_stats_frame(handle, 1, length);
+		}
+		ceci_tx_set_result(&status, r);
+		status.queued_time = ceci_elapsed_us(&entry->queued, &start);
+		status.wire_time = ceci_elapsed_us(&start, &end);
+
+		pthread_mutex_lock(&tx->lock);
+		if (entry->async) {
+			callback = tx->callback;
+			callback_data = tx->callback_data;
+			if (callback != NULL) {
+				/* the head entry stays in place, so nobody can merge with it meanwhile */
+				pthread_mutex_unlock(&tx->lock);
+				callback(handle, buffer, length, &status, callback_data);
+				pthread_mutex_lock(&tx->lock);
+			} else if (r != LIBCEC_SUCCESS) {
+				ceci_warn(HANDLE_CTX(handle), "could not send queued message %02X: %s", buffer[0], libcec_strerror(r));
+			}
+		}
+		for (waiter = entry->waiters; waiter != NULL; waiter = waiter->next) {
+			waiter->result = r;
+			waiter->status = status;
+			waiter->done = 1;
+		}
+		entry->waiters = NULL;
+		tx->head = (tx->head + 1) % CECI_TX_SLOTS;
+		tx->count--;
+		tx->sending = 0;
+		pthread_cond_broadcast(&tx->cond);
+	}
+	pthread_mutex_unlock(&tx->lock);
+	return NULL;
+}
+
+int ceci_tx_start(libcec_device_handle* handle)
+{
+	ceci_tx_state* tx = &handle->tx;
+	int r = LIBCEC_SUCCESS;
+
+	pthread_mutex_lock(&tx->lock);
+	if (tx->stop) {
+		r = LIBCEC_ERROR_INTERRUPTED;
+	} else if (!tx->running) {
+		if (pthread_create(&tx->thread, NULL, ceci_tx_thread, handle) != 0) {
+			ceci_error(HANDLE_CTX(handle), "could not create transmit thread");
+			r = LIBCEC_ERROR_RESOURCE;
+		} else {
+			tx->running = 1;
+			ceci_dbg(HANDLE_CTX(handle), "started transmit thread");
+		}
+	}
+	pthread_mutex_unlock(&tx->lock);
+	return r;
+}
+
+/* Look for a waiting frame identical to this one. Must be called with the lock held */
+static ceci_tx_entry* ceci_tx_find(ceci_tx_state* tx, uint8_t* buffer, size_t length)
+{
+	ceci_tx_entry* entry;
+	unsigned int i;
+
+	for (i = tx->sending; i < tx->count; i++) {
+		entry = &tx->entries[(tx->head + i) % CECI_TX_SLOTS];
+		if ((entry->length == length) && (memcmp(entry->frame, buffer, length) == 0)) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Queue a frame, or merge it with an identical one that is still waiting.
+ * Must be called with the lock held and a free slot. If waiter is not
+ * NULL, it is notified when the frame has been transmitted.
+ */
+static void ceci_tx_enqueue(libcec_device_handle* handle, uint8_t* buffer, size_t length, ceci_tx_waiter* waiter)
+{
+	ceci_tx_state* tx = &handle->tx;
+	ceci_tx_entry* entry;
+
+	entry = ceci_tx_find(tx, buffer, length);
+	if (entry != NULL) {
+		ceci_dbg(HANDLE_CTX(handle), "merged message %02X %02X with pending duplicate", buffer[0], (length > 1) ? buffer[1] : 0);
+		tx->coalesced++;
+		goto out;
+	}
+	entry = &tx->entries[(tx->head + tx->count) % CECI_TX_SLOTS];
+	memcpy(entry->frame, buffer, length);
+	entry->length = (uint8_t)length;
+	entry->async = 0;
+	entry->waiters = NULL;
+	clock_gettime(CLOCK_MONOTONIC, &entry->queued);
+	tx->count++;
+	pthread_cond_broadcast(&tx->cond);
+out:
+	if (waiter != NULL) {
+		waiter->done = 0;
+		waiter->next = entry->waiters;
+		entry->waiters = waiter;
+	} else {
+		entry->async = 1;
+	}
+}
+
+/*
+ * Wait for a free slot, or return LIBCEC_ERROR_BUSY on a zero timeout.
+ * Must be called with the lock held. A frame that can be merged with a
+ * pending one never needs to wait. Once the handle is closing, nothing
+ * can be queued anymore.
+ */
+static int ceci_tx_wait_slot(ceci_tx_state* tx, uint8_t* buffer, size_t length, int32_t timeout)
+{
+	while ((tx->count >= CECI_TX_SLOTS) && (ceci_tx_find(tx, buffer, length) == NULL)) {
+		if (tx->stop) {
+			break;
+		}
+		if (timeout == 0) {
+			return LIBCEC_ERROR_BUSY;
+		}
+		pthread_cond_wait(&tx->cond, &tx->lock);
+	}
+	return tx->stop ? LIBCEC_ERROR_INTERRUPTED : LIBCEC_SUCCESS;
+}
+
+/*
+ * Asynchronous transmission. Waits for room in the queue only if timeout
+ * is non zero, otherwise returns LIBCEC_ERROR_BUSY when the queue is full.
+ */
+int ceci_tx_submit(libcec_device_handle* handle, uint8_t* buffer, size_t length, int32_t timeout)
+{
+	ceci_tx_state* tx = &handle->tx;
+	int r;
+
+	r = ceci_tx_start(handle);
+	if (r != LIBCEC_SUCCESS) {
+		return r;
+	}
+	pthread_mutex_lock(&tx->lock);
+	r = ceci_tx_wait_slot(tx, buffer, length, timeout);
+	if (r == LIBCEC_SUCCESS) {
+		ceci_tx_enqueue(handle, buffer, length, NULL);
+	}
+	pthread_mutex_unlock(&tx->lock);
+	return r;
+}
+
+/*
+ * Register a synchronous writer, so that libcec_close() can wait for it
+ * to be done with the queue. Must be called with the lock held.
+ */
+static int ceci_tx_enter(ceci_tx_state* tx)
+{
+	if (tx->stop) {
+		return LIBCEC_ERROR_INTERRUPTED;
+	}
+	tx->writers++;
+	return LIBCEC_SUCCESS;
+}
+
+/* Must be called with the lock held */
+static void ceci_tx_leave(ceci_tx_state* tx)
+{
+	tx->writers--;
+	if (tx->stop) {
+		pthread_cond_broadcast(&tx->cond);
+	}
+}
+
+/*
+ * Synchronous transmission, through the queue, so that it keeps frames in
+ * order. If status is not NULL, it receives the completion status.
+ */
+int ceci_tx_write(libcec_device_handle* handle, uint8_t* buffer, size_t length, libcec_tx_status* status)
+{
+	ceci_tx_state* tx = &handle->tx;
+	ceci_tx_waiter waiter;
+	int r;
+
+	r = ceci_tx_start(handle);
+	if (r != LIBCEC_SUCCESS) {
+		return r;
+	}
+	pthread_mutex_lock(&tx->lock);
+	r = ceci_tx_enter(tx);
+	if (r != LIBCEC_SUCCESS) {
+		pthread_mutex_unlock(&tx->lock);
+		return r;
+	}
+	r = ceci_tx_wait_slot(tx, buffer, length, -1);
+	if (r != LIBCEC_SUCCESS) {
+		ceci_tx_leave(tx);
+		pthread_mutex_unlock(&tx->lock);
+		return r;
+	}
+	ceci_tx_enqueue(handle, buffer, length, &waiter);
+	while (!waiter.done) {
+		pthread_cond_wait(&tx->cond, &tx->lock);
+	}
+	ceci_tx_leave(tx);
+	pthread_mutex_unlock(&tx->lock);
+	if (status != NULL) {
+		*status = waiter.status;
+	}
+	return waiter.result;
+}
+
+/*
+ * Synchronous transmission of up to CECI_TX_SLOTS frames, queued back to
+ * back so that the bus doesn't idle between them. Returns once they have
+ * all been processed, with the outcome of each in results and status.
+ */
+int ceci_tx_write_multiple(libcec_device_handle* handle, libcec_frame* frames, int nb_frames,
+	int* results, libcec_tx_status* status)
+{
+	ceci_tx_state* tx = &handle->tx;
+	ceci_tx_waiter waiters[CECI_TX_SLOTS];
+	int i, r;
+
+	if (nb_frames > CECI_TX_SLOTS) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	r = ceci_tx_start(handle);
+	if (r != LIBCEC_SUCCESS) {
+		return r;
+	}
+	pthread_mutex_lock(&tx->lock);
+	r = ceci_tx_enter(tx);
+	if (r != LIBCEC_SUCCESS) {
+		pthread_mutex_unlock(&tx->lock);
+		return r;
+	}
+	for (i=0; i<nb_frames; i++) {
+		r = ceci_tx_wait_slot(tx, frames[i].data, frames[i].length, -1);
+		if (r != LIBCEC_SUCCESS) {
+			/* closing: report the frames we couldn't queue as such */
+			waiters[i].done = 1;
+			waiters[i].result = r;
+			memset(&waiters[i].status, 0, sizeof(waiters[i].status));
+			waiters[i].status.result = LIBCEC_TX_ERROR;
+			continue;
+		}
+		ceci_tx_enqueue(handle, frames[i].data, frames[i].length, &waiters[i]);
+	}
+	for (i=0; i<nb_frames; i++) {
+		while (!waiters[i].done) {
+			pthread_cond_wait(&tx->cond, &tx->lock);
+		}
+		results[i] = waiters[i].result;
+		status[i] = waiters[i].status;
+	}
+	ceci_tx_leave(tx);
+	pthread_mutex_unlock(&tx->lock);
+	return LIBCEC_SUCCESS;
+}
+
+void ceci_tx_set_callback(libcec_device_handle* handle, libcec_tx_callback callback, void* user_data)
+{
+	pthread_mutex_lock(&handle->tx.lock);
+	handle->tx.callback = callback;
+	handle->tx.callback_data = user_data;
+	pthread_mutex_unlock(&handle->tx.lock);
+}
+
+/*
+ * Transactions: the caller registers with the receive side before sending
+ * its request, so that an early answer can't be missed, then waits for the
+ * reader to route the answer to it. Answers only ever need the receive
+ * lock, so any number of transactions can be outstanding at once.
+ */
+int ceci_rx_transact(libcec_device_handle* handle, uint8_t* request, size_t length,
+	uint8_t expected_opcode, int32_t timeout, libcec_frame* reply)
+{
+	ceci_rx_state* rx = &handle->rx;
+	ceci_rx_waiter waiter, **prev;
+	struct timespec deadline;
+	int r;
+
+	/* somebody must be reading for the answer to be seen */
+	r = ceci_rx_start(handle, CECI_RX_SLOTS);
+	if (r != LIBCEC_SUCCESS) {
+		return r;
+	}
+	memset(&waiter, 0, sizeof(waiter));
+	waiter.initiator = request[0] & 0x0F;
+	waiter.destination = request[0] >> 4;
+	waiter.opcode = expected_opcode;
+	waiter.request_opcode = request[1];
+	waiter.reply = reply;
+
+	pthread_mutex_lock(&rx->lock);
+	r = ceci_rx_enter(rx);
+	if (r != LIBCEC_SUCCESS) {
+		pthread_mutex_unlock(&rx->lock);
+		return r;
+	}
+	waiter.next = rx->transactions;
+	rx->transactions = &waiter;
+	pthread_mutex_unlock(&rx->lock);
+
+	r = ceci_tx_write(handle, request, length, NULL);
+
+	pthread_mutex_lock(&rx->lock);
+	if (r == LIBCEC_SUCCESS) {
+		/* the destination has until the timeout to answer, from the end of the request */
+		ceci_deadline(&deadline, (timeout > 0) ? timeout : 0);
+		while (!waiter.done) {
+			if (rx->closing) {
+				r = LIBCEC_ERROR_INTERRUPTED;
+				break;
+			}
+			if (timeout < 0) {
+				pthread_cond_wait(&rx->cond, &rx->lock);
+			} else if ( (timeout == 0)
+			  || (pthread_cond_timedwait(&rx->cond, &rx->lock, &deadline) == ETIMEDOUT) ) {
+				if (!waiter.done) {
+					r = LIBCEC_ERROR_TIMEOUT;
+					break;
+				}
+			}
+		}
+		if (waiter.done) {
+			r = waiter.result;
+		}
+	}
+	for (prev = &rx->transactions; *prev != &waiter; prev = &(*prev)->next);
+	*prev = waiter.next;
+	ceci_rx_leave(rx);
+	pthread_mutex_unlock(&rx->lock);
+	return r;
+}
@@ -23,74 +23,321 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/types.h>
 
 #include "libceci.h"
 
+/* Compiled-in backends. The first one is used for device names without a scheme */
+static const _ceci_backend* const ceci_backends[] = {
 #if defined(LINUX_REALTEK_SOC)
-const _ceci_backend* const ceci_backend = &linux_realtek_soc_backend;
-#else
+	&linux_realtek_soc_backend,
+#endif
+#if defined(LINUX_CEC)
+	&linux_cec_backend,
+#endif
+#if defined(SERIAL_CEC)
+	&serial_cec_backend,
+#endif
+#if defined(LOOPBACK)
+	&loopback_backend,
+#endif
+	NULL
+};
+#define NB_BACKENDS	(sizeof(ceci_backends)/sizeof(ceci_backends[0]) - 1)
+
+#if !defined(LINUX_REALTEK_SOC) && !defined(LINUX_CEC) && !defined(SERIAL_CEC) && !defined(LOOPBACK)
 #error "Unsupported CEC backend"
 #endif
 
+/*
+ * Backends are only initialized the first time a device is opened with them,
+ * and are exited once the last context that used them exits.
+ */
+static unsigned int ceci_backend_users[NB_BACKENDS];
+static pthread_mutex_t ceci_backend_lock = PTHREAD_MUTEX_INITIALIZER;
+
 const libcec_version libcec_version_internal = {
 	LIBCEC_VERSION_MAJOR, LIBCEC_VERSION_MINOR,
 	LIBCEC_VERSION_MICRO, LIBCEC_VERSION_NANO };
 
-FILE* ceci_logger = NULL;
-int ceci_global_log_level = LIBCEC_LOG_LEVEL_INFO;
+/* Used by the calls that don't take a context, and when a NULL context is passed */
+static libcec_context ceci_default_context = {
+	NULL, LIBCEC_LOG_LEVEL_INFO, { NULL, NULL, NULL }, 0, 0, PTHREAD_MUTEX_INITIALIZER
+};
+
+libcec_context* ceci_get_context(libcec_context* ctx)
+{
+	return (ctx != NULL) ? ctx : &ceci_default_context;
+}
+
+void* ceci_malloc(libcec_context* ctx, size_t size)
+{
+	ctx = ceci_get_context(ctx);
+	if (ctx->allocator.alloc != NULL) {
+		return ctx->allocator.alloc(size, ctx->allocator.user_data);
+	}
+	return malloc(size);
+}
+
+void* ceci_calloc(libcec_context* ctx, size_t nmemb, size_t size)
+{
+	void* ptr;
+
+	if ((size != 0) && (nmemb > SIZE_MAX / size)) {
+		return NULL;
+	}
+	ptr = ceci_malloc(ctx, nmemb * size);
+	if (ptr != NULL) {
+		memset(ptr, 0, nmemb * size);
+	}
+	return ptr;
+}
+
+void ceci_free(libcec_context* ctx, void* ptr)
+{
+	if (ptr == NULL) {
+		return;
+	}
+	ctx = ceci_get_context(ctx);
+	if (ctx->allocator.free != NULL) {
+		ctx->allocator.free(ptr, ctx->allocator.user_data);
+	} else {
+		free(ptr);
+	}
+}
 
 /*
- * Set the logging level and destination.
+ * Set the logging level and destination of a context.
  * If the stream is NULL, stderr will be used.
  * The stream must be open by the caller.
- * This function can be called outside of init/exit
+ * This function can be called outside of init/exit, for the default context
  */
 DEFAULT_VISIBILITY
-void libcec_set_logging(int level, FILE* stream)
+void libcec_set_logging_ex(libcec_context* ctx, int level, FILE* stream)
 {
-	ceci_global_log_level = level;
+	ctx = ceci_get_context(ctx);
+	ctx->log_level = level;
 	if (stream == NULL) {
-		ceci_logger = stderr;
+		ctx->logger = stderr;
+	} else {
+		ctx->logger = stream;
+	}
+}
+
+DEFAULT_VISIBILITY
+void libcec_set_logging(int level, FILE* stream)
+{
+	libcec_set_logging_ex(NULL, level, stream);
+}
+
+/*
+ * Create a context. If allocator is not NULL, the context, the handles opened
+ * with it and their internal buffers are allocated with it. Both of its
+ * callbacks must be set.
+ * If ctx is NULL, the default context is initialized instead. Its allocator
+ * can only be changed while no device is open with it, or LIBCEC_ERROR_BUSY
+ * is returned.
+ */
+DEFAULT_VISIBILITY
+int libcec_init_ex(libcec_context** ctx, const libcec_allocator* allocator)
+{
+	libcec_context* _ctx;
+
+	if ( (allocator != NULL)
+	  && ((allocator->alloc == NULL) || (allocator->free == NULL)) ) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+
+	if (ctx == NULL) {
+		if (allocator != NULL) {
+			/* what the open devices hold must be freed with the allocator it came from */
+			pthread_mutex_lock(&ceci_default_context.lock);
+			if (ceci_default_context.nb_handles != 0) {
+				pthread_mutex_unlock(&ceci_default_context.lock);
+				return LIBCEC_ERROR_BUSY;
+			}
+			ceci_default_context.allocator = *allocator;
+			pthread_mutex_unlock(&ceci_default_context.lock);
+		}
+		if (ceci_default_context.logger == NULL) {
+			ceci_default_context.logger = stderr;
+		}
+		return LIBCEC_SUCCESS;
+	}
+
+	if (allocator != NULL) {
+		_ctx = allocator->alloc(sizeof(*_ctx), allocator->user_data);
 	} else {
-		ceci_logger = stream;
+		_ctx = malloc(sizeof(*_ctx));
+	}
+	if (_ctx == NULL) {
+		return LIBCEC_ERROR_RESOURCE;
 	}
+	memset(_ctx, 0, sizeof(*_ctx));
+	if (allocator != NULL) {
+		_ctx->allocator = *allocator;
+	}
+	/* new contexts start with the settings of the default one */
+	_ctx->logger = (ceci_default_context.logger != NULL) ? ceci_default_context.logger : stderr;
+	_ctx->log_level = ceci_default_context.log_level;
+	pthread_mutex_init(&_ctx->lock, NULL);
+
+	*ctx = _ctx;
+	return LIBCEC_SUCCESS;
 }
 
 DEFAULT_VISIBILITY
 int libcec_init(void)
 {
-	if (ceci_logger == NULL) {
-		ceci_logger = stderr;
+	return libcec_init_ex(NULL, NULL);
+}
+
+/*
+ * Release the backends used by a context and, unless it is the default
+ * context, free it. All the devices opened with it must have been closed.
+ */
+DEFAULT_VISIBILITY
+int libcec_exit_ex(libcec_context* ctx)
+{
+	size_t i;
+	int r, ret_val = LIBCEC_SUCCESS;
+	libcec_context* _ctx = ceci_get_context(ctx);
+
+	pthread_mutex_lock(&_ctx->lock);
+	pthread_mutex_lock(&ceci_backend_lock);
+	for (i=0; i<NB_BACKENDS; i++) {
+		if (!(_ctx->backends & (1 << i))) {
+			continue;
+		}
+		if (--ceci_backend_users[i] == 0) {
+			r = ceci_backends[i]->exit();
+			if (r != LIBCEC_SUCCESS) {
+				ret_val = r;
+			}
+		}
+	}
+	pthread_mutex_unlock(&ceci_backend_lock);
+	_ctx->backends = 0;
+	pthread_mutex_unlock(&_ctx->lock);
+
+	if (_ctx != &ceci_default_context) {
+		pthread_mutex_destroy(&_ctx->lock);
+		ceci_free(_ctx, _ctx);
 	}
-	return ceci_backend->init();
+	return ret_val;
 }
 
 DEFAULT_VISIBILITY
 int libcec_exit(void)
 {
-	return ceci_backend->exit();
+	return libcec_exit_ex(NULL);
 }
 
+/*
+ * Find the backend for a "<scheme>:<device>" device name and initialize it
+ * if this is its first use. Names that don't start with a scheme, such as
+ * "/dev/cec/0", are handed over unmodified to the first compiled-in backend.
+ */
+static int ceci_backend_lookup(libcec_context* ctx, char* device_name,
+	const _ceci_backend** backend, char** backend_device)
+{
+	size_t i, len;
+	int r = LIBCEC_SUCCESS;
+
+	*backend = NULL;
+	*backend_device = device_name;
+	for (len=0; (device_name[len] >= 'a') && (device_name[len] <= 'z'); len++);
+	if ((len != 0) && (device_name[len] == ':')) {
+		for (i=0; i<NB_BACKENDS; i++) {
+			if ( (strlen(ceci_backends[i]->scheme) == len)
+			  && (strncmp(device_name, ceci_backends[i]->scheme, len) == 0) ) {
+				break;
+			}
+		}
+		if (i >= NB_BACKENDS) {
+			ceci_error(ctx, "no backend for '%.*s' devices in this build", (int)len, device_name);
+			return LIBCEC_ERROR_NOT_SUPPORTED;
+		}
+		*backend_device = &device_name[len+1];
+	} else {
+		i = 0;
+	}
+
+	pthread_mutex_lock(&ctx->lock);
+	if (!(ctx->backends & (1 << i))) {
+		pthread_mutex_lock(&ceci_backend_lock);
+		if (ceci_backend_users[i] == 0) {
+			r = ceci_backends[i]->init();
+		}
+		if (r == LIBCEC_SUCCESS) {
+			ceci_backend_users[i]++;
+			ctx->backends |= 1 << i;
+		}
+		pthread_mutex_unlock(&ceci_backend_lock);
+	}
+	pthread_mutex_unlock(&ctx->lock);
+	if (r != LIBCEC_SUCCESS) {
+		ceci_error(ctx, "failed to initialize %s backend", ceci_backends[i]->name);
+		return r;
+	}
+
+	*backend = ceci_backends[i];
+	return LIBCEC_SUCCESS;
+}
+
+/* Account for a device of the context, so that its allocator isn't swapped from under it */
+static void ceci_ctx_add_handle(libcec_context* ctx, int n)
+{
+	pthread_mutex_lock(&ctx->lock);
+	ctx->nb_handles += n;
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+/*
+ * Open a CEC device. The device name selects the backend, e.g.
+ * "realtek:/dev/cec/0" or "loop:traffic=10". A name without a
+ * scheme uses the first backend compiled in.
+ * The handle is tied to ctx, or to the default context if ctx is NULL.
+ */
 DEFAULT_VISIBILITY
-int libcec_open(char* device_name, libcec_device_handle** handle)
+int libcec_open_ex(libcec_context* ctx, char* device_name, libcec_device_handle** handle)
 {
-	size_t priv_size = ceci_backend->device_handle_priv_size;
+	const _ceci_backend* backend;
+	char* backend_device;
+	size_t priv_size;
 	struct libcec_device_handle *_handle;
 	int r;
-	ceci_dbg("open %s", device_name);
 
-	_handle = malloc(sizeof(*_handle) + priv_size);
+	if ((device_name == NULL) || (handle == NULL)) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	ctx = ceci_get_context(ctx);
+	ceci_dbg(ctx, "open %s", device_name);
+
+	r = ceci_backend_lookup(ctx, device_name, &backend, &backend_device);
+	if (r != LIBCEC_SUCCESS) {
+		return r;
+	}
+	priv_size = backend->device_handle_priv_size;
+
+	ceci_ctx_add_handle(ctx, 1);
+	_handle = ceci_calloc(ctx, 1, sizeof(*_handle) + priv_size);
 	if (!_handle) {
+		ceci_ctx_add_handle(ctx, -1);
 		return LIBCEC_ERROR_RESOURCE;
 	}
 
-	// TODO: mutex?
-	memset(&_handle->priv, 0, priv_size);
+	_handle->ctx = ctx;
+	_handle->backend = backend;
+	ceci_io_init(_handle);
 
-	r = ceci_backend->open(device_name, _handle);
+	/* nothing was started on a handle that failed to open, and the backend can't cancel */
+	r = backend->open(backend_device, _handle);
 	if (r < 0) {
-		free(_handle);
+		ceci_io_exit(_handle);
+		ceci_free(ctx, _handle);
+		ceci_ctx_add_handle(ctx, -1);
 		return r;
 	}
 
@@ -100,107 +347,427 @@ int libcec_open(char* device_name, libcec_device_handle** handle)
 	return LIBCEC_SUCCESS;
 }
 
+DEFAULT_VISIBILITY
+int libcec_open(char* device_name, libcec_device_handle** handle)
+{
+	return libcec_open_ex(NULL, device_name, handle);
+}
+
 DEFAULT_VISIBILITY
 int libcec_close(libcec_device_handle* handle)
 {
+	libcec_context* ctx;
 	int r;
 
 	if (handle == NULL) {
 		return LIBCEC_ERROR_INVALID_PARAM;
 	}
 
-	r = ceci_backend->close(handle);
-	free(handle);
+	/* the I/O threads use the backend, so they must be stopped first */
+	ctx = HANDLE_CTX(handle);
+	ceci_io_stop(handle);
+	ceci_io_exit(handle);
+	r = handle->backend->close(handle);
+	ceci_free(ctx, handle->edid.path);
+	ceci_free(ctx, handle);
+	ceci_ctx_add_handle(ctx, -1);
+	return r;
+}
+
+/* Ranged EDID read, accounted for in the statistics */
+static int ceci_read_edid_range(libcec_device_handle* handle, uint8_t segment, uint8_t offset,
+	uint8_t* buffer, size_t length)
+{
+	uint64_t start;
+	int r;
+
+	start = ceci_stats_start();
+	r = handle->backend->read_edid_range(handle, segment, offset, buffer, length);
+	ceci_stats_record(handle, LIBCEC_STATS_READ_EDID, start, r);
 	return r;
 }
 
 DEFAULT_VISIBILITY
 int libcec_read_edid(libcec_device_handle* handle, uint8_t* buffer, size_t length)
 {
+	uint64_t start;
+	int r;
+
 	if ((handle == NULL) || (buffer == NULL) || (length < 256)) {
 		return LIBCEC_ERROR_INVALID_PARAM;
 	}
 	memset(buffer, 0, length);
-	return ceci_backend->read_edid(handle, buffer, length);
+	start = ceci_stats_start();
+	r = handle->backend->read_edid(handle, buffer, length);
+	ceci_stats_record(handle, LIBCEC_STATS_READ_EDID, start, r);
+	return r;
 }
 
-DEFAULT_VISIBILITY
-int libcec_get_physical_address(libcec_device_handle* handle, uint16_t* phys_addr)
+/* Read a single 128 bytes EDID block */
+static int ceci_edid_read_block(libcec_device_handle* handle, unsigned int block, uint8_t* buffer)
 {
-	uint8_t edid[256], block_length, checksum = 0;
-	const uint8_t edid_marker[] = {0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00};
-	int i, r, block_start;
+	uint8_t edid[256];
+	int r;
 
-	*phys_addr = 0xFFFF;	/* undetermined */
-	if (handle == NULL) {
-		return LIBCEC_ERROR_INVALID_PARAM;
+	if (handle->backend->read_edid_range != NULL) {
+		return ceci_read_edid_range(handle, (uint8_t)(block / 2),
+			(uint8_t)((block % 2) * CECI_EDID_BLOCK_SIZE), buffer, CECI_EDID_BLOCK_SIZE);
+	}
+	/* Without range reads, we can only access the first segment */
+	if (block >= 2) {
+		ceci_warn(HANDLE_CTX(handle), "EDID block %d cannot be accessed with this backend", block);
+		return LIBCEC_ERROR_NOT_SUPPORTED;
 	}
 	r = libcec_read_edid(handle, edid, sizeof(edid));
 	if (r < 0) {
 		return r;
 	}
+	memcpy(buffer, edid + block * CECI_EDID_BLOCK_SIZE, CECI_EDID_BLOCK_SIZE);
+	return LIBCEC_SUCCESS;
+}
 
-	/* Check the header for EDID signature */
-	if (memcmp(edid, edid_marker, sizeof(edid_marker)) != 0) {
-		ceci_error("invalid EDID header");
-		return LIBCEC_ERROR_IO;
+/*
+ * Read and parse the EDID, one block at a time. Unless need_parse is set,
+ * the extension blocks after the one that holds the HDMI VSDB are not read.
+ * key receives the bytes the EDID cache is keyed by: the extension count,
+ * and the checksums of block 0 and of the block with the VSDB (or block 1).
+ */
+static int ceci_edid_read(libcec_device_handle* handle, libcec_edid_info* info, uint8_t* key, int need_parse)
+{
+	uint8_t block[CECI_EDID_BLOCK_SIZE];
+	unsigned int i;
+	int r;
+
+	r = ceci_edid_read_block(handle, 0, block);
+	if (r != LIBCEC_SUCCESS) {
+		return r;
+	}
+	r = ceci_edid_parse_base(HANDLE_CTX(handle), block, info);
+	if (r != LIBCEC_SUCCESS) {
+		return r;
+	}
+	key[0] = block[0x7e];
+	key[1] = block[0x7f];
+	key[2] = 0;
+
+	for (i=1; (i<=info->nb_extensions) && (need_parse || (info->vsdb_block == 0)); i++) {
+		r = ceci_edid_read_block(handle, i, block);
+		if ((r == LIBCEC_ERROR_NOT_SUPPORTED) && (info->vsdb_block != 0)) {
+			/* the rest is out of reach of the backend, but we have the address */
+			break;
+		}
+		if (r != LIBCEC_SUCCESS) {
+			return r;
+		}
+		if (i == 1) {
+			key[2] = block[0x7f];
+		}
+		r = ceci_edid_parse_extension(HANDLE_CTX(handle), block, info);
+		if (r != LIBCEC_SUCCESS) {
+			return r;
+		}
+		if ((info->flags & LIBCEC_EDID_HDMI) && (info->vsdb_block == 0)) {
+			info->vsdb_block = (uint8_t)i;
+			key[2] = block[0x7f];
+			ceci_dbg(HANDLE_CTX(handle), "found physical address %04X in EDID block %d", info->physical_address, i);
+		}
 	}
+	return LIBCEC_SUCCESS;
+}
+
+/*
+ * Read the bytes that identify an EDID: the header, to make sure a sink is
+ * present, then the extension count and the checksums of block 0 and, if
+ * there are extensions, of the block the key was taken from (see above)
+ */
+static int ceci_edid_probe(libcec_device_handle* handle, uint8_t vsdb_block, uint8_t* key)
+{
+	const uint8_t edid_marker[] = {0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00};
+	uint8_t header[sizeof(edid_marker)];
+	unsigned int block = (vsdb_block != 0) ? vsdb_block : 1;
+	int r;
 
-	/* Validate the EDID checksum */
-	for (i=0; i<0x80; i++) {
-		checksum += edid[i];
+	r = ceci_read_edid_range(handle, 0, 0x00, header, sizeof(header));
+	if (r != LIBCEC_SUCCESS) {
+		return r;
 	}
-	if (checksum != 0) {
-		ceci_error("invalid EDID checksum");
+	if (memcmp(header, edid_marker, sizeof(edid_marker)) != 0) {
 		return LIBCEC_ERROR_IO;
 	}
-
-	/* Confirm that we have an HDMI device */
-	if (edid[0x7e] == 0) {
-		ceci_error("display device does not appear to be HDMI");
-		return LIBCEC_ERROR_NO_DEVICE;
+	r = ceci_read_edid_range(handle, 0, 0x7e, key, 2);
+	if (r != LIBCEC_SUCCESS) {
+		return r;
 	}
+	key[2] = 0;
+	if (key[0] == 0) {
+		return LIBCEC_SUCCESS;
+	}
+	return ceci_read_edid_range(handle, (uint8_t)(block / 2),
+		(uint8_t)((block % 2) * CECI_EDID_BLOCK_SIZE + 0x7f), key+2, 1);
+}
 
-	/* Check that we have an E-EDID extension */
-	if ((edid[0x7e] == 0) || (edid[0x80] != 0x02) || (edid[0x81] != 0x03)) {
-		ceci_error("E-EDID marker not found");
-		return LIBCEC_ERROR_NOT_FOUND;
+static void ceci_edid_cache_save(libcec_device_handle* handle)
+{
+	ceci_edid_cache* cache = &handle->edid;
+	FILE* fd;
+
+	if (cache->path == NULL) {
+		return;
 	}
+	fd = fopen(cache->path, "w");
+	if (fd == NULL) {
+		ceci_warn(HANDLE_CTX(handle), "could not write EDID cache '%s' - errno: %d", cache->path, errno);
+		return;
+	}
+	fprintf(fd, "%02X%02X%02X %02X %04X\n", cache->key[0], cache->key[1], cache->key[2],
+		cache->info.vsdb_block, cache->info.physical_address);
+	fclose(fd);
+}
+
+/*
+ * Make sure the EDID cache is current, and holds the full parse if needed.
+ * The full EDID is only reread if the probe says it changed.
+ */
+static int ceci_edid_update(libcec_device_handle* handle, int need_parse)
+{
+	ceci_edid_cache* cache = &handle->edid;
+	uint8_t key[CECI_EDID_KEY_SIZE];
+	int r;
 
-	for (block_start=0x84; block_start<256; ) {
-		block_length = (edid[block_start] & 0x1f) + 1;
-		switch((edid[block_start]>>5)&7) {
-		case 3:	/* HDMI VSDB */
-			if ( (edid[block_start+1] == 0x03) && (edid[block_start+2] == 0x0c)
-				&& (edid[block_start+3] == 0x00) ) {
-				/* HDMI IEEE Registration Identifier */
-				*phys_addr = (edid[block_start+4]<<8) + edid[block_start+5];
-				ceci_dbg("found physical address %04X", *phys_addr);
+	if (cache->valid) {
+		if (handle->backend->read_edid_range == NULL) {
+			if (cache->parsed || !need_parse) {
 				return LIBCEC_SUCCESS;
 			}
-		default:
-			block_start += block_length;
+		} else if ( (ceci_edid_probe(handle, cache->info.vsdb_block, key) == LIBCEC_SUCCESS)
+		  && (memcmp(key, cache->key, sizeof(key)) == 0) ) {
+			if (cache->parsed || !need_parse) {
+				ceci_dbg(HANDLE_CTX(handle), "EDID unchanged - physical address %04X", cache->info.physical_address);
+				return LIBCEC_SUCCESS;
+			}
+		} else {
+			ceci_dbg(HANDLE_CTX(handle), "EDID changed");
 		}
+		cache->valid = 0;
 	}
 
-	return LIBCEC_ERROR_NOT_FOUND;
+	r = ceci_edid_read(handle, &cache->info, cache->key, need_parse);
+	if (r != LIBCEC_SUCCESS) {
+		return r;
+	}
+	/* unless the read stopped at the VSDB, before the last extension */
+	cache->parsed = need_parse || (cache->info.vsdb_block == 0)
+		|| (cache->info.vsdb_block == cache->info.nb_extensions);
+	cache->valid = 1;
+	ceci_edid_cache_save(handle);
+	return LIBCEC_SUCCESS;
+}
+
+DEFAULT_VISIBILITY
+int libcec_get_physical_address(libcec_device_handle* handle, uint16_t* phys_addr)
+{
+	int r;
+
+	*phys_addr = 0xFFFF;	/* undetermined */
+	if (handle == NULL) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	if (handle->backend->get_physical_address != NULL) {
+		return handle->backend->get_physical_address(handle, phys_addr);
+	}
+	r = ceci_edid_update(handle, 0);
+	if (r != LIBCEC_SUCCESS) {
+		return r;
+	}
+
+	/* Confirm that we have an HDMI device */
+	if (handle->edid.info.nb_extensions == 0) {
+		ceci_error(HANDLE_CTX(handle), "display device does not appear to be HDMI");
+		return LIBCEC_ERROR_NO_DEVICE;
+	}
+	if (handle->edid.info.physical_address == 0xFFFF) {
+		ceci_error(HANDLE_CTX(handle), "HDMI VSDB not found in EDID");
+		return LIBCEC_ERROR_NOT_FOUND;
+	}
+	*phys_addr = handle->edid.info.physical_address;
+	return LIBCEC_SUCCESS;
+}
+
+/*
+ * Fill info with the CEC relevant parts of the EDID: the HDMI VSDB with
+ * the physical address, capabilities and latencies, as well as the sink
+ * identification. This uses the same cache as libcec_get_physical_address().
+ */
+DEFAULT_VISIBILITY
+int libcec_parse_edid(libcec_device_handle* handle, libcec_edid_info* info)
+{
+	int r;
+
+	if ((handle == NULL) || (info == NULL)) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	r = ceci_edid_update(handle, 1);
+	if (r != LIBCEC_SUCCESS) {
+		return r;
+	}
+	*info = handle->edid.info;
+	return LIBCEC_SUCCESS;
+}
+
+/*
+ * Tell libcec that the HDMI connection was replugged, so that the next
+ * libcec_get_physical_address() rereads the EDID.
+ */
+DEFAULT_VISIBILITY
+int libcec_notify_hotplug(libcec_device_handle* handle)
+{
+	if (handle == NULL) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	handle->edid.valid = 0;
+	handle->edid.parsed = 0;
+	return LIBCEC_SUCCESS;
+}
+
+/*
+ * Persist the physical address found in the EDID to a file, and reuse it
+ * from there on the next start, if a cheap probe of the EDID confirms that
+ * it is unchanged. The entry from the file is only used with backends that
+ * can probe the EDID.
+ */
+DEFAULT_VISIBILITY
+int libcec_set_edid_cache_path(libcec_device_handle* handle, const char* path)
+{
+	FILE* fd;
+	unsigned int key, vsdb_block, physical_address;
+
+	if (handle == NULL) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	ceci_free(HANDLE_CTX(handle), handle->edid.path);
+	handle->edid.path = NULL;
+	if (path == NULL) {
+		return LIBCEC_SUCCESS;
+	}
+	handle->edid.path = ceci_malloc(HANDLE_CTX(handle), strlen(path) + 1);
+	if (handle->edid.path == NULL) {
+		return LIBCEC_ERROR_RESOURCE;
+	}
+	strcpy(handle->edid.path, path);
+
+	if ((handle->edid.valid) || (handle->backend->read_edid_range == NULL)) {
+		return LIBCEC_SUCCESS;
+	}
+	fd = fopen(path, "r");
+	if (fd == NULL) {
+		/* not created yet */
+		return LIBCEC_SUCCESS;
+	}
+	if (fscanf(fd, "%6x %2x %4x", &key, &vsdb_block, &physical_address) == 3) {
+		handle->edid.key[0] = (uint8_t)(key >> 16);
+		handle->edid.key[1] = (uint8_t)(key >> 8);
+		handle->edid.key[2] = (uint8_t)key;
+		memset(&handle->edid.info, 0, sizeof(handle->edid.info));
+		handle->edid.info.physical_address = (uint16_t)physical_address;
+		handle->edid.info.nb_extensions = handle->edid.key[0];
+		handle->edid.info.vsdb_block = (uint8_t)vsdb_block;
+		handle->edid.valid = 1;
+		handle->edid.parsed = 0;
+		ceci_dbg(HANDLE_CTX(handle), "loaded cached physical address %04X", handle->edid.info.physical_address);
+	} else {
+		ceci_warn(HANDLE_CTX(handle), "ignoring invalid EDID cache '%s'", path);
+	}
+	fclose(fd);
+	return LIBCEC_SUCCESS;
 }
 
 DEFAULT_VISIBILITY
 int libcec_set_logical_address(libcec_device_handle* handle, uint8_t logical_address)
 {
+	uint64_t start;
+	int r;
+
 	if ((handle == NULL) || (logical_address > 15)) {
 		return LIBCEC_ERROR_INVALID_PARAM;
 	}
-	return ceci_backend->set_logical_address(handle, logical_address);
+	start = ceci_stats_start();
+	r = handle->backend->set_logical_address(handle, logical_address);
+	ceci_stats_record(handle, LIBCEC_STATS_SET_LOGICAL_ADDRESS, start, r);
+	return r;
+}
+
+#define CECI_POLL_ATTEMPTS	3
+
+/*
+ * Poll candidate addresses, given in order of preference, back to back.
+ * A polling message is a frame with the same initiator and destination, and
+ * no data: an address is in use if it is ACKed, and assumed free otherwise.
+ * Losing arbitration tells nothing about the address, so these polls are
+ * retried, and a free address is only picked once all the preferred ones
+ * are known to be taken. Returns the index of the address to use, nb_polls
+ * if there is none, or an error code.
+ */
+static int ceci_poll_candidates(libcec_device_handle* handle, libcec_frame* polls, int nb_polls)
+{
+	enum { POLL_UNKNOWN, POLL_TAKEN, POLL_FREE } state[15];
+	libcec_frame batch[15];
+	libcec_tx_status status[15];
+	int i, j, r, attempt, nb_batch, index[15], results[15];
+
+	for (i=0; i<nb_polls; i++) {
+		state[i] = POLL_UNKNOWN;
+	}
+	for (attempt=0; attempt<CECI_POLL_ATTEMPTS; attempt++) {
+		for (i=0, nb_batch=0; i<nb_polls; i++) {
+			if (state[i] == POLL_UNKNOWN) {
+				index[nb_batch] = i;
+				batch[nb_batch++] = polls[i];
+			}
+		}
+		r = ceci_tx_write_multiple(handle, batch, nb_batch, results, status);
+		if (r != LIBCEC_SUCCESS) return r;
+		for (j=0; j<nb_batch; j++) {
+			if (results[j] == LIBCEC_SUCCESS) {
+				state[index[j]] = POLL_TAKEN;
+			} else if (status[j].result == LIBCEC_TX_ARB_LOST) {
+				ceci_dbg(HANDLE_CTX(handle), "lost arbitration polling address %d", polls[index[j]].data[0] & 0x0F);
+			} else {
+				state[index[j]] = POLL_FREE;
+			}
+		}
+		for (i=0; (i<nb_polls) && (state[i] == POLL_TAKEN); i++);
+		if ((i == nb_polls) || (state[i] == POLL_FREE)) {
+			return i;
+		}
+	}
+	/* the preferred addresses kept losing arbitration: don't risk a clash */
+	ceci_warn(HANDLE_CTX(handle), "could not poll address %d after %d attempts", polls[i].data[0] & 0x0F, attempt);
+	return nb_polls;
 }
 
 DEFAULT_VISIBILITY
 int libcec_allocate_logical_address(libcec_device_handle* handle, uint8_t device_type, uint16_t* physical_address)
+{
+	return libcec_allocate_logical_address_ex(handle, device_type, physical_address, 15, 0xFFFF);
+}
+
+/*
+ * Same as libcec_allocate_logical_address(), but if the physical address
+ * is still last_physical_address, last_logical_address (e.g. the address
+ * claimed on the previous run) is preferred over the other candidates.
+ * The preferred address is polled alone, as it is usually free, and the
+ * remaining candidates are only polled, back to back through the transmit
+ * queue, if it turns out to be taken.
+ */
+DEFAULT_VISIBILITY
+int libcec_allocate_logical_address_ex(libcec_device_handle* handle, uint8_t device_type, uint16_t* physical_address,
+	uint8_t last_logical_address, uint16_t last_physical_address)
 {
 	const uint8_t logical_address_table[15] = {0, 1, 1, 3, 4, 5, 3, 3, 4, 1, 3, 4, 2, 2, 0};
-	int r;
-	uint8_t logical_address, polling_message;
+	libcec_frame polls[15];
+	int r, nb_polls = 0;
+	uint8_t logical_address;
+	uint64_t start;
 
 	if (handle == NULL) {
 		return LIBCEC_ERROR_INVALID_PARAM;
@@ -220,11 +787,11 @@ int libcec_allocate_logical_address(libcec_device_handle* handle, uint8_t device
 	/* Set our logical address to unregistered during allocation */
 	r = libcec_set_logical_address(handle, 15);
 	if (r != LIBCEC_SUCCESS) return r;
-	ceci_dbg("switched to unregistered logical address");
+	ceci_dbg(HANDLE_CTX(handle), "switched to unregistered logical address");
 
 	r = libcec_get_physical_address(handle, physical_address);
 	if (r != LIBCEC_SUCCESS) return r;
-	ceci_info("physical address: %d.%d.%d.%d", (*physical_address>>12)&0xF,
+	ceci_info(HANDLE_CTX(handle), "physical address: %d.%d.%d.%d", (*physical_address>>12)&0xF,
 		(*physical_address>>8)&0xF, (*physical_address>>4)&0xF, (*physical_address>>0)&0xF);
 	if (*physical_address == 0xFFFF) {
 		return LIBCEC_SUCCESS;	/* keep unregistered */
@@ -233,39 +800,87 @@ int libcec_allocate_logical_address(libcec_device_handle* handle, uint8_t device
 	/* TV as root */
 	if (*physical_address == 0x0000) {
 		if (device_type != 0) {
-			ceci_error("invalid device type for physical address 0.0.0.0 - must be TV");
+			ceci_error(HANDLE_CTX(handle), "invalid device type for physical address 0.0.0.0 - must be TV");
 			return LIBCEC_ERROR_INVALID_PARAM;
 		}
 		return libcec_set_logical_address(handle, 0);
 	}
 
+	/* The driver polls and retries by itself */
+	if (handle->backend->claim_logical_address != NULL) {
+		start = ceci_stats_start();
+		r = handle->backend->claim_logical_address(handle, device_type);
+		ceci_stats_record(handle, LIBCEC_STATS_SET_LOGICAL_ADDRESS, start, r);
+		if (r == 15) {
+			ceci_warn(HANDLE_CTX(handle), "exhausted all possible logical addresses - keeping unregistered (15)");
+			return LIBCEC_SUCCESS;
+		}
+		if (r >= 0) {
+			ceci_dbg(HANDLE_CTX(handle), "using logical address %d", r);
+		}
+		return r;
+	}
+
+	/* The address we had comes first, if we haven't moved */
+	if ( (last_physical_address == *physical_address) && (last_logical_address > 0)
+	  && (last_logical_address < 15) && (logical_address_table[last_logical_address] == device_type) ) {
+		polls[nb_polls].data[0] = last_logical_address << 4 | last_logical_address;
+		polls[nb_polls].length = 1;
+		nb_polls++;
+	} else {
+		last_logical_address = 15;
+	}
 	for (logical_address = 1; logical_address < 15; logical_address++) {
-		if (logical_address_table[logical_address] != device_type) {
+		if ( (logical_address_table[logical_address] != device_type)
+		  || (logical_address == last_logical_address) ) {
 			continue;
 		}
-		polling_message = logical_address << 4 | logical_address;
-		ceci_dbg("querying logical address %d\n", logical_address);
-		if (libcec_write_message(handle, &polling_message, 1) != LIBCEC_SUCCESS) {
-			/* error on polling (no ACK) => assume address is free */
-			r = libcec_set_logical_address(handle, logical_address);
-			if (r != LIBCEC_SUCCESS) return r;
-			ceci_dbg("using logical address %d\n", logical_address);
-			return logical_address;
-		}
-		ceci_dbg("address already in use - trying next\n");
+		polls[nb_polls].data[0] = logical_address << 4 | logical_address;
+		polls[nb_polls].length = 1;
+		nb_polls++;
 	}
 
-	ceci_warn("exhausted all possible logical addresses - keeping unregistered (15)\n");
+	/* Poll the preferred address alone, then the others if it is taken */
+	ceci_dbg(HANDLE_CTX(handle), "querying %s logical address %d", (last_logical_address < 15) ? "last" : "preferred",
+		polls[0].data[0] & 0x0F);
+	r = ceci_poll_candidates(handle, polls, 1);
+	if ((r == 1) && (nb_polls > 1)) {
+		ceci_dbg(HANDLE_CTX(handle), "address %d is not available - querying %d others", polls[0].data[0] & 0x0F, nb_polls - 1);
+		r = ceci_poll_candidates(handle, &polls[1], nb_polls - 1);
+		if (r >= 0) r++;
+	}
+	if (r < 0) return r;
+
+	if (r < nb_polls) {
+		logical_address = polls[r].data[0] & 0x0F;
+		r = libcec_set_logical_address(handle, logical_address);
+		if (r != LIBCEC_SUCCESS) return r;
+		ceci_dbg(HANDLE_CTX(handle), "%s logical address %d", (logical_address == last_logical_address) ? "reclaimed" : "using",
+			logical_address);
+		return logical_address;
+	}
+
+	ceci_warn(HANDLE_CTX(handle), "exhausted all possible logical addresses - keeping unregistered (15)");
 	return LIBCEC_SUCCESS;
 }
 
 DEFAULT_VISIBILITY
 int libcec_write_message(libcec_device_handle* handle, uint8_t* buffer, size_t length)
 {
-	if ((handle == NULL) || (buffer == NULL) || (length == 0)) {
+	return libcec_write_message_ex(handle, buffer, length, NULL);
+}
+
+/*
+ * Same as libcec_write_message(), but also fills status, if not NULL,
+ * with the outcome of the transmission and how long it took.
+ */
+DEFAULT_VISIBILITY
+int libcec_write_message_ex(libcec_device_handle* handle, uint8_t* buffer, size_t length, libcec_tx_status* status)
+{
+	if ((handle == NULL) || (buffer == NULL) || (length == 0) || (length > LIBCEC_MAX_FRAME_SIZE)) {
 		return LIBCEC_ERROR_INVALID_PARAM;
 	}
-	return ceci_backend->write_message(handle, buffer, length);
+	return ceci_tx_write(handle, buffer, length, status);
 }
 
 DEFAULT_VISIBILITY
@@ -274,20 +889,229 @@ int libcec_read_message(libcec_device_handle* handle, uint8_t* buffer, size_t le
 	if ((handle == NULL) || (buffer == NULL) || (length == 0)) {
 		return LIBCEC_ERROR_INVALID_PARAM;
 	}
-	return ceci_backend->read_message(handle, buffer, length, timeout);
+	return ceci_rx_read(handle, buffer, length, timeout);
+}
+
+/*
+ * Same as libcec_read_message(), but also returns when the frame was
+ * received, and whether it was directed or broadcast.
+ */
+DEFAULT_VISIBILITY
+int libcec_read_message_ex(libcec_device_handle* handle, libcec_frame* frame, int32_t timeout)
+{
+	int r;
+
+	if (frame == NULL) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	r = libcec_read_messages(handle, frame, 1, timeout);
+	if (r < 0) {
+		return r;
+	}
+	return frame->length;
+}
+
+/*
+ * Return a file descriptor that polls readable (POLLIN) whenever
+ * libcec_try_read_message() has a message to return, so that CEC
+ * can be added to an application's poll/epoll loop. The descriptor
+ * belongs to the handle and must not be read or closed by the caller.
+ * If the reader doesn't run, this is the backend's own descriptor, and
+ * the reader can no longer be started after that.
+ */
+DEFAULT_VISIBILITY
+int libcec_get_pollfd(libcec_device_handle* handle)
+{
+	int r;
+
+	if (handle == NULL) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	pthread_mutex_lock(&handle->rx.lock);
+	if (handle->rx.running) {
+		r = handle->rx.event_fd;
+		pthread_mutex_unlock(&handle->rx.lock);
+		return r;
+	}
+	if (handle->backend->get_pollfd != NULL) {
+		handle->rx.pollfd_lent = 1;
+		pthread_mutex_unlock(&handle->rx.lock);
+		return handle->backend->get_pollfd(handle);
+	}
+	pthread_mutex_unlock(&handle->rx.lock);
+	r = ceci_rx_start(handle, CECI_RX_SLOTS);
+	if (r != LIBCEC_SUCCESS) {
+		return r;
+	}
+	return handle->rx.event_fd;
+}
+
+/*
+ * Non-blocking read. Returns the number of bytes read, or
+ * LIBCEC_ERROR_TIMEOUT if no message is pending.
+ */
+DEFAULT_VISIBILITY
+int libcec_try_read_message(libcec_device_handle* handle, uint8_t* buffer, size_t length)
+{
+	int r;
+
+	if ((handle == NULL) || (buffer == NULL) || (length == 0)) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	if ((handle->backend->get_pollfd == NULL) && (!handle->rx.running)) {
+		r = ceci_rx_start(handle, CECI_RX_SLOTS);
+		if (r != LIBCEC_SUCCESS) {
+			return r;
+		}
+	}
+	return libcec_read_message(handle, buffer, length, 0);
+}
+
+/*
+ * Non-blocking write. The message is added to the transmit queue, and
+ * LIBCEC_ERROR_BUSY is returned if the queue is full. Transmission
+ * errors are only logged.
+ */
+DEFAULT_VISIBILITY
+int libcec_try_write_message(libcec_device_handle* handle, uint8_t* buffer, size_t length)
+{
+	if ((handle == NULL) || (buffer == NULL) || (length == 0) || (length > LIBCEC_MAX_FRAME_SIZE)) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	return ceci_tx_submit(handle, buffer, length, 0);
+}
+
+/*
+ * Asynchronous write. The message is added to the transmit queue, which
+ * only blocks if the queue is full. A message identical to one still
+ * waiting in the queue is merged with it, and sent once.
+ */
+DEFAULT_VISIBILITY
+int libcec_submit_message(libcec_device_handle* handle, uint8_t* buffer, size_t length)
+{
+	if ((handle == NULL) || (buffer == NULL) || (length == 0) || (length > LIBCEC_MAX_FRAME_SIZE)) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	return ceci_tx_submit(handle, buffer, length, -1);
+}
+
+/*
+ * Set a callback to receive the completion status of the messages sent
+ * with libcec_submit_message() or libcec_try_write_message(). The callback
+ * runs on the transmit thread and must not wait on the transmit queue.
+ * A NULL callback disables it, in which case failures are only logged.
+ */
+DEFAULT_VISIBILITY
+int libcec_set_tx_callback(libcec_device_handle* handle, libcec_tx_callback callback, void* user_data)
+{
+	if (handle == NULL) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	ceci_tx_set_callback(handle, callback, user_data);
+	return LIBCEC_SUCCESS;
+}
+
+/*
+ * Start a reader thread that drains the device into a preallocated ring
+ * of 'slots' messages, so that messages no longer queue in the driver
+ * while the application is busy. When the ring is full, the oldest
+ * messages are dropped. This must be called before any read, and before
+ * libcec_get_pollfd(), and can only be called once per handle.
+ */
+DEFAULT_VISIBILITY
+int libcec_set_rx_buffering(libcec_device_handle* handle, unsigned int slots)
+{
+	if ((handle == NULL) || (slots == 0)) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	if (handle->rx.running) {
+		return LIBCEC_ERROR_BUSY;
+	}
+	return ceci_rx_start(handle, slots);
+}
+
+/*
+ * Only receive the frames from an initiator whose bit is set in initiator_mask
+ * and whose opcode, if any, is set in opcode_bitmap, which holds
+ * LIBCEC_RX_FILTER_SIZE bytes (see LIBCEC_RX_FILTER_SET). A NULL bitmap lets
+ * every opcode through, and (NULL, 0xFFFF) removes the filter.
+ * Frames are dropped as early as possible: in the driver if it can filter,
+ * else as soon as libcec gets them, so they never wake a reader up.
+ */
+DEFAULT_VISIBILITY
+int libcec_set_rx_filter(libcec_device_handle* handle, const uint8_t* opcode_bitmap, uint16_t initiator_mask)
+{
+	if (handle == NULL) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	return ceci_rx_set_filter(handle, opcode_bitmap, initiator_mask);
+}
+
+/*
+ * Send a request to a single device and wait up to timeout ms, from the end
+ * of the transmission, for the answer with expected_opcode from that device,
+ * e.g. Give OSD Name (0x46) and Set OSD Name (0x47). Returns the length of
+ * the answer, which is copied to reply, LIBCEC_ERROR_NOT_SUPPORTED if the
+ * device answered with a Feature Abort for the request (then in reply), or
+ * a negative error code. Answers go to the pending transactions instead of
+ * the readers, so several threads can query different devices at once. They
+ * must still pass the receive filter. This starts the reader, so it fails
+ * with LIBCEC_ERROR_BUSY once the device's descriptor has been handed out.
+ */
+DEFAULT_VISIBILITY
+int libcec_transact(libcec_device_handle* handle, uint8_t* request, size_t length, uint8_t expected_opcode,
+	int32_t timeout, libcec_frame* reply)
+{
+	if ( (handle == NULL) || (request == NULL) || (reply == NULL) || (length < 2)
+	  || (length > LIBCEC_MAX_FRAME_SIZE) || ((request[0] & 0x0F) == 0x0F) ) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	return ceci_rx_transact(handle, request, length, expected_opcode, timeout, reply);
+}
+
+/*
+ * Get the call and error counts and the latency histograms of the backend
+ * operations, and the frames and bytes received and sent, since the handle
+ * was opened. Recording them only takes a few atomic increments per call.
+ */
+DEFAULT_VISIBILITY
+int libcec_get_stats(libcec_device_handle* handle, libcec_stats* stats)
+{
+	if ((handle == NULL) || (stats == NULL)) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	ceci_stats_get(handle, stats);
+	return LIBCEC_SUCCESS;
+}
+
+/*
+ * Read all the pending messages, up to max, in one call. Waits up to
+ * timeout ms for the first message and returns the number of messages
+ * read, or LIBCEC_ERROR_TIMEOUT.
+ */
+DEFAULT_VISIBILITY
+int libcec_read_messages(libcec_device_handle* handle, libcec_frame* frames, int max, int32_t timeout)
+{
+	if ((handle == NULL) || (frames == NULL) || (max <= 0)) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	return ceci_rx_read_batch(handle, frames, max, timeout);
 }
 
-void ceci_log_v(enum libcec_log_level level, const char *function,
+void ceci_log_v(libcec_context* ctx, enum libcec_log_level level, const char *function,
 				const char *format, va_list args)
 {
 	const char *prefix;
 	struct timeval tv;
 	struct tm *loc;
+	FILE* logger;
 
+	ctx = ceci_get_context(ctx);
 #ifndef ENABLE_DEBUG_LOGGING
-	if (level < ceci_global_log_level)
+	if (level < ctx->log_level)
 		return;
 #endif
+	logger = (ctx->logger != NULL) ? ctx->logger : stderr;
 
 	switch (level) {
 	case LIBCEC_LOG_LEVEL_DEBUG:
@@ -309,20 +1133,20 @@ void ceci_log_v(enum libcec_log_level level, const char *function,
 
 	gettimeofday(&tv, (struct timezone *)0);
 	loc = localtime(&tv.tv_sec);
-	fprintf(ceci_logger, "%04d.%02d.%02d %02d:%02d:%02d.%03ld libcec:%s [%s] ",
+	fprintf(logger, "%04d.%02d.%02d %02d:%02d:%02d.%03ld libcec:%s [%s] ",
 		loc->tm_year+1900, loc->tm_mon+1, loc->tm_mday, loc->tm_hour,
 		loc->tm_min, loc->tm_sec, tv.tv_usec/1000, prefix, function);
-	vfprintf(ceci_logger, format, args);
-	fprintf(ceci_logger, "\n");
-	fflush(ceci_logger);
+	vfprintf(logger, format, args);
+	fprintf(logger, "\n");
+	fflush(logger);
 }
 
-void ceci_log(enum libcec_log_level level, const char *function, const char *format, ...)
+void ceci_log(libcec_context* ctx, enum libcec_log_level level, const char *function, const char *format, ...)
 {
 	va_list args;
 
 	va_start (args, format);
-	ceci_log_v(level, function, format, args);
+	ceci_log_v(ctx, level, function, format, args);
 	va_end (args);
 }
 
@@ -85,24 +85,211 @@ enum libcec_error {
 	   update the LIBCEC_strerror() function implementation! */
 };
 
+/*
+ * Maximum size of a CEC frame, including the header block and the opcode
+ * (same as CEC_MAX_COMMAND_SIZE from decoder.h)
+ */
+#define LIBCEC_MAX_FRAME_SIZE	16
+
+/* Buffer size that holds the text of any frame from libcec_format_message() */
+#define LIBCEC_MAX_FORMAT_SIZE	96
+
+/* libcec_frame flags */
+#define LIBCEC_FRAME_DIRECTED			0x01	/* sent to a single logical address */
+#define LIBCEC_FRAME_BROADCAST			0x02	/* sent to all (destination 15) */
+#define LIBCEC_FRAME_DRIVER_TIMESTAMP	0x04	/* timestamp comes from the driver, rather than libcec */
+
+/* A received CEC frame */
+typedef struct {
+	uint8_t data[LIBCEC_MAX_FRAME_SIZE];
+	uint8_t length;
+	uint8_t flags;
+	/* CLOCK_MONOTONIC reception time, in ns */
+	uint64_t timestamp;
+} libcec_frame;
+
+/* Size of a receive filter opcode bitmap, which has one bit per opcode */
+#define LIBCEC_RX_FILTER_SIZE			32
+#define LIBCEC_RX_FILTER_SET(bitmap, opcode)	((bitmap)[(uint8_t)(opcode) >> 3] |= 1 << ((opcode) & 7))
+
+/* Outcome of a transmission */
+enum libcec_tx_result {
+	/** The frame was acknowledged (or broadcast) */
+	LIBCEC_TX_OK = 0,
+	/** The frame was not acknowledged by its destination */
+	LIBCEC_TX_NACK = 1,
+	/** Another initiator won arbitration, and kept doing so on every retry */
+	LIBCEC_TX_ARB_LOST = 2,
+	/** The bus or the driver did not complete the transmission in time */
+	LIBCEC_TX_TIMEOUT = 3,
+	/** Driver or other error */
+	LIBCEC_TX_ERROR = 4,
+};
+
+/* Completion status of a transmitted frame, times are in us */
+typedef struct {
+	enum libcec_tx_result result;
+	unsigned int retries;		/* retransmissions, as reported by the driver */
+	uint32_t queued_time;		/* time spent in the transmit queue */
+	uint32_t wire_time;			/* time spent transmitting, retries included */
+} libcec_tx_status;
+
+/* libcec_edid_info flags */
+#define LIBCEC_EDID_HDMI				0x0001	/* an HDMI VSDB was found */
+#define LIBCEC_EDID_SUPPORTS_AI			0x0002	/* sink accepts ACP, ISRC1 or ISRC2 packets */
+#define LIBCEC_EDID_DVI_DUAL			0x0004	/* sink supports DVI dual-link operation */
+#define LIBCEC_EDID_LATENCY				0x0008	/* progressive latency fields are present */
+#define LIBCEC_EDID_I_LATENCY			0x0010	/* interlaced latency fields are present */
+#define LIBCEC_EDID_BASIC_AUDIO			0x0020	/* sink supports basic audio */
+#define LIBCEC_EDID_HDMI_FORUM			0x0040	/* an HDMI Forum VSDB (HDMI 2.0) was found */
+
+/*
+ * The parts of an EDID that matter to a CEC device. Latencies are the raw
+ * HDMI VSDB values: 0 = unknown, 255 = not supported, else (value-1)*2 ms.
+ */
+typedef struct {
+	char manufacturer[4];		/* 3 letters PNP ID */
+	uint16_t product_code;
+	uint32_t serial_number;
+	uint8_t version;
+	uint8_t revision;
+	uint8_t nb_extensions;
+	uint8_t vsdb_block;			/* extension block that holds the HDMI VSDB */
+	uint16_t flags;
+	uint16_t physical_address;	/* 0xFFFF if undetermined */
+	uint16_t max_tmds_clock;	/* in MHz, 0 if not specified */
+	uint8_t video_latency;
+	uint8_t audio_latency;
+	uint8_t interlaced_video_latency;
+	uint8_t interlaced_audio_latency;
+	char monitor_name[14];
+} libcec_edid_info;
+
+/* Backend operations that libcec_get_stats() reports on */
+enum libcec_stats_op {
+	LIBCEC_STATS_READ_MESSAGE = 0,
+	LIBCEC_STATS_WRITE_MESSAGE,
+	LIBCEC_STATS_READ_EDID,			/* full and ranged EDID reads */
+	LIBCEC_STATS_SET_LOGICAL_ADDRESS,	/* including driver side allocation */
+	LIBCEC_STATS_OP_COUNT
+};
+
+/*
+ * Latency histogram buckets: bucket 0 counts the calls that took less than
+ * 2 us, bucket i the ones that took [2^i, 2^(i+1)) us, and the last bucket
+ * everything from LIBCEC_STATS_BUCKET_LOW(LIBCEC_STATS_BUCKETS-1) us up.
+ */
+#define LIBCEC_STATS_BUCKETS			24
+#define LIBCEC_STATS_BUCKET_LOW(i)		(((i) == 0) ? 0 : (1ULL << (i)))
+
+/* Counters for one backend operation, times are in us */
+typedef struct {
+	uint64_t calls;
+	uint64_t errors;
+	/* read_message only: calls that timed out or were interrupted, not counted as errors */
+	uint64_t timeouts;
+	uint64_t total_time;
+	uint64_t max_time;
+	uint64_t histogram[LIBCEC_STATS_BUCKETS];
+} libcec_op_stats;
+
+/*
+ * Statistics of a device handle, since it was opened. Read times include
+ * the wait for a frame to arrive. Frames and bytes in are counted as the
+ * driver delivers them, before the receive filter, and frames and bytes out
+ * when they were transmitted successfully.
+ */
+typedef struct {
+	libcec_op_stats ops[LIBCEC_STATS_OP_COUNT];
+	uint64_t frames_in;
+	uint64_t bytes_in;
+	uint64_t frames_out;
+	uint64_t bytes_out;
+} libcec_stats;
+
+/*
+ * Opaque library context, owning the logging settings and the allocator of the
+ * devices opened with it. Independent CEC stacks in one process can each use
+ * their own. NULL designates the default context.
+ */
+struct libcec_context;
+typedef struct libcec_context libcec_context;
+
+/*
+ * Optional memory allocator for a context, its device handles and their
+ * internal buffers, e.g. to place them in a preallocated arena
+ */
+typedef struct {
+	void* (*alloc)(size_t size, void* user_data);
+	void (*free)(void* ptr, void* user_data);
+	void* user_data;
+} libcec_allocator;
+
 /* Opaque type returned by open and used for CEC I/O */
 struct libcec_device_handle;
 typedef struct libcec_device_handle libcec_device_handle;
 
+/* Called from the transmit thread, once an asynchronously submitted frame has been processed */
+typedef void (*libcec_tx_callback)(libcec_device_handle* handle, const uint8_t* buffer, size_t length,
+	const libcec_tx_status* status, void* user_data);
+
+/*
+ * Thread safety: the receive calls (libcec_read_message*, libcec_try_read_message)
+ * and the transmit calls (libcec_write_message*, libcec_submit_message,
+ * libcec_try_write_message) can be used on the same handle, from different
+ * threads, at the same time. Each path has its own lock, so a blocked reader
+ * never holds back a transmission. The other calls (EDID, logical address and
+ * configuration) must not run concurrently with one another.
+ * libcec_close() wakes up blocked readers, which return LIBCEC_ERROR_INTERRUPTED,
+ * and waits for them to leave. No call may be started on a handle after that.
+ */
+/*
+ * Receive readiness: libcec_get_pollfd() returns the device's own descriptor
+ * when it can be polled and the reader thread doesn't run, and the reader's
+ * eventfd otherwise. Once the device's descriptor has been handed out, the
+ * calls that need the reader (libcec_set_rx_buffering, libcec_transact) fail
+ * with LIBCEC_ERROR_BUSY, as that descriptor would then stop reporting frames.
+ * Call them before libcec_get_pollfd() to poll the reader instead.
+ */
 void libcec_set_logging(int level, FILE* stream);
+void libcec_set_logging_ex(libcec_context* ctx, int level, FILE* stream);
 const char* libcec_strerror(enum libcec_error error_code);
 int libcec_init(void);
+int libcec_init_ex(libcec_context** ctx, const libcec_allocator* allocator);
 int libcec_exit(void);
+int libcec_exit_ex(libcec_context* ctx);
 int libcec_open(char* device_name, libcec_device_handle** handle);
+int libcec_open_ex(libcec_context* ctx, char* device_name, libcec_device_handle** handle);
 int libcec_close(libcec_device_handle* handle);
 int libcec_read_edid(libcec_device_handle* handle, uint8_t* buffer, size_t length);
 int libcec_get_physical_address(libcec_device_handle* handle, uint16_t* phys_addr);
+int libcec_parse_edid(libcec_device_handle* handle, libcec_edid_info* info);
+int libcec_notify_hotplug(libcec_device_handle* handle);
+int libcec_set_edid_cache_path(libcec_device_handle* handle, const char* path);
 int libcec_set_logical_address(libcec_device_handle* handle, uint8_t logical_address);
 int libcec_allocate_logical_address(libcec_device_handle* handle, uint8_t device_type, uint16_t* physical_address);
+int libcec_allocate_logical_address_ex(libcec_device_handle* handle, uint8_t device_type, uint16_t* physical_address,
+	uint8_t last_logical_address, uint16_t last_physical_address);
 int libcec_write_message(libcec_device_handle* handle, uint8_t* buffer, size_t length);
+int libcec_write_message_ex(libcec_device_handle* handle, uint8_t* buffer, size_t length, libcec_tx_status* status);
 /* timeout is in ms */
 int libcec_read_message(libcec_device_handle* handle, uint8_t* buffer, size_t length, int32_t timeout);
+int libcec_read_message_ex(libcec_device_handle* handle, libcec_frame* frame, int32_t timeout);
+int libcec_get_pollfd(libcec_device_handle* handle);
+int libcec_try_read_message(libcec_device_handle* handle, uint8_t* buffer, size_t length);
+int libcec_try_write_message(libcec_device_handle* handle, uint8_t* buffer, size_t length);
+int libcec_submit_message(libcec_device_handle* handle, uint8_t* buffer, size_t length);
+int libcec_set_tx_callback(libcec_device_handle* handle, libcec_tx_callback callback, void* user_data);
+int libcec_set_rx_buffering(libcec_device_handle* handle, unsigned int slots);
+int libcec_read_messages(libcec_device_handle* handle, libcec_frame* frames, int max, int32_t timeout);
+int libcec_set_rx_filter(libcec_device_handle* handle, const uint8_t* opcode_bitmap, uint16_t initiator_mask);
+int libcec_transact(libcec_device_handle* handle, uint8_t* request, size_t length, uint8_t expected_opcode,
+	int32_t timeout, libcec_frame* reply);
+int libcec_get_stats(libcec_device_handle* handle, libcec_stats* stats);
 int libcec_decode_message(uint8_t* message, size_t length);
+int libcec_validate_message(const uint8_t* message, size_t length);
+int libcec_validate_batch(const libcec_frame* frames, size_t count, int* results);
+int libcec_format_message(const uint8_t* message, size_t length, char* out, size_t outlen);
 
 #ifdef __cplusplus
 }
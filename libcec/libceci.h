@@ -25,6 +25,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <libcec.h>
 #include "libcec_version.h"
@@ -32,31 +33,29 @@
 #define MIN(a, b)	((a) < (b) ? (a) : (b))
 #define MAX(a, b)	((a) > (b) ? (a) : (b))
 
-void ceci_log(enum libcec_log_level level, const char *function, const char *format, ...);
+void ceci_log(libcec_context* ctx, enum libcec_log_level level, const char *function, const char *format, ...);
 
 #if defined (ENABLE_LOGGING)
-#define _ceci_log(level, ...) ceci_log(level, __FUNCTION__, __VA_ARGS__)
+#define _ceci_log(ctx, level, ...) ceci_log(ctx, level, __FUNCTION__, __VA_ARGS__)
 #else
-#define _ceci_log(level, ...)
+#define _ceci_log(ctx, level, ...)
 #endif
 
 #if defined(ENABLE_DEBUG_LOGGING)
-#define ceci_dbg(...) _ceci_log(LIBCEC_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define ceci_dbg(ctx, ...) _ceci_log(ctx, LIBCEC_LOG_LEVEL_DEBUG, __VA_ARGS__)
 #else
-#define ceci_dbg(...)
+#define ceci_dbg(ctx, ...)
 #endif
 
-#define ceci_info(...)  _ceci_log(LIBCEC_LOG_LEVEL_INFO, __VA_ARGS__)
-#define ceci_warn(...)  _ceci_log(LIBCEC_LOG_LEVEL_WARNING, __VA_ARGS__)
-#define ceci_error(...) _ceci_log(LIBCEC_LOG_LEVEL_ERROR, __VA_ARGS__)
-
-struct libcec_device_handle {
-	unsigned char priv[0];
-};
+#define ceci_info(ctx, ...)  _ceci_log(ctx, LIBCEC_LOG_LEVEL_INFO, __VA_ARGS__)
+#define ceci_warn(ctx, ...)  _ceci_log(ctx, LIBCEC_LOG_LEVEL_WARNING, __VA_ARGS__)
+#define ceci_error(ctx, ...) _ceci_log(ctx, LIBCEC_LOG_LEVEL_ERROR, __VA_ARGS__)
 
 /* CEC implementation abstraction */
 typedef struct {
 	const char *name;
+	/* prefix selecting this backend in a device name, as in "<scheme>:<device>" */
+	const char *scheme;
 	int (*init)(void);
 	int (*exit)(void);
 	int (*open)(char* device_name, libcec_device_handle* handle);
@@ -64,18 +63,215 @@ typedef struct {
 	int (*set_logical_address)(libcec_device_handle* handle, uint8_t logical_address);
 	/* we need a call to read EDID from closest sink, to obtain our physical address */
 	int (*read_edid)(libcec_device_handle* handle, uint8_t* buffer, size_t length);
-	/* returns the number of bytes read, or a negative value on error */
-	int (*read_message)(libcec_device_handle* handle, uint8_t* buffer, size_t length, int32_t timeout);
-	/* returns 0 on success or a negative error code. Must also return success for ACK of Polling Messages */
-	int (*write_message)(libcec_device_handle* handle, uint8_t* buffer, size_t length);
+	/* reads length bytes of EDID segment 'segment' (E-DDC segment pointer), from offset.
+	   This is used to read extension blocks one at a time, and to check cheaply whether
+	   the EDID changed. Leave NULL if unsupported */
+	int (*read_edid_range)(libcec_device_handle* handle, uint8_t segment, uint8_t offset, uint8_t* buffer, size_t length);
+	/* returns the number of bytes read, or a negative value on error. If the driver
+	   timestamps frames, set timestamp to the CLOCK_MONOTONIC reception time in ns,
+	   otherwise leave it to 0 and the core timestamps the frame when the call returns */
+	int (*read_message)(libcec_device_handle* handle, uint8_t* buffer, size_t length, int32_t timeout, uint64_t* timestamp);
+	/* returns 0 on success or a negative error code. Must also return success for ACK of Polling Messages.
+	   status comes zeroed: set its result on failure and its retries, if the driver can tell. If the
+	   result is left to LIBCEC_TX_OK on failure, the core derives it from the error code */
+	int (*write_message)(libcec_device_handle* handle, uint8_t* buffer, size_t length, libcec_tx_status* status);
+	/* returns a file descriptor that polls readable when read_message with a zero timeout
+	   would not time out. Leave NULL if the driver cannot poll: readiness is then emulated
+	   by the core, with a reader thread and an eventfd */
+	int (*get_pollfd)(libcec_device_handle* handle);
+	/* makes read_message calls that are blocked, and any further ones, return
+	   LIBCEC_ERROR_INTERRUPTED, so that the handle can be closed. Leave NULL if
+	   the driver cannot do that: blocking reads are then split into slices */
+	int (*cancel)(libcec_device_handle* handle);
+	/* only lets through the frames from an initiator set in initiators and whose
+	   opcode, if any, is set in the opcodes bitmap (NULL for all), so that others
+	   don't cause a wakeup. Receiving is filtered by the core regardless, so this
+	   can be approximate. Leave NULL if the driver cannot filter */
+	int (*set_rx_filter)(libcec_device_handle* handle, const uint8_t* opcodes, uint16_t initiators);
+	/* for drivers that get the physical address from elsewhere than the EDID we can
+	   read, e.g. from the HDMI driver. Leave NULL to have the core parse the EDID */
+	int (*get_physical_address)(libcec_device_handle* handle, uint16_t* physical_address);
+	/* for drivers that allocate logical addresses by themselves: claims one for
+	   device_type, and returns it, 15 if none was free, or a negative error code.
+	   Leave NULL to have the core poll the candidates */
+	int (*claim_logical_address)(libcec_device_handle* handle, uint8_t device_type);
 
 	/* number of bytes to reserve for the device handle private backend data */
 	size_t device_handle_priv_size;
 } _ceci_backend ;
 
-extern FILE* ceci_logger;
-extern int ceci_global_log_level;
-extern const _ceci_backend* const ceci_backend;
+/*
+ * Receive buffering: a reader thread drains the backend into a ring of
+ * fixed size frame slots. This also emulates receive readiness, through
+ * an eventfd, for backends that cannot poll.
+ * The receive and transmit paths each have their own lock, and never hold
+ * the other's, so that a blocked reader doesn't hold back transmission.
+ */
+#define CECI_RX_SLOTS			16	/* default ring size */
+#define CECI_RX_BATCH			8	/* max frames drained from the backend at once */
+#define CECI_RX_POLL_TIMEOUT	500
+/* What a frame slot doesn't hold, kept aside so that slots stay LIBCEC_MAX_FRAME_SIZE bytes */
+typedef struct {
+	uint64_t		timestamp;
+	uint8_t			length;
+	uint8_t			flags;
+} ceci_rx_slot_info;
+
+/*
+ * A pending transaction, waiting for an answer from 'initiator' (the
+ * destination of its request). It lives on the stack of the caller.
+ */
+typedef struct ceci_rx_waiter {
+	struct ceci_rx_waiter*	next;
+	uint8_t			initiator;
+	uint8_t			destination;	/* the initiator of the request, unless the answer is broadcast */
+	uint8_t			opcode;			/* opcode of the expected answer */
+	uint8_t			request_opcode;	/* to match a Feature Abort */
+	int				done;
+	int				result;
+	libcec_frame*	reply;
+} ceci_rx_waiter;
+
+typedef struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	pthread_t		thread;
+	int				running;
+	int				stop;
+	int				event_fd;
+	uint8_t			(*slots)[LIBCEC_MAX_FRAME_SIZE];
+	ceci_rx_slot_info*	slot_info;
+	unsigned int	size;
+	unsigned int	head;
+	unsigned int	count;
+	unsigned int	dropped;
+	unsigned int	readers;	/* callers currently on the receive path */
+	int				pollfd_lent;	/* the backend's descriptor was handed out, so no reader can start */
+	int				closing;
+	/* receive filter */
+	int				filtered;
+	uint8_t			filter_opcodes[LIBCEC_RX_FILTER_SIZE];
+	uint16_t		filter_initiators;
+	unsigned int	filter_dropped;
+	/* pending transactions, keyed by initiator and opcode of the answer */
+	ceci_rx_waiter*	transactions;
+} ceci_rx_state;
+
+/*
+ * Transmit queue, drained by a worker thread. Synchronous writers wait
+ * on the frame they queued, through a waiter that lives on their stack.
+ */
+#define CECI_TX_SLOTS			16
+typedef struct ceci_tx_waiter {
+	struct ceci_tx_waiter*	next;
+	int				done;
+	int				result;
+	libcec_tx_status	status;
+} ceci_tx_waiter;
+
+typedef struct {
+	uint8_t			frame[LIBCEC_MAX_FRAME_SIZE];
+	uint8_t			length;
+	int				async;		/* at least one submission doesn't wait on the result */
+	struct timespec	queued;
+	ceci_tx_waiter*	waiters;
+} ceci_tx_entry;
+
+typedef struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	pthread_t		thread;
+	int				running;
+	int				stop;
+	ceci_tx_entry	entries[CECI_TX_SLOTS];
+	unsigned int	head;
+	unsigned int	count;
+	unsigned int	sending;	/* 1 if the head frame is being transmitted */
+	unsigned int	writers;	/* synchronous writers still waiting on the queue */
+	unsigned int	coalesced;	/* number of frames merged with a pending duplicate */
+	libcec_tx_callback	callback;
+	void*			callback_data;
+} ceci_tx_state;
+
+/*
+ * EDID cache: the physical address from the last full EDID read, keyed by
+ * the extension count and the checksums of block 0 and of the block that
+ * holds the HDMI VSDB, which can be probed with a few bytes of DDC traffic.
+ */
+#define CECI_EDID_KEY_SIZE		3
+#define CECI_EDID_BLOCK_SIZE	128
+typedef struct {
+	int				valid;
+	int				parsed;		/* info holds the full parse, not just the address from the cache file */
+	uint8_t			key[CECI_EDID_KEY_SIZE];
+	libcec_edid_info	info;
+	char*			path;		/* file the cache persists to, if any */
+} ceci_edid_cache;
+
+/*
+ * Statistics. They are only ever updated with relaxed atomic operations, so
+ * that recording them takes no lock, on the I/O paths or anywhere else.
+ */
+#define ceci_atomic_add(ptr, val)	__atomic_fetch_add((ptr), (val), __ATOMIC_RELAXED)
+#define ceci_atomic_load(ptr)		__atomic_load_n((ptr), __ATOMIC_RELAXED)
+
+/*
+ * Library context. It owns the logging settings and the allocator, and keeps
+ * track of the backends it uses. A NULL context designates the default one,
+ * which is what the non _ex calls use.
+ */
+struct libcec_context {
+	FILE*			logger;
+	int				log_level;
+	libcec_allocator	allocator;
+	uint32_t		backends;	/* bitmask of the backends this context initialized */
+	unsigned int	nb_handles;	/* devices allocated with this context, and not freed yet */
+	pthread_mutex_t	lock;
+};
+
+#define HANDLE_CTX(handle)	((handle)->ctx)
+
+libcec_context* ceci_get_context(libcec_context* ctx);
+void* ceci_malloc(libcec_context* ctx, size_t size);
+void* ceci_calloc(libcec_context* ctx, size_t nmemb, size_t size);
+void ceci_free(libcec_context* ctx, void* ptr);
+
+struct libcec_device_handle {
+	libcec_context* ctx;
+	const _ceci_backend* backend;
+	ceci_edid_cache edid;
+	ceci_rx_state rx;
+	ceci_tx_state tx;
+	libcec_stats stats;
+	unsigned char priv[0];
+};
+
+void ceci_io_init(libcec_device_handle* handle);
+void ceci_io_stop(libcec_device_handle* handle);
+void ceci_io_exit(libcec_device_handle* handle);
+int ceci_edid_parse_base(libcec_context* ctx, const uint8_t* block, libcec_edid_info* info);
+int ceci_edid_parse_extension(libcec_context* ctx, const uint8_t* block, libcec_edid_info* info);
+int ceci_rx_start(libcec_device_handle* handle, unsigned int slots);
+int ceci_rx_read(libcec_device_handle* handle, uint8_t* buffer, size_t length, int32_t timeout);
+int ceci_rx_read_batch(libcec_device_handle* handle, libcec_frame* frames, int max, int32_t timeout);
+int ceci_rx_filter_match(const uint8_t* opcodes, uint16_t initiators, const uint8_t* frame, size_t length);
+int ceci_rx_set_filter(libcec_device_handle* handle, const uint8_t* opcodes, uint16_t initiators);
+int ceci_rx_transact(libcec_device_handle* handle, uint8_t* request, size_t length,
+	uint8_t expected_opcode, int32_t timeout, libcec_frame* reply);
+int ceci_tx_start(libcec_device_handle* handle);
+int ceci_tx_submit(libcec_device_handle* handle, uint8_t* buffer, size_t length, int32_t timeout);
+int ceci_tx_write(libcec_device_handle* handle, uint8_t* buffer, size_t length, libcec_tx_status* status);
+int ceci_tx_write_multiple(libcec_device_handle* handle, libcec_frame* frames, int nb_frames,
+	int* results, libcec_tx_status* status);
+void ceci_tx_set_callback(libcec_device_handle* handle, libcec_tx_callback callback, void* user_data);
+uint64_t ceci_stats_start(void);
+void ceci_stats_record(libcec_device_handle* handle, enum libcec_stats_op op, uint64_t start, int r);
+void ceci_stats_frame(libcec_device_handle* handle, int out, size_t length);
+void ceci_stats_get(libcec_device_handle* handle, libcec_stats* stats);
+
 extern const _ceci_backend linux_realtek_soc_backend;
+extern const _ceci_backend linux_cec_backend;
+extern const _ceci_backend serial_cec_backend;
+extern const _ceci_backend loopback_backend;
 
 #endif
@@ -0,0 +1,510 @@
+/*
+ * libcec - Linux CEC framework (linux/cec.h) functions
+ *
+ * Copyright (c) 2010-2011 Pete Batard <pete@akeo.ie>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <linux/cec.h>
+
+#include "libceci.h"
+#include "linux_cec.h"
+
+/* Device type of each logical address */
+static const uint8_t linux_cec_device_type[15] = {0, 1, 1, 3, 4, 5, 3, 3, 4, 1, 3, 4, 2, 2, 0};
+
+int linux_cec_init(void)
+{
+	return LIBCEC_SUCCESS;
+}
+
+int linux_cec_exit(void)
+{
+	return LIBCEC_SUCCESS;
+}
+
+/*
+ * Device names are "<path>[,option...]", where the path defaults to /dev/cec0
+ * and the options are "monitor" (or "monitor=all", to also see the messages
+ * between other devices, which requires CAP_NET_ADMIN) and "pa=<address>",
+ * for adapters that expect userspace to provide the physical address.
+ * Logical addresses are claimed by the framework, from the device type: a
+ * specific address can only be set if it is the first free one of its type.
+ */
+static int linux_cec_parse_options(libcec_device_handle* handle, char* options, char** path)
+{
+	linux_cec_device_handle_priv* priv = __device_handle_priv(handle);
+	char *token, *val, *end_str, *saveptr = NULL;
+	unsigned long v;
+
+	*path = LINUX_CEC_DEFAULT_DEV;
+	for (token = strtok_r(options, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr)) {
+		if (token[0] == '/') {
+			*path = token;
+			continue;
+		}
+		val = strchr(token, '=');
+		if (val != NULL) {
+			*val++ = 0;
+		}
+		if (strcmp(token, "monitor") == 0) {
+			if (val == NULL) {
+				priv->monitor = CEC_MODE_MONITOR;
+			} else if (strcmp(val, "all") == 0) {
+				priv->monitor = CEC_MODE_MONITOR_ALL;
+			} else {
+				goto invalid;
+			}
+		} else if ((strcmp(token, "pa") == 0) && (val != NULL)) {
+			v = strtoul(val, &end_str, 0);
+			if ((*val == 0) || (*end_str != 0) || (v > 0xFFFF)) {
+				goto invalid;
+			}
+			priv->physical_address = (uint16_t)v;
+		} else {
+			ceci_warn(HANDLE_CTX(handle), "unknown CEC device option '%s'", token);
+			return LIBCEC_ERROR_INVALID_PARAM;
+		}
+	}
+	return LIBCEC_SUCCESS;
+invalid:
+	ceci_warn(HANDLE_CTX(handle), "invalid value '%s' for CEC device option '%s'", val, token);
+	return LIBCEC_ERROR_INVALID_PARAM;
+}
+
+static int linux_cec_errno_to_error(int err)
+{
+	switch (err) {
+	case EPERM:
+	case EACCES:
+		return LIBCEC_ERROR_ACCESS;
+	case ENODEV:
+	case ENXIO:
+	case ENONET:
+		return LIBCEC_ERROR_NO_DEVICE;
+	case EBUSY:
+		return LIBCEC_ERROR_BUSY;
+	case EINVAL:
+		return LIBCEC_ERROR_INVALID_PARAM;
+	case ENOTTY:
+		return LIBCEC_ERROR_NOT_SUPPORTED;
+	case EINTR:
+		return LIBCEC_ERROR_INTERRUPTED;
+	default:
+		return LIBCEC_ERROR_IO;
+	}
+}
+
+int linux_cec_open(char* device_name, libcec_device_handle* handle)
+{
+	linux_cec_device_handle_priv* priv = __device_handle_priv(handle);
+	struct cec_caps caps;
+	char options[256], *path;
+	uint32_t mode;
+	int r;
+
+	priv->rx_dev = -1;
+	priv->tx_dev = -1;
+	priv->cancel_fd = -1;
+	priv->physical_address = CEC_PHYS_ADDR_INVALID;
+	strncpy(options, device_name, sizeof(options)-1);
+	options[sizeof(options)-1] = 0;
+	r = linux_cec_parse_options(handle, options, &path);
+	if (r != LIBCEC_SUCCESS) {
+		return r;
+	}
+
+	priv->rx_dev = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (priv->rx_dev < 0) {
+		ceci_error(HANDLE_CTX(handle), "cannot open CEC device '%s' - errno: %d", path, errno);
+		return (errno == ENOENT) ? LIBCEC_ERROR_NOT_FOUND : linux_cec_errno_to_error(errno);
+	}
+	if (ioctl(priv->rx_dev, CEC_ADAP_G_CAPS, &caps) != 0) {
+		ceci_error(HANDLE_CTX(handle), "'%s' is not a CEC device - errno: %d", path, errno);
+		r = LIBCEC_ERROR_NOT_SUPPORTED;
+		goto err;
+	}
+	priv->capabilities = caps.capabilities;
+	ceci_dbg(HANDLE_CTX(handle), "%s (%s), capabilities %04X", caps.name, caps.driver, caps.capabilities);
+
+	priv->cancel_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (priv->cancel_fd < 0) {
+		ceci_error(HANDLE_CTX(handle), "could not create eventfd - errno: %d", errno);
+		r = LIBCEC_ERROR_RESOURCE;
+		goto err;
+	}
+
+	/* we answer everything ourselves, including the messages the framework could handle */
+	mode = (priv->monitor != 0) ? (CEC_MODE_NO_INITIATOR | priv->monitor)
+		: (CEC_MODE_INITIATOR | CEC_MODE_EXCL_FOLLOWER_PASSTHRU);
+	if (ioctl(priv->rx_dev, CEC_S_MODE, &mode) != 0) {
+		ceci_error(HANDLE_CTX(handle), "cannot set receive mode %02X - errno: %d", mode, errno);
+		r = linux_cec_errno_to_error(errno);
+		goto err;
+	}
+	if (priv->monitor != 0) {
+		return LIBCEC_SUCCESS;
+	}
+
+	priv->tx_dev = open(path, O_RDWR | O_CLOEXEC);
+	if (priv->tx_dev < 0) {
+		ceci_error(HANDLE_CTX(handle), "cannot open CEC device '%s' - errno: %d", path, errno);
+		r = linux_cec_errno_to_error(errno);
+		goto err;
+	}
+	mode = CEC_MODE_INITIATOR | CEC_MODE_NO_FOLLOWER;
+	if (ioctl(priv->tx_dev, CEC_S_MODE, &mode) != 0) {
+		ceci_error(HANDLE_CTX(handle), "cannot set transmit mode %02X - errno: %d", mode, errno);
+		r = linux_cec_errno_to_error(errno);
+		goto err;
+	}
+
+	if ( (priv->capabilities & CEC_CAP_PHYS_ADDR)
+	  && (priv->physical_address != CEC_PHYS_ADDR_INVALID) ) {
+		if (ioctl(priv->tx_dev, CEC_ADAP_S_PHYS_ADDR, &priv->physical_address) != 0) {
+			ceci_error(HANDLE_CTX(handle), "cannot set physical address %04X - errno: %d", priv->physical_address, errno);
+			r = linux_cec_errno_to_error(errno);
+			goto err;
+		}
+	}
+	return LIBCEC_SUCCESS;
+
+err:
+	if (priv->tx_dev >= 0) {
+		close(priv->tx_dev);
+		priv->tx_dev = -1;
+	}
+	if (priv->cancel_fd >= 0) {
+		close(priv->cancel_fd);
+		priv->cancel_fd = -1;
+	}
+	close(priv->rx_dev);
+	priv->rx_dev = -1;
+	return r;
+}
+
+int linux_cec_close(libcec_device_handle* handle)
+{
+	linux_cec_device_handle_priv* priv = __device_handle_priv(handle);
+
+	if (priv->tx_dev >= 0) {
+		close(priv->tx_dev);
+	}
+	close(priv->cancel_fd);
+	close(priv->rx_dev);
+	return LIBCEC_SUCCESS;
+}
+
+/*
+ * Have the framework claim a logical address of device_type (a CEC device
+ * type), or release ours if device_type is 0xFF. The framework polls the
+ * candidates and retries by itself, and we block until it is done.
+ * Returns the logical address, 15 if none was free, or an error code.
+ */
+static int linux_cec_configure(libcec_device_handle* handle, uint8_t device_type)
+{
+	linux_cec_device_handle_priv* priv = __device_handle_priv(handle);
+	struct cec_log_addrs log_addrs;
+
+	if (priv->tx_dev < 0) {
+		return LIBCEC_ERROR_NOT_SUPPORTED;
+	}
+	if (!(priv->capabilities & CEC_CAP_LOG_ADDRS)) {
+		ceci_error(HANDLE_CTX(handle), "this adapter manages its logical addresses by itself");
+		return LIBCEC_ERROR_NOT_SUPPORTED;
+	}
+
+	/* the logical addresses must be cleared before they can be set again */
+	memset(&log_addrs, 0, sizeof(log_addrs));
+	if (ioctl(priv->tx_dev, CEC_ADAP_S_LOG_ADDRS, &log_addrs) != 0) {
+		ceci_error(HANDLE_CTX(handle), "failed to clear logical addresses - errno: %d", errno);
+		return linux_cec_errno_to_error(errno);
+	}
+	if (device_type == 0xFF) {
+		return 15;
+	}
+
+	log_addrs.cec_version = CEC_OP_CEC_VERSION_1_4;
+	log_addrs.vendor_id = CEC_VENDOR_ID_NONE;
+	log_addrs.num_log_addrs = 1;
+	log_addrs.flags = CEC_LOG_ADDRS_FL_ALLOW_UNREG_FALLBACK;
+	log_addrs.primary_device_type[0] = device_type;
+	switch (device_type) {
+	case CEC_OP_PRIM_DEVTYPE_TV:
+		log_addrs.log_addr_type[0] = CEC_LOG_ADDR_TYPE_TV;
+		log_addrs.all_device_types[0] = CEC_OP_ALL_DEVTYPE_TV;
+		break;
+	case CEC_OP_PRIM_DEVTYPE_RECORD:
+		log_addrs.log_addr_type[0] = CEC_LOG_ADDR_TYPE_RECORD;
+		log_addrs.all_device_types[0] = CEC_OP_ALL_DEVTYPE_RECORD;
+		break;
+	case CEC_OP_PRIM_DEVTYPE_TUNER:
+		log_addrs.log_addr_type[0] = CEC_LOG_ADDR_TYPE_TUNER;
+		log_addrs.all_device_types[0] = CEC_OP_ALL_DEVTYPE_TUNER;
+		break;
+	case CEC_OP_PRIM_DEVTYPE_PLAYBACK:
+		log_addrs.log_addr_type[0] = CEC_LOG_ADDR_TYPE_PLAYBACK;
+		log_addrs.all_device_types[0] = CEC_OP_ALL_DEVTYPE_PLAYBACK;
+		break;
+	case CEC_OP_PRIM_DEVTYPE_AUDIOSYSTEM:
+		log_addrs.log_addr_type[0] = CEC_LOG_ADDR_TYPE_AUDIOSYSTEM;
+		log_addrs.all_device_types[0] = CEC_OP_ALL_DEVTYPE_AUDIOSYSTEM;
+		break;
+	default:
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	if (ioctl(priv->tx_dev, CEC_ADAP_S_LOG_ADDRS, &log_addrs) != 0) {
+		ceci_error(HANDLE_CTX(handle), "failed to claim a logical address - errno: %d", errno);
+		return linux_cec_errno_to_error(errno);
+	}
+	if ( (log_addrs.log_addr_mask & CEC_LOG_ADDR_MASK_UNREGISTERED)
+	  || (log_addrs.log_addr[0] == CEC_LOG_ADDR_INVALID) ) {
+		return 15;
+	}
+	return log_addrs.log_addr[0];
+}
+
+/*
+ * The framework only lets us choose a device type, and claims the first free
+ * address of that type, which need not be the one requested. In that case,
+ * the address it got is released rather than kept behind the caller's back.
+ */
+int linux_cec_set_logical_address(libcec_device_handle* handle, uint8_t logical_address)
+{
+	int r;
+
+	if (logical_address == 15) {
+		r = linux_cec_configure(handle, 0xFF);
+		return (r < 0) ? r : LIBCEC_SUCCESS;
+	}
+	r = linux_cec_configure(handle, linux_cec_device_type[logical_address]);
+	if (r < 0) {
+		return r;
+	}
+	if (r != logical_address) {
+		ceci_warn(HANDLE_CTX(handle), "logical address %d is not available - got %d", logical_address, r);
+		r = linux_cec_configure(handle, 0xFF);
+		return (r < 0) ? r : LIBCEC_ERROR_BUSY;
+	}
+	return LIBCEC_SUCCESS;
+}
+
+int linux_cec_claim_logical_address(libcec_device_handle* handle, uint8_t device_type)
+{
+	return linux_cec_configure(handle, device_type);
+}
+
+int linux_cec_get_physical_address(libcec_device_handle* handle, uint16_t* physical_address)
+{
+	linux_cec_device_handle_priv* priv = __device_handle_priv(handle);
+
+	if (ioctl(priv->rx_dev, CEC_ADAP_G_PHYS_ADDR, physical_address) != 0) {
+		ceci_error(HANDLE_CTX(handle), "failed to get physical address - errno: %d", errno);
+		return linux_cec_errno_to_error(errno);
+	}
+	return LIBCEC_SUCCESS;
+}
+
+int linux_cec_read_edid(libcec_device_handle* handle, uint8_t* buffer, size_t length)
+{
+	/* the HDMI driver reads the EDID and hands the physical address over to the framework */
+	ceci_dbg(HANDLE_CTX(handle), "the EDID is not accessible through the CEC framework");
+	return LIBCEC_ERROR_NOT_SUPPORTED;
+}
+
+/* Log the events the framework queued, as it drops the oldest ones when full */
+static void linux_cec_dequeue_events(libcec_device_handle* handle)
+{
+	linux_cec_device_handle_priv* priv = __device_handle_priv(handle);
+	struct cec_event event;
+
+	memset(&event, 0, sizeof(event));
+	while (ioctl(priv->rx_dev, CEC_DQEVENT, &event) == 0) {
+		switch (event.event) {
+		case CEC_EVENT_STATE_CHANGE:
+			ceci_dbg(HANDLE_CTX(handle), "adapter state: physical address %04X, logical addresses %04X",
+				event.state_change.phys_addr, event.state_change.log_addr_mask);
+			break;
+		case CEC_EVENT_LOST_MSGS:
+			ceci_warn(HANDLE_CTX(handle), "driver dropped %d messages", event.lost_msgs.lost_msgs);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+int linux_cec_read_message(libcec_device_handle* handle, uint8_t* buffer, size_t length, int32_t timeout, uint64_t* timestamp)
+{
+	linux_cec_device_handle_priv* priv = __device_handle_priv(handle);
+	struct pollfd fds[2];
+	struct timespec deadline, now;
+	struct cec_msg msg;
+	int r, wait = timeout;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (timeout % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	fds[0].fd = priv->rx_dev;
+	fds[0].events = POLLIN | POLLPRI;
+	fds[1].fd = priv->cancel_fd;
+	fds[1].events = POLLIN;
+
+	while (1) {
+		memset(&msg, 0, sizeof(msg));
+		if (ioctl(priv->rx_dev, CEC_RECEIVE, &msg) == 0) {
+			if (msg.len > length) {
+				return LIBCEC_ERROR_OVERFLOW;
+			}
+			memcpy(buffer, msg.msg, msg.len);
+			*timestamp = msg.rx_ts;
+			return (int)msg.len;
+		}
+		if (errno != EAGAIN) {
+			ceci_error(HANDLE_CTX(handle), "failed to receive CEC message - errno: %d", errno);
+			return linux_cec_errno_to_error(errno);
+		}
+
+		if (timeout > 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			/* round up, as poll() returning a little before the deadline would end the wait early */
+			wait = (int)((deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec + 999999) / 1000000);
+			if (wait < 0) {
+				wait = 0;
+			}
+		}
+		r = poll(fds, 2, wait);
+		if (r < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return LIBCEC_ERROR_IO;
+		}
+		if (fds[1].revents & POLLIN) {
+			/* the eventfd is left signaled, so that any further read is interrupted too */
+			return LIBCEC_ERROR_INTERRUPTED;
+		}
+		if (fds[0].revents & POLLPRI) {
+			linux_cec_dequeue_events(handle);
+		}
+		if (fds[0].revents & (POLLERR | POLLHUP)) {
+			ceci_error(HANDLE_CTX(handle), "CEC adapter was disconnected");
+			return LIBCEC_ERROR_NO_DEVICE;
+		}
+		if ((r == 0) && (wait == 0)) {
+			return LIBCEC_ERROR_TIMEOUT;
+		}
+	}
+}
+
+int linux_cec_write_message(libcec_device_handle* handle, uint8_t* buffer, size_t length, libcec_tx_status* status)
+{
+	linux_cec_device_handle_priv* priv = __device_handle_priv(handle);
+	struct cec_msg msg;
+	unsigned int events;
+
+	if (priv->tx_dev < 0) {
+		return LIBCEC_ERROR_NOT_SUPPORTED;
+	}
+	if ((length == 0) || (length > CEC_MAX_MSG_SIZE)) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	memset(&msg, 0, sizeof(msg));
+	memcpy(msg.msg, buffer, length);
+	msg.len = (__u32)length;
+
+	/* blocks until the framework is done with it, retries included */
+	if (ioctl(priv->tx_dev, CEC_TRANSMIT, &msg) != 0) {
+		if (errno != EINVAL) {
+			ceci_error(HANDLE_CTX(handle), "failed to send CEC message - errno: %d", errno);
+		}
+		status->result = LIBCEC_TX_ERROR;
+		return linux_cec_errno_to_error(errno);
+	}
+
+	events = msg.tx_arb_lost_cnt + msg.tx_nack_cnt + msg.tx_low_drive_cnt + msg.tx_error_cnt;
+	if (msg.tx_status & CEC_TX_STATUS_OK) {
+		status->retries = events;
+		return LIBCEC_SUCCESS;
+	}
+	/* the last attempt is counted too */
+	status->retries = (events > 0) ? events - 1 : 0;
+	if (msg.tx_status & CEC_TX_STATUS_NACK) {
+		status->result = LIBCEC_TX_NACK;
+		return LIBCEC_ERROR_IO;
+	}
+	if (msg.tx_status & CEC_TX_STATUS_ARB_LOST) {
+		status->result = LIBCEC_TX_ARB_LOST;
+		return LIBCEC_ERROR_BUSY;
+	}
+	if (msg.tx_status & CEC_TX_STATUS_TIMEOUT) {
+		status->result = LIBCEC_TX_TIMEOUT;
+		return LIBCEC_ERROR_TIMEOUT;
+	}
+	status->result = LIBCEC_TX_ERROR;
+	return (msg.tx_status & CEC_TX_STATUS_ABORTED) ? LIBCEC_ERROR_INTERRUPTED : LIBCEC_ERROR_IO;
+}
+
+int linux_cec_get_pollfd(libcec_device_handle* handle)
+{
+	return __device_handle_priv(handle)->rx_dev;
+}
+
+int linux_cec_cancel(libcec_device_handle* handle)
+{
+	uint64_t one = 1;
+
+	if (write(__device_handle_priv(handle)->cancel_fd, &one, sizeof(one)) != sizeof(one)) {
+		return LIBCEC_ERROR_IO;
+	}
+	return LIBCEC_SUCCESS;
+}
+
+const _ceci_backend linux_cec_backend = {
+	"Linux CEC framework",
+	"cec",
+	linux_cec_init,
+	linux_cec_exit,
+	linux_cec_open,
+	linux_cec_close,
+	linux_cec_set_logical_address,
+	linux_cec_read_edid,
+	NULL,
+	linux_cec_read_message,
+	linux_cec_write_message,
+	linux_cec_get_pollfd,
+	linux_cec_cancel,
+	NULL,
+	linux_cec_get_physical_address,
+	linux_cec_claim_logical_address,
+
+	sizeof(linux_cec_device_handle_priv),
+};
@@ -0,0 +1,41 @@
+/*
+ * libcec - Linux CEC framework (linux/cec.h) functions
+ *
+ * Copyright (c) 2010-2011 Pete Batard <pete@akeo.ie>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define LINUX_CEC_DEFAULT_DEV	"/dev/cec0"
+
+/*
+ * Receiving and transmitting use separate file handles on the adapter: a
+ * non-blocking follower one, that the reader polls, and a blocking initiator
+ * one, so that CEC_TRANSMIT returns the outcome of the transmission, rather
+ * than the receive side having to sort it out from the received messages.
+ * In monitor mode, only the receive handle is open.
+ */
+typedef struct {
+	int			rx_dev;
+	int			tx_dev;
+	int			cancel_fd;		/* eventfd, makes blocked reads return */
+	uint32_t	capabilities;
+	uint32_t	monitor;		/* CEC_MODE_MONITOR or CEC_MODE_MONITOR_ALL, 0 if not monitoring */
+	uint16_t	physical_address;	/* set at open, for adapters that need it from userspace */
+} linux_cec_device_handle_priv;
+
+static inline linux_cec_device_handle_priv* __device_handle_priv(libcec_device_handle *handle)
+{
+	return (linux_cec_device_handle_priv*) handle->priv;
+}
@@ -37,6 +37,9 @@
 /* I2C definitions */
 #define REALTEK_EDID_I2C_DEV	"/dev/i2c/0"
 #define REALTEK_EDID_I2C_ADDR	0x50
+#define REALTEK_EDID_I2C_SEGMENT_ADDR	0x30
+#define REALTEK_EDID_SIZE		256		/* one DDC segment */
+#define REALTEK_EDID_SLACK		32		/* extra bytes read to skip parasitic data */
 #define I2C_RDWR				0x0707
 #define I2C_M_RD				0x01
 struct i2c_msg {
@@ -65,15 +68,16 @@ int realtek_cec_open(char* device_name, libcec_device_handle* handle)
 	int ret_val;
 
 	realtek_device_handle_priv* handle_priv = __device_handle_priv(handle);
+	handle_priv->i2c_dev = -1;
 	handle_priv->cec_dev = open(device_name, 0);
 	if (handle_priv->cec_dev < 0) {
-		ceci_error("cannot open CEC device '%s' - errno: %d", device_name, errno);
+		ceci_error(HANDLE_CTX(handle), "cannot open CEC device '%s' - errno: %d", device_name, errno);
 		return LIBCEC_ERROR_NO_DEVICE;
 	}
 
 	ret_val = ioctl(handle_priv->cec_dev, CEC_ENABLE, 1);
 	if (ret_val) {
-		ceci_error("cannot enable CEC device '%s' - errno: %d", device_name, errno);
+		ceci_error(HANDLE_CTX(handle), "cannot enable CEC device '%s' - errno: %d", device_name, errno);
 		close(handle_priv->cec_dev);
 		return LIBCEC_ERROR_IO;
 	}
@@ -85,64 +89,132 @@ int realtek_cec_close(libcec_device_handle* handle)
 {
 	realtek_device_handle_priv* handle_priv = __device_handle_priv(handle);
 
+	if (handle_priv->i2c_dev >= 0) {
+		close(handle_priv->i2c_dev);
+	}
 	close(handle_priv->cec_dev);
 	return LIBCEC_SUCCESS;
 }
 
+/* Read length bytes of EDID, starting at the given segment and offset of the E-DDC address space */
+static int realtek_i2c_read_at(int fd, uint8_t segment, uint8_t offset, uint8_t* buffer, size_t length)
+{
+	struct i2c_msg i2c_messages[3], *msg = i2c_messages;
+	struct i2c_rdwr_ioctl_data i2c_msgset = { i2c_messages, 0 };
+
+	/* Set the segment pointer, which sinks without E-DDC don't acknowledge,
+	   then the DDC word offset, and read from there, as a single transaction */
+	if (segment != 0) {
+		msg->addr = REALTEK_EDID_I2C_SEGMENT_ADDR;
+		msg->flags = 0;
+		msg->len = 1;
+		msg->buf = &segment;
+		msg++;
+	}
+	msg->addr = REALTEK_EDID_I2C_ADDR;
+	msg->flags = 0;
+	msg->len = 1;
+	msg->buf = &offset;
+	msg++;
+	msg->addr = REALTEK_EDID_I2C_ADDR;
+	msg->flags = I2C_M_RD;
+	msg->len = length;
+	msg->buf = buffer;
+	msg++;
+	i2c_msgset.nmsgs = msg - i2c_messages;
+	return ioctl(fd, I2C_RDWR, &i2c_msgset);
+}
+
+/* The I2C device is kept open, as we need it again on hotplug */
+static int realtek_i2c_open(libcec_device_handle* handle)
+{
+	realtek_device_handle_priv* handle_priv = __device_handle_priv(handle);
+
+	if (handle_priv->i2c_dev < 0) {
+		handle_priv->i2c_dev = open(REALTEK_EDID_I2C_DEV, O_RDWR | O_CLOEXEC);
+		if (handle_priv->i2c_dev < 0) {
+			ceci_error(HANDLE_CTX(handle), "unable to open I2C device '%s' - errno: %d", REALTEK_EDID_I2C_DEV, errno);
+			return LIBCEC_ERROR_ACCESS;
+		}
+	}
+	return LIBCEC_SUCCESS;
+}
+
 int realtek_i2c_read_edid(libcec_device_handle* handle, uint8_t* buffer, size_t length)
 {
-	int fd;
-	size_t offset;
+	realtek_device_handle_priv* handle_priv = __device_handle_priv(handle);
+	size_t offset, available;
+	int r;
+	uint8_t data[REALTEK_EDID_SIZE + REALTEK_EDID_SLACK];
 	struct i2c_msg i2c_message;
 	struct i2c_rdwr_ioctl_data i2c_msgset = { &i2c_message, 1};
 	const uint8_t edid_marker[] = {0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00};
 
-	/* Only one HDMI port for RTD, and the DDC for EDID is at I2C address 0x50 */
-	i2c_message.addr = REALTEK_EDID_I2C_ADDR;
-	i2c_message.flags = I2C_M_RD;
-	i2c_message.len = length;
-	i2c_message.buf = buffer;
+	/* The DDC address pointer is 8 bit, so a read is limited to a single segment */
+	length = MIN(length, REALTEK_EDID_SIZE);
 
-	fd = open(REALTEK_EDID_I2C_DEV, O_RDWR);
-	if (fd < 0) {
-		ceci_error("unable to open I2C device '%s' - errno: %d", REALTEK_EDID_I2C_DEV, errno);
-		return LIBCEC_ERROR_ACCESS;
+	r = realtek_i2c_open(handle);
+	if (r != LIBCEC_SUCCESS) {
+		return r;
 	}
 
-	if (ioctl(fd, I2C_RDWR, &i2c_msgset) < 0) {
-		ceci_error("unable to read EDID - errno: %d", errno);
-		close(fd);
+	/* Only one HDMI port for RTD, and the DDC for EDID is at I2C address 0x50.
+	   Read a few more bytes than needed, so that a misaligned EDID can usually
+	   be recovered without another transfer */
+	i2c_message.addr = REALTEK_EDID_I2C_ADDR;
+	i2c_message.flags = I2C_M_RD;
+	i2c_message.len = length + REALTEK_EDID_SLACK;
+	i2c_message.buf = data;
+
+	if (ioctl(handle_priv->i2c_dev, I2C_RDWR, &i2c_msgset) < 0) {
+		ceci_error(HANDLE_CTX(handle), "unable to read EDID - errno: %d", errno);
 		return LIBCEC_ERROR_IO;
 	}
 
 	/* If you switch your HDMI connection around, parasitic bytes
 	   may get inserted in the EDID => attempt to remedy that */
-	if (memcmp(buffer, edid_marker, sizeof(edid_marker)) != 0) {
-		/* EDID marker was not found at the zero position */
-		for (offset=1; offset<length-sizeof(edid_marker); offset++) {
-			if (memcmp(buffer+offset, edid_marker, sizeof(edid_marker)) == 0) {
-				ceci_warn("found EDID marker at offset 0x%x - attempting to fix it", offset);
-				memmove(buffer, buffer+offset, length-offset);
-				break;
-			}
-		}
-		if (offset >= length-sizeof(edid_marker)) {
-			ceci_warn("could not find EDID marker in data - EDID seems invalid");
-			close(fd);
-			return LIBCEC_ERROR_IO;
+	for (offset=0; offset<length+REALTEK_EDID_SLACK-sizeof(edid_marker); offset++) {
+		if (memcmp(data+offset, edid_marker, sizeof(edid_marker)) == 0) {
+			break;
 		}
-		/* Fill the missing bytes */
-		i2c_message.len = offset;
-		i2c_message.buf = buffer+length-offset-1;
-		if (ioctl(fd, I2C_RDWR, &i2c_msgset) < 0) {
-			ceci_error("failed to complete EDID readout - errno: %d", errno);
-			close(fd);
+	}
+	if (offset >= length+REALTEK_EDID_SLACK-sizeof(edid_marker)) {
+		ceci_warn(HANDLE_CTX(handle), "could not find EDID marker in data - EDID seems invalid");
+		return LIBCEC_ERROR_IO;
+	}
+	available = MIN(length, length + REALTEK_EDID_SLACK - offset);
+	memcpy(buffer, data+offset, available);
+	if (offset != 0) {
+		ceci_warn(HANDLE_CTX(handle), "found EDID marker at offset 0x%x - attempting to fix it", offset);
+	}
+
+	/* Fetch the exact span that is still missing, if any */
+	if (available < length) {
+		if (realtek_i2c_read_at(handle_priv->i2c_dev, 0, (uint8_t)available, buffer+available, length-available) < 0) {
+			ceci_error(HANDLE_CTX(handle), "failed to complete EDID readout - errno: %d", errno);
 			return LIBCEC_ERROR_IO;
 		}
 	}
 
-	close(fd);
+	return LIBCEC_SUCCESS;
+}
+
+int realtek_i2c_read_edid_range(libcec_device_handle* handle, uint8_t segment, uint8_t offset, uint8_t* buffer, size_t length)
+{
+	realtek_device_handle_priv* handle_priv = __device_handle_priv(handle);
+	int r;
 
+	if (offset + length > REALTEK_EDID_SIZE) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	r = realtek_i2c_open(handle);
+	if (r != LIBCEC_SUCCESS) {
+		return r;
+	}
+	if (realtek_i2c_read_at(handle_priv->i2c_dev, segment, offset, buffer, length) < 0) {
+		ceci_dbg(HANDLE_CTX(handle), "unable to read EDID at segment %d, offset 0x%02x - errno: %d", segment, offset, errno);
+		return LIBCEC_ERROR_IO;
+	}
 	return LIBCEC_SUCCESS;
 }
 
@@ -153,13 +225,13 @@ int realtek_cec_set_logical_address(libcec_device_handle* handle, uint8_t logica
 
 	ret_val = ioctl(handle_priv->cec_dev, CEC_SET_LOGICAL_ADDRESS, logical_address);
 	if (ret_val) {
-		ceci_error("failed to set CEC logical address");
+		ceci_error(HANDLE_CTX(handle), "failed to set CEC logical address");
 		return LIBCEC_ERROR_IO;
 	}
 	return LIBCEC_SUCCESS;
 }
 
-int realtek_cec_write_message(libcec_device_handle* handle, uint8_t* buffer, size_t length)
+int realtek_cec_write_message(libcec_device_handle* handle, uint8_t* buffer, size_t length, libcec_tx_status* status)
 {
 	realtek_device_handle_priv* handle_priv = __device_handle_priv(handle);
 	int ret_val;
@@ -173,13 +245,29 @@ int realtek_cec_write_message(libcec_device_handle* handle, uint8_t* buffer, siz
 
 	ret_val = ioctl(handle_priv->cec_dev, CEC_SEND_MESSAGE, &msg);
 	if (ret_val) {
-		ceci_error("failed to send CEC message - errno: %d");
-		return LIBCEC_ERROR_IO;
+		/* the driver retries internally, and reports the final outcome through errno */
+		switch (errno) {
+		case EIO:
+			status->result = LIBCEC_TX_NACK;
+			return LIBCEC_ERROR_IO;
+		case EBUSY:
+		case EAGAIN:
+			status->result = LIBCEC_TX_ARB_LOST;
+			return LIBCEC_ERROR_BUSY;
+		case ETIME:
+		case ETIMEDOUT:
+			status->result = LIBCEC_TX_TIMEOUT;
+			return LIBCEC_ERROR_TIMEOUT;
+		default:
+			ceci_error(HANDLE_CTX(handle), "failed to send CEC message - errno: %d", errno);
+			status->result = LIBCEC_TX_ERROR;
+			return LIBCEC_ERROR_IO;
+		}
 	}
 	return LIBCEC_SUCCESS;
 }
 
-int realtek_cec_read_message(libcec_device_handle* handle, uint8_t* buffer, size_t length, int32_t timeout)
+int realtek_cec_read_message(libcec_device_handle* handle, uint8_t* buffer, size_t length, int32_t timeout, uint64_t* timestamp)
 {
 	realtek_device_handle_priv* handle_priv = __device_handle_priv(handle);
 	int rcv_len;
@@ -197,7 +285,7 @@ int realtek_cec_read_message(libcec_device_handle* handle, uint8_t* buffer, size
 		if (errno == ETIME) {
 			return LIBCEC_ERROR_TIMEOUT;
 		}
-		ceci_error("failed to receive CEC message - errno: %d", errno);
+		ceci_error(HANDLE_CTX(handle), "failed to receive CEC message - errno: %d", errno);
 		return LIBCEC_ERROR_IO;
 	}
 	return rcv_len;
@@ -205,14 +293,21 @@ int realtek_cec_read_message(libcec_device_handle* handle, uint8_t* buffer, size
 
 const _ceci_backend linux_realtek_soc_backend = {
 	"Linux Realtek SoC",
+	"realtek",
 	realtek_cec_init,
 	realtek_cec_exit,
 	realtek_cec_open,
 	realtek_cec_close,
 	realtek_cec_set_logical_address,
 	realtek_i2c_read_edid,
+	realtek_i2c_read_edid_range,
 	realtek_cec_read_message,
 	realtek_cec_write_message,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
 
 	sizeof(realtek_device_handle_priv),
 };
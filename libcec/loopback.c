@@ -0,0 +1,797 @@
+/*
+ * libcec - Loopback (simulated bus) CEC functions
+ *
+ * Copyright (c) 2010-2011 Pete Batard <pete@akeo.ie>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This backend models an in-process CEC bus populated with simulated
+ * devices, so that libcec and cecd can be exercised without any hardware.
+ * The device name is a comma separated list of options:
+ *   devices=<hex digits>  logical addresses of the simulated devices (default "045")
+ *   pa=<a.b.c.d>          our physical address, as reported in the EDID (default 1.0.0.0)
+ *   edid=<0|1>            whether an HDMI sink EDID can be read (default 1)
+ *   ext=<n>               number of EDID extension blocks, the last one with the VSDB (default 1)
+ *   nack=<percent>        probability of a transmitted frame not being ACKed
+ *   arb=<percent>         probability of losing arbitration on transmit
+ *   latency=<ms>          delay added to our transmissions and to device replies
+ *   wire=<0|1>            simulate the nominal CEC bit timing (default 0)
+ *   retries=<n>           retransmissions after a NACK or arbitration loss (default 0)
+ *   traffic=<n>           frames per second of background traffic from the devices
+ *   seed=<n>              seed for the fault injection generator (default 1)
+ * Any other token, such as a regular device path, is ignored.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "libceci.h"
+#include "loopback.h"
+
+#define LOOPBACK_VENDOR_ID		0x000000
+#define LOOPBACK_CEC_VERSION	0x04	/* 1.3a */
+
+static const uint8_t loopback_device_type[15] = {0, 1, 1, 3, 4, 5, 3, 3, 4, 1, 3, 4, 2, 2, 0};
+static const char* loopback_device_name[6] = {
+	"TV", "Recorder", "Reserved", "Tuner", "Player", "Audio System" };
+
+static void ts_add_us(struct timespec* ts, unsigned long us)
+{
+	ts->tv_sec += us / 1000000;
+	ts->tv_nsec += (us % 1000000) * 1000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static int ts_before(const struct timespec* a, const struct timespec* b)
+{
+	if (a->tv_sec != b->tv_sec) {
+		return a->tv_sec < b->tv_sec;
+	}
+	return a->tv_nsec < b->tv_nsec;
+}
+
+/* Time it takes for a frame to go through the bus, in us */
+static unsigned long loopback_frame_time(loopback_device_handle_priv* priv, size_t length)
+{
+	unsigned long us = priv->latency * 1000;
+
+	if (priv->wire_timing) {
+		/* 4.5 ms start bit, then 10 bits of 2.4 ms per block */
+		us += 4500 + length * 24000;
+	}
+	return us;
+}
+
+static int loopback_fault(loopback_device_handle_priv* priv, unsigned int rate)
+{
+	return (rate != 0) && ((unsigned int)(rand_r(&priv->seed) % 100) < rate);
+}
+
+/*
+ * Arm the poll timer for the next frame that will become readable, which
+ * makes it poll readable right away if that frame is already due.
+ * Must be called with the lock held.
+ */
+static void loopback_update_timer(loopback_device_handle_priv* priv)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	if (priv->queue_count > 0) {
+		its.it_value = priv->queue[priv->queue_head].due;
+	} else if (priv->traffic != 0) {
+		its.it_value = priv->next_traffic;
+	}
+	/* a zero it_value disarms the timer */
+	timerfd_settime(priv->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* Queue a frame for reading. Must be called with the lock held */
+static void loopback_queue_push(loopback_device_handle_priv* priv, uint8_t* buf, size_t len,
+								struct timespec* due)
+{
+	loopback_frame* frame;
+	loopback_frame* prev;
+	unsigned int i;
+
+	/* like a driver that filters, don't even queue what wasn't asked for */
+	if ( (priv->rx_filtered)
+	  && !ceci_rx_filter_match(priv->rx_opcodes, priv->rx_initiators, buf, len) ) {
+		return;
+	}
+	if (priv->queue_count >= LOOPBACK_QUEUE_SIZE) {
+		ceci_warn(priv->ctx, "loopback queue full - dropping oldest frame");
+		priv->queue_head = (priv->queue_head + 1) % LOOPBACK_QUEUE_SIZE;
+		priv->queue_count--;
+	}
+	/* keep the queue in due order, as the next traffic frame is queued ahead
+	   of time, and must not hold back the replies that are due before it */
+	for (i=priv->queue_count; i>0; i--) {
+		prev = &priv->queue[(priv->queue_head + i - 1) % LOOPBACK_QUEUE_SIZE];
+		if (!ts_before(due, &prev->due)) {
+			break;
+		}
+		priv->queue[(priv->queue_head + i) % LOOPBACK_QUEUE_SIZE] = *prev;
+	}
+	frame = &priv->queue[(priv->queue_head + i) % LOOPBACK_QUEUE_SIZE];
+	memcpy(frame->buf, buf, len);
+	frame->len = (uint8_t)len;
+	frame->due = *due;
+	priv->queue_count++;
+	if (i == 0) {
+		loopback_update_timer(priv);
+	}
+	pthread_cond_broadcast(&priv->cond);
+}
+
+/* Have a simulated device send a frame, and have it reach us if it concerns us */
+static void loopback_device_send(loopback_device_handle_priv* priv, uint8_t* buf, size_t len,
+								 struct timespec* when)
+{
+	uint8_t dst = buf[0] & 0x0F;
+
+	ts_add_us(when, loopback_frame_time(priv, len));
+	if ((dst == 0x0F) || (dst == priv->logical_address)) {
+		loopback_queue_push(priv, buf, len, when);
+	}
+}
+
+/* Have a simulated device process a frame it received */
+static void loopback_device_process(loopback_device_handle_priv* priv, loopback_device* dev,
+									uint8_t* buf, size_t len, struct timespec* when)
+{
+	uint8_t reply[LOOPBACK_FRAME_SIZE];
+	uint8_t src = buf[0] >> 4, dst = buf[0] & 0x0F;
+	size_t reply_len = 0, i;
+
+	if (len < 2) {
+		return;
+	}
+
+	reply[0] = (dev->logical_address << 4) | src;
+	switch (buf[1]) {
+	case 0x83:	/* Give Physical Address */
+		reply[0] = (dev->logical_address << 4) | 0x0F;
+		reply[1] = 0x84;
+		reply[2] = dev->physical_address >> 8;
+		reply[3] = dev->physical_address & 0xFF;
+		reply[4] = dev->device_type;
+		reply_len = 5;
+		break;
+	case 0x46:	/* Give OSD Name */
+		reply[1] = 0x47;
+		for (i=0; (dev->osd_name[i] != 0) && (i < 14); i++) {
+			reply[i+2] = dev->osd_name[i];
+		}
+		reply_len = i+2;
+		break;
+	case 0x8C:	/* Give Device Vendor ID */
+		reply[0] = (dev->logical_address << 4) | 0x0F;
+		reply[1] = 0x87;
+		reply[2] = (LOOPBACK_VENDOR_ID >> 16) & 0xFF;
+		reply[3] = (LOOPBACK_VENDOR_ID >> 8) & 0xFF;
+		reply[4] = LOOPBACK_VENDOR_ID & 0xFF;
+		reply_len = 5;
+		break;
+	case 0x8F:	/* Give Device Power Status */
+		reply[1] = 0x90;
+		reply[2] = dev->power_status;
+		reply_len = 3;
+		break;
+	case 0x9F:	/* Get CEC Version */
+		reply[1] = 0x9E;
+		reply[2] = LOOPBACK_CEC_VERSION;
+		reply_len = 3;
+		break;
+	case 0x91:	/* Get Menu Language */
+		if (dev->device_type != 0) {
+			goto abort;
+		}
+		reply[0] = (dev->logical_address << 4) | 0x0F;
+		reply[1] = 0x32;
+		memcpy(&reply[2], "eng", 3);
+		reply_len = 5;
+		break;
+	case 0x71:	/* Give Audio Status */
+		if (dev->device_type != 5) {
+			goto abort;
+		}
+		reply[1] = 0x7A;
+		reply[2] = 0x32;
+		reply_len = 3;
+		break;
+	case 0x36:	/* Standby */
+		dev->power_status = 0x01;
+		break;
+	case 0x04:	/* Image View On */
+	case 0x0D:	/* Text View On */
+		if (dev->device_type == 0) {
+			dev->power_status = 0x00;
+		}
+		break;
+	/* Messages that never call for a reply */
+	case 0x00:	/* Feature Abort */
+	case 0x32:	/* Set Menu Language */
+	case 0x44:	/* User Control Pressed */
+	case 0x45:	/* User Control Released */
+	case 0x47:	/* Set OSD Name */
+	case 0x7A:	/* Report Audio Status */
+	case 0x80:	/* Routing Change */
+	case 0x81:	/* Routing Information */
+	case 0x82:	/* Active Source */
+	case 0x84:	/* Report Physical Address */
+	case 0x85:	/* Request Active Source */
+	case 0x86:	/* Set Stream Path */
+	case 0x87:	/* Device Vendor ID */
+	case 0x8E:	/* Menu Status */
+	case 0x90:	/* Report Power Status */
+	case 0x9D:	/* Inactive Source */
+	case 0x9E:	/* CEC Version */
+	case 0x1B:	/* Deck Status */
+		break;
+	default:
+abort:
+		/* Only directed messages get a <Feature Abort> */
+		if (dst == 0x0F) {
+			break;
+		}
+		reply[1] = 0x00;
+		reply[2] = buf[1];
+		reply[3] = 0x00;	/* Unrecognized opcode */
+		reply_len = 4;
+		break;
+	}
+
+	if (reply_len != 0) {
+		ts_add_us(when, priv->latency * 1000);
+		loopback_device_send(priv, reply, reply_len, when);
+	}
+}
+
+/* Generate the background traffic that is due. Must be called with the lock held */
+static void loopback_generate_traffic(loopback_device_handle_priv* priv, struct timespec* now)
+{
+	uint8_t buf[LOOPBACK_FRAME_SIZE];
+	loopback_device* dev = NULL;
+	struct timespec when, limit;
+	size_t len;
+	int i;
+
+	if (priv->traffic == 0) {
+		return;
+	}
+	for (i=0; i<15; i++) {
+		if ((priv->present & (1<<i)) && (i != priv->logical_address)) {
+			dev = &priv->devices[i];
+			break;
+		}
+	}
+	if (dev == NULL) {
+		return;
+	}
+
+	/* Don't try to catch up with traffic that was due more than a second ago */
+	when = *now;
+	when.tv_sec -= 1;
+	if (ts_before(&priv->next_traffic, &when)) {
+		priv->next_traffic = when;
+	}
+
+	/* keep the next frame queued in advance, so that its exact due time is known,
+	   unless the receive filter drops everything we generate */
+	limit = *now;
+	limit.tv_sec += 1;
+	while ( ((priv->queue_count == 0) && ts_before(&priv->next_traffic, &limit))
+	  || !ts_before(now, &priv->next_traffic) ) {
+		buf[0] = (dev->logical_address << 4) | priv->logical_address;
+		/* Unregistered devices only get to see broadcast traffic */
+		switch ((priv->logical_address == 0x0F) ? 5 : (priv->traffic_index % 6)) {
+		case 0:
+			buf[1] = 0x83;	/* Give Physical Address */
+			len = 2;
+			break;
+		case 1:
+			buf[1] = 0x8F;	/* Give Device Power Status */
+			len = 2;
+			break;
+		case 2:
+			buf[1] = 0x44;	/* User Control Pressed */
+			buf[2] = 0x01;	/* Up */
+			len = 3;
+			break;
+		case 3:
+			buf[1] = 0x45;	/* User Control Released */
+			len = 2;
+			break;
+		case 4:
+			buf[1] = 0x46;	/* Give OSD Name */
+			len = 2;
+			break;
+		default:
+			buf[0] = (dev->logical_address << 4) | 0x0F;
+			buf[1] = 0x84;	/* Report Physical Address */
+			buf[2] = dev->physical_address >> 8;
+			buf[3] = dev->physical_address & 0xFF;
+			buf[4] = dev->device_type;
+			len = 5;
+			break;
+		}
+		priv->traffic_index++;
+		when = priv->next_traffic;
+		loopback_device_send(priv, buf, len, &when);
+		ts_add_us(&priv->next_traffic, 1000000 / priv->traffic);
+	}
+}
+
+static int loopback_parse_uint(const char* str, unsigned int* val)
+{
+	char* end_str;
+	unsigned long v;
+
+	v = strtoul(str, &end_str, 0);
+	if ((*str == 0) || (*end_str != 0) || (v > 0xFFFF)) {
+		return -1;
+	}
+	*val = (unsigned int)v;
+	return 0;
+}
+
+static int loopback_parse_options(loopback_device_handle_priv* priv, const char* device_name)
+{
+	char options[256], *token, *val, *saveptr = NULL;
+	unsigned int a, b, c, d, i;
+	int r;
+
+	if (device_name == NULL) {
+		return LIBCEC_SUCCESS;
+	}
+	strncpy(options, device_name, sizeof(options)-1);
+	options[sizeof(options)-1] = 0;
+
+	for (token = strtok_r(options, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr)) {
+		val = strchr(token, '=');
+		if (val == NULL) {
+			ceci_dbg(priv->ctx, "ignoring '%s'", token);
+			continue;
+		}
+		*val++ = 0;
+		r = 0;
+		if (strcmp(token, "devices") == 0) {
+			priv->present = 0;
+			for (i=0; val[i] != 0; i++) {
+				if ((val[i] >= '0') && (val[i] <= '9')) {
+					priv->present |= 1 << (val[i] - '0');
+				} else if ((val[i] >= 'a') && (val[i] <= 'e')) {
+					priv->present |= 1 << (val[i] - 'a' + 10);
+				} else if ((val[i] >= 'A') && (val[i] <= 'E')) {
+					priv->present |= 1 << (val[i] - 'A' + 10);
+				} else {
+					r = -1;
+				}
+			}
+		} else if (strcmp(token, "pa") == 0) {
+			if (sscanf(val, "%x.%x.%x.%x", &a, &b, &c, &d) == 4) {
+				priv->physical_address = ((a&0xF)<<12) | ((b&0xF)<<8) | ((c&0xF)<<4) | (d&0xF);
+			} else {
+				r = loopback_parse_uint(val, &a);
+				priv->physical_address = (uint16_t)a;
+			}
+		} else if (strcmp(token, "edid") == 0) {
+			r = loopback_parse_uint(val, &a);
+			priv->has_edid = (a != 0);
+		} else if (strcmp(token, "ext") == 0) {
+			r = loopback_parse_uint(val, &priv->edid_extensions);
+			if ((priv->edid_extensions == 0) || (priv->edid_extensions >= LOOPBACK_EDID_SIZE / 128)) {
+				r = -1;
+			}
+		} else if (strcmp(token, "nack") == 0) {
+			r = loopback_parse_uint(val, &priv->nack_rate);
+		} else if (strcmp(token, "arb") == 0) {
+			r = loopback_parse_uint(val, &priv->arb_rate);
+		} else if (strcmp(token, "latency") == 0) {
+			r = loopback_parse_uint(val, &priv->latency);
+		} else if (strcmp(token, "wire") == 0) {
+			r = loopback_parse_uint(val, &priv->wire_timing);
+		} else if (strcmp(token, "retries") == 0) {
+			r = loopback_parse_uint(val, &priv->retries);
+		} else if (strcmp(token, "traffic") == 0) {
+			r = loopback_parse_uint(val, &priv->traffic);
+		} else if (strcmp(token, "seed") == 0) {
+			r = loopback_parse_uint(val, &priv->seed);
+		} else {
+			ceci_warn(priv->ctx, "unknown loopback option '%s'", token);
+			return LIBCEC_ERROR_INVALID_PARAM;
+		}
+		if (r != 0) {
+			ceci_warn(priv->ctx, "invalid value '%s' for loopback option '%s'", val, token);
+			return LIBCEC_ERROR_INVALID_PARAM;
+		}
+	}
+	return LIBCEC_SUCCESS;
+}
+
+int loopback_cec_init(void)
+{
+	return LIBCEC_SUCCESS;
+}
+
+int loopback_cec_exit(void)
+{
+	return LIBCEC_SUCCESS;
+}
+
+int loopback_cec_open(char* device_name, libcec_device_handle* handle)
+{
+	loopback_device_handle_priv* priv = __device_handle_priv(handle);
+	pthread_condattr_t attr;
+	struct timespec now;
+	uint16_t next_pa = 0x2000;
+	int i, r;
+
+	priv->ctx = HANDLE_CTX(handle);
+	priv->present = (1<<0) | (1<<4) | (1<<5);
+	priv->logical_address = 0x0F;
+	priv->physical_address = 0x1000;
+	priv->has_edid = 1;
+	priv->edid_extensions = 1;
+	priv->seed = 1;
+
+	r = loopback_parse_options(priv, device_name);
+	if (r != LIBCEC_SUCCESS) {
+		return r;
+	}
+
+	for (i=0; i<15; i++) {
+		priv->devices[i].logical_address = (uint8_t)i;
+		priv->devices[i].device_type = loopback_device_type[i];
+		priv->devices[i].power_status = 0x00;
+		snprintf(priv->devices[i].osd_name, sizeof(priv->devices[i].osd_name), "%s",
+			loopback_device_name[loopback_device_type[i]]);
+		if (i == 0) {
+			priv->devices[i].physical_address = 0x0000;
+		} else if (priv->present & (1<<i)) {
+			priv->devices[i].physical_address = next_pa;
+			next_pa += 0x1000;
+		}
+	}
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&priv->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&priv->lock, NULL);
+
+	priv->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (priv->timer_fd < 0) {
+		ceci_error(HANDLE_CTX(handle), "could not create timerfd - errno: %d", errno);
+		pthread_cond_destroy(&priv->cond);
+		pthread_mutex_destroy(&priv->lock);
+		return LIBCEC_ERROR_RESOURCE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	priv->next_traffic = now;
+	if (priv->traffic != 0) {
+		ts_add_us(&priv->next_traffic, 1000000 / priv->traffic);
+	}
+	loopback_generate_traffic(priv, &now);
+	loopback_update_timer(priv);
+
+	ceci_dbg(HANDLE_CTX(handle), "loopback bus: devices %04X, nack %d%%, arb %d%%, latency %d ms, traffic %d/s",
+		priv->present, priv->nack_rate, priv->arb_rate, priv->latency, priv->traffic);
+	return LIBCEC_SUCCESS;
+}
+
+int loopback_cec_close(libcec_device_handle* handle)
+{
+	loopback_device_handle_priv* priv = __device_handle_priv(handle);
+
+	close(priv->timer_fd);
+	pthread_cond_destroy(&priv->cond);
+	pthread_mutex_destroy(&priv->lock);
+	return LIBCEC_SUCCESS;
+}
+
+/* Fill the checksum byte of a 128 bytes EDID block */
+static void loopback_edid_checksum(uint8_t* block)
+{
+	uint8_t checksum;
+	int i;
+
+	for (checksum=0, i=0; i<0x7F; i++) {
+		checksum += block[i];
+	}
+	block[0x7F] = -checksum;
+}
+
+/*
+ * Synthesize the EDID of the sink we are connected to. The HDMI VSDB goes
+ * into the last extension block, so that multi-segment EDIDs can be tested.
+ */
+static void loopback_build_edid(loopback_device_handle_priv* priv, uint8_t* buffer)
+{
+	const uint8_t edid_marker[] = {0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00};
+	const char monitor_name[] = "Loopback TV\n ";
+	uint8_t* block;
+	unsigned int i;
+
+	memset(buffer, 0, LOOPBACK_EDID_SIZE);
+
+	/* Base block: header, "CEC" manufacturer ID, EDID 1.3, monitor name */
+	memcpy(buffer, edid_marker, sizeof(edid_marker));
+	buffer[0x08] = 0x0C;
+	buffer[0x09] = 0xA3;
+	buffer[0x0A] = 0x01;
+	buffer[0x12] = 0x01;
+	buffer[0x13] = 0x03;
+	buffer[0x4B] = 0xFC;
+	memcpy(&buffer[0x4D], monitor_name, 13);
+	buffer[0x7E] = (uint8_t)priv->edid_extensions;
+	loopback_edid_checksum(buffer);
+
+	/* CEA-861 extensions, the last one with an HDMI VSDB holding our physical address */
+	for (i=1; i<=priv->edid_extensions; i++) {
+		block = &buffer[i*128];
+		block[0x00] = 0x02;
+		block[0x01] = 0x03;
+		block[0x02] = 0x04;
+		block[0x03] = 0x40;		/* basic audio */
+		if (i == priv->edid_extensions) {
+			block[0x02] = 0x0F;
+			block[0x04] = 0x6A;
+			block[0x05] = 0x03;
+			block[0x06] = 0x0C;
+			block[0x07] = 0x00;
+			block[0x08] = priv->physical_address >> 8;
+			block[0x09] = priv->physical_address & 0xFF;
+			block[0x0A] = 0x80;	/* Supports_AI */
+			block[0x0B] = 0x2D;	/* 225 MHz */
+			block[0x0C] = 0x80;	/* latency fields present */
+			block[0x0D] = 1 + priv->latency / 2;
+			block[0x0E] = 1 + priv->latency / 2;
+		}
+		loopback_edid_checksum(block);
+	}
+}
+
+int loopback_cec_read_edid_range(libcec_device_handle* handle, uint8_t segment, uint8_t offset, uint8_t* buffer, size_t length)
+{
+	loopback_device_handle_priv* priv = __device_handle_priv(handle);
+	uint8_t edid[LOOPBACK_EDID_SIZE];
+	size_t start = segment * 256 + offset;
+
+	if (!priv->has_edid) {
+		ceci_error(HANDLE_CTX(handle), "no EDID on loopback bus");
+		return LIBCEC_ERROR_IO;
+	}
+	if (start + length > (priv->edid_extensions + 1) * 128) {
+		/* nothing answers past the end of the EDID */
+		return LIBCEC_ERROR_IO;
+	}
+	loopback_build_edid(priv, edid);
+	memcpy(buffer, edid + start, length);
+	return LIBCEC_SUCCESS;
+}
+
+int loopback_cec_read_edid(libcec_device_handle* handle, uint8_t* buffer, size_t length)
+{
+	loopback_device_handle_priv* priv = __device_handle_priv(handle);
+	uint8_t edid[LOOPBACK_EDID_SIZE];
+
+	if (!priv->has_edid) {
+		ceci_error(HANDLE_CTX(handle), "no EDID on loopback bus");
+		return LIBCEC_ERROR_IO;
+	}
+	/* a plain DDC read only reaches the first segment */
+	loopback_build_edid(priv, edid);
+	memcpy(buffer, edid, MIN(length, 256));
+	return LIBCEC_SUCCESS;
+}
+
+int loopback_cec_set_logical_address(libcec_device_handle* handle, uint8_t logical_address)
+{
+	loopback_device_handle_priv* priv = __device_handle_priv(handle);
+
+	pthread_mutex_lock(&priv->lock);
+	priv->logical_address = logical_address;
+	pthread_mutex_unlock(&priv->lock);
+	return LIBCEC_SUCCESS;
+}
+
+int loopback_cec_write_message(libcec_device_handle* handle, uint8_t* buffer, size_t length, libcec_tx_status* status)
+{
+	loopback_device_handle_priv* priv = __device_handle_priv(handle);
+	struct timespec now, when;
+	unsigned long bus_time = 0;
+	unsigned int attempt;
+	uint8_t dst;
+	int i, r = LIBCEC_SUCCESS;
+
+	if (length > LOOPBACK_FRAME_SIZE) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	dst = buffer[0] & 0x0F;
+
+	pthread_mutex_lock(&priv->lock);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (attempt = 0; attempt <= priv->retries; attempt++) {
+		if (loopback_fault(priv, priv->arb_rate)) {
+			/* arbitration is lost during the header block */
+			bus_time += loopback_frame_time(priv, 1);
+			status->result = LIBCEC_TX_ARB_LOST;
+			r = LIBCEC_ERROR_BUSY;
+		} else {
+			bus_time += loopback_frame_time(priv, length);
+			if ( ((dst != 0x0F) && !(priv->present & (1<<dst)))
+			  || loopback_fault(priv, priv->nack_rate) ) {
+				status->result = LIBCEC_TX_NACK;
+				r = LIBCEC_ERROR_IO;
+			} else {
+				status->result = LIBCEC_TX_OK;
+				r = LIBCEC_SUCCESS;
+				break;
+			}
+		}
+	}
+	status->retries = MIN(attempt, priv->retries);
+	if (r == LIBCEC_SUCCESS) {
+		for (i=0; i<15; i++) {
+			if ((priv->present & (1<<i)) && ((dst == 0x0F) || (dst == i))) {
+				when = now;
+				ts_add_us(&when, bus_time);
+				loopback_device_process(priv, &priv->devices[i], buffer, length, &when);
+			}
+		}
+	}
+	pthread_mutex_unlock(&priv->lock);
+
+	if (bus_time != 0) {
+		usleep(bus_time);
+	}
+	if (r != LIBCEC_SUCCESS) {
+		ceci_dbg(HANDLE_CTX(handle), "loopback transmit to %X failed: %s", dst, libcec_strerror(r));
+	}
+	return r;
+}
+
+/* A negative timeout waits forever */
+int loopback_cec_read_message(libcec_device_handle* handle, uint8_t* buffer, size_t length, int32_t timeout, uint64_t* timestamp)
+{
+	loopback_device_handle_priv* priv = __device_handle_priv(handle);
+	struct timespec now, deadline, wake;
+	loopback_frame* frame;
+	int r, has_wake;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	if (timeout > 0) {
+		ts_add_us(&deadline, (unsigned long)timeout * 1000);
+	}
+
+	pthread_mutex_lock(&priv->lock);
+	while (1) {
+		if (priv->cancelled) {
+			pthread_mutex_unlock(&priv->lock);
+			return LIBCEC_ERROR_INTERRUPTED;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		loopback_generate_traffic(priv, &now);
+		frame = &priv->queue[priv->queue_head];
+		if ((priv->queue_count > 0) && !ts_before(&now, &frame->due)) {
+			break;
+		}
+		if ((timeout >= 0) && !ts_before(&now, &deadline)) {
+			loopback_update_timer(priv);
+			pthread_mutex_unlock(&priv->lock);
+			return LIBCEC_ERROR_TIMEOUT;
+		}
+		/* sleep until the next frame is due, or we time out */
+		wake = deadline;
+		has_wake = (timeout >= 0);
+		if ((priv->queue_count > 0) && (!has_wake || ts_before(&frame->due, &wake))) {
+			wake = frame->due;
+			has_wake = 1;
+		}
+		if ((priv->traffic != 0) && (!has_wake || ts_before(&priv->next_traffic, &wake))) {
+			wake = priv->next_traffic;
+			has_wake = 1;
+		}
+		if (has_wake) {
+			pthread_cond_timedwait(&priv->cond, &priv->lock, &wake);
+		} else {
+			pthread_cond_wait(&priv->cond, &priv->lock);
+		}
+	}
+
+	if (frame->len > length) {
+		r = LIBCEC_ERROR_OVERFLOW;
+	} else {
+		memcpy(buffer, frame->buf, frame->len);
+		r = frame->len;
+		/* the time the frame completed on the simulated bus */
+		*timestamp = (uint64_t)frame->due.tv_sec * 1000000000ULL + frame->due.tv_nsec;
+	}
+	priv->queue_head = (priv->queue_head + 1) % LOOPBACK_QUEUE_SIZE;
+	priv->queue_count--;
+	loopback_generate_traffic(priv, &now);
+	loopback_update_timer(priv);
+	pthread_mutex_unlock(&priv->lock);
+
+	return r;
+}
+
+int loopback_cec_get_pollfd(libcec_device_handle* handle)
+{
+	return __device_handle_priv(handle)->timer_fd;
+}
+
+int loopback_cec_cancel(libcec_device_handle* handle)
+{
+	loopback_device_handle_priv* priv = __device_handle_priv(handle);
+
+	pthread_mutex_lock(&priv->lock);
+	priv->cancelled = 1;
+	pthread_cond_broadcast(&priv->cond);
+	pthread_mutex_unlock(&priv->lock);
+	return LIBCEC_SUCCESS;
+}
+
+int loopback_cec_set_rx_filter(libcec_device_handle* handle, const uint8_t* opcodes, uint16_t initiators)
+{
+	loopback_device_handle_priv* priv = __device_handle_priv(handle);
+
+	pthread_mutex_lock(&priv->lock);
+	priv->rx_filtered = (opcodes != NULL) || (initiators != 0xFFFF);
+	if (opcodes != NULL) {
+		memcpy(priv->rx_opcodes, opcodes, sizeof(priv->rx_opcodes));
+	} else {
+		memset(priv->rx_opcodes, 0xFF, sizeof(priv->rx_opcodes));
+	}
+	priv->rx_initiators = initiators;
+	pthread_mutex_unlock(&priv->lock);
+	return LIBCEC_SUCCESS;
+}
+
+const _ceci_backend loopback_backend = {
+	"Loopback",
+	"loop",
+	loopback_cec_init,
+	loopback_cec_exit,
+	loopback_cec_open,
+	loopback_cec_close,
+	loopback_cec_set_logical_address,
+	loopback_cec_read_edid,
+	loopback_cec_read_edid_range,
+	loopback_cec_read_message,
+	loopback_cec_write_message,
+	loopback_cec_get_pollfd,
+	loopback_cec_cancel,
+	loopback_cec_set_rx_filter,
+	NULL,
+	NULL,
+
+	sizeof(loopback_device_handle_priv),
+};
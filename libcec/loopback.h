@@ -0,0 +1,85 @@
+/*
+ * libcec - Loopback (simulated bus) CEC functions
+ *
+ * Copyright (c) 2010-2011 Pete Batard <pete@akeo.ie>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+
+/* Maximum number of frames waiting to be read on the simulated bus */
+#define LOOPBACK_QUEUE_SIZE		64
+#define LOOPBACK_FRAME_SIZE		16
+#define LOOPBACK_EDID_SIZE		512		/* up to 3 extension blocks */
+
+/* A device simulated on the loopback bus */
+typedef struct {
+	uint8_t		logical_address;
+	uint8_t		device_type;
+	uint16_t	physical_address;
+	uint8_t		power_status;
+	char		osd_name[15];
+} loopback_device;
+
+/* A frame travelling on the loopback bus, visible to us after 'due' */
+typedef struct {
+	uint8_t			buf[LOOPBACK_FRAME_SIZE];
+	uint8_t			len;
+	struct timespec	due;
+} loopback_frame;
+
+typedef struct {
+	libcec_context*	ctx;				/* for logging, from the helpers that only get this */
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	int				timer_fd;			/* fires when the next frame is due */
+	int				cancelled;			/* the handle is being closed */
+
+	/* bus topology */
+	loopback_device	devices[15];
+	uint16_t		present;			/* bitmask of simulated logical addresses */
+	uint8_t			logical_address;	/* ours */
+	uint16_t		physical_address;	/* ours, as reported through the EDID */
+	int				has_edid;
+	unsigned int	edid_extensions;
+
+	/* fault injection and timing (rates in percent, times in ms) */
+	unsigned int	nack_rate;
+	unsigned int	arb_rate;
+	unsigned int	latency;
+	unsigned int	wire_timing;
+	unsigned int	retries;			/* retransmissions on NACK or arbitration loss */
+	unsigned int	traffic;			/* background frames per second */
+	unsigned int	seed;
+
+	/* background traffic generator */
+	struct timespec	next_traffic;
+	unsigned int	traffic_index;
+
+	/* receive filter */
+	int				rx_filtered;
+	uint8_t			rx_opcodes[LIBCEC_RX_FILTER_SIZE];
+	uint16_t		rx_initiators;
+
+	/* frames waiting to be read */
+	loopback_frame	queue[LOOPBACK_QUEUE_SIZE];
+	unsigned int	queue_head;
+	unsigned int	queue_count;
+} loopback_device_handle_priv;
+
+static inline loopback_device_handle_priv* __device_handle_priv(libcec_device_handle *handle)
+{
+	return (loopback_device_handle_priv*) handle->priv;
+}
@@ -0,0 +1,793 @@
+/*
+ * libcec - USB-serial CEC adapter functions
+ *
+ * Copyright (c) 2010-2011 Pete Batard <pete@akeo.ie>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/eventfd.h>
+
+#include "libceci.h"
+#include "serial_cec.h"
+
+/* Size of the reads from the adapter, which may hold many messages */
+#define SERIAL_CEC_CHUNK_SIZE	4096
+
+typedef struct {
+	uint8_t		code;
+	uint8_t		len;
+	uint8_t		param[2];
+} serial_cec_command;
+
+int serial_cec_init(void)
+{
+	return LIBCEC_SUCCESS;
+}
+
+int serial_cec_exit(void)
+{
+	return LIBCEC_SUCCESS;
+}
+
+static uint64_t serial_cec_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void serial_cec_deadline(struct timespec* ts, int32_t timeout)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	ts->tv_sec += timeout / 1000;
+	ts->tv_nsec += (timeout % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static void serial_cec_signal(int fd)
+{
+	uint64_t one = 1;
+
+	if (write(fd, &one, sizeof(one)) != sizeof(one)) {
+		/* only fails if the counter is saturated, in which case it is readable anyway */
+	}
+}
+
+static void serial_cec_unsignal(int fd)
+{
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+		/* EAGAIN: it was not signaled */
+	}
+}
+
+/*
+ * Device names are "<path>[,option...]", where the path defaults to
+ * /dev/ttyACM0 and the options are "baud=<rate>" and "pa=<address>", as
+ * the adapter cannot read the EDID to find out our physical address.
+ */
+static int serial_cec_parse_options(libcec_device_handle* handle, char* options, char** path, speed_t* speed)
+{
+	serial_cec_device_handle_priv* priv = __device_handle_priv(handle);
+	char *token, *val, *end_str, *saveptr = NULL;
+	unsigned long v;
+
+	*path = SERIAL_CEC_DEFAULT_DEV;
+	*speed = B38400;
+	for (token = strtok_r(options, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr)) {
+		if (token[0] == '/') {
+			*path = token;
+			continue;
+		}
+		val = strchr(token, '=');
+		if (val == NULL) {
+			ceci_warn(HANDLE_CTX(handle), "unknown serial device option '%s'", token);
+			return LIBCEC_ERROR_INVALID_PARAM;
+		}
+		*val++ = 0;
+		v = strtoul(val, &end_str, 0);
+		if ((*val == 0) || (*end_str != 0)) {
+			goto invalid;
+		}
+		if (strcmp(token, "pa") == 0) {
+			if (v > 0xFFFF) {
+				goto invalid;
+			}
+			priv->physical_address = (uint16_t)v;
+		} else if (strcmp(token, "baud") == 0) {
+			switch (v) {
+			case 9600: *speed = B9600; break;
+			case 19200: *speed = B19200; break;
+			case 38400: *speed = B38400; break;
+			case 57600: *speed = B57600; break;
+			case 115200: *speed = B115200; break;
+			default: goto invalid;
+			}
+		} else {
+			ceci_warn(HANDLE_CTX(handle), "unknown serial device option '%s'", token);
+			return LIBCEC_ERROR_INVALID_PARAM;
+		}
+	}
+	return LIBCEC_SUCCESS;
+invalid:
+	ceci_warn(HANDLE_CTX(handle), "invalid value '%s' for serial device option '%s'", val, token);
+	return LIBCEC_ERROR_INVALID_PARAM;
+}
+
+/* Queue a complete received frame. Must be called with the lock held */
+static void serial_cec_frame_done(libcec_device_handle* handle)
+{
+	serial_cec_device_handle_priv* priv = __device_handle_priv(handle);
+
+	if (priv->rx_count >= SERIAL_CEC_RX_SLOTS) {
+		priv->rx_head = (priv->rx_head + 1) % SERIAL_CEC_RX_SLOTS;
+		priv->rx_count--;
+		if (priv->rx_dropped++ == 0) {
+			ceci_warn(HANDLE_CTX(handle), "receive queue full - dropping oldest messages");
+		}
+	}
+	priv->rx[(priv->rx_head + priv->rx_count) % SERIAL_CEC_RX_SLOTS] = priv->partial;
+	if (priv->rx_count++ == 0) {
+		serial_cec_signal(priv->poll_fd);
+	}
+	priv->partial.length = 0;
+	pthread_cond_broadcast(&priv->cond);
+}
+
+/* Act on a complete message from the adapter. Must be called with the lock held */
+static void serial_cec_dispatch(libcec_device_handle* handle, const uint8_t* msg, unsigned int len, uint64_t timestamp)
+{
+	serial_cec_device_handle_priv* priv = __device_handle_priv(handle);
+	uint8_t code = msg[0] & SERIAL_CEC_CODE_MASK;
+
+	switch (code) {
+	case SERIAL_CEC_FRAME_START:
+		priv->partial.length = 0;
+		if (len < 2) {
+			priv->parse_errors++;
+			break;
+		}
+		priv->partial.data[0] = msg[1];
+		priv->partial.length = 1;
+		priv->partial.timestamp = timestamp;
+		if (msg[0] & SERIAL_CEC_FRAME_EOM) {
+			serial_cec_frame_done(handle);
+		}
+		break;
+	case SERIAL_CEC_FRAME_DATA:
+		if ((len < 2) || (priv->partial.length == 0) || (priv->partial.length >= LIBCEC_MAX_FRAME_SIZE)) {
+			priv->partial.length = 0;
+			priv->parse_errors++;
+			break;
+		}
+		priv->partial.data[priv->partial.length++] = msg[1];
+		if (msg[0] & SERIAL_CEC_FRAME_EOM) {
+			serial_cec_frame_done(handle);
+		}
+		break;
+	case SERIAL_CEC_RECEIVE_FAILED:
+	case SERIAL_CEC_TIMEOUT_ERROR:
+	case SERIAL_CEC_HIGH_ERROR:
+	case SERIAL_CEC_LOW_ERROR:
+		ceci_dbg(HANDLE_CTX(handle), "adapter reported receive error %d", code);
+		priv->partial.length = 0;
+		break;
+	case SERIAL_CEC_COMMAND_ACCEPTED:
+	case SERIAL_CEC_COMMAND_REJECTED:
+		if (priv->pending_count == 0) {
+			ceci_dbg(HANDLE_CTX(handle), "ignoring unsolicited acknowledgement");
+			break;
+		}
+		/* the adapter echoes the command code, which tells stale acknowledgements apart */
+		if ((len >= 2) && (msg[1] != priv->pending[priv->pending_head])) {
+			ceci_dbg(HANDLE_CTX(handle), "ignoring acknowledgement of command %d, expected %d",
+				msg[1], priv->pending[priv->pending_head]);
+			break;
+		}
+		if (code == SERIAL_CEC_COMMAND_REJECTED) {
+			ceci_dbg(HANDLE_CTX(handle), "adapter rejected command %d", priv->pending[priv->pending_head]);
+			priv->rejected++;
+		}
+		priv->pending_head = (priv->pending_head + 1) % SERIAL_CEC_MAX_PENDING;
+		if (--priv->pending_count == 0) {
+			pthread_cond_broadcast(&priv->cond);
+		}
+		break;
+	case SERIAL_CEC_TRANSMIT_SUCCEEDED:
+	case SERIAL_CEC_TRANSMIT_FAILED_LINE:
+	case SERIAL_CEC_TRANSMIT_FAILED_ACK:
+	case SERIAL_CEC_TRANSMIT_FAILED_TIMEOUT_DATA:
+	case SERIAL_CEC_TRANSMIT_FAILED_TIMEOUT_LINE:
+		priv->tx_result = code;
+		pthread_cond_broadcast(&priv->cond);
+		break;
+	case SERIAL_CEC_FIRMWARE_VERSION:
+		priv->reply_code = code;
+		priv->reply_len = len - 1;
+		memcpy(priv->reply, &msg[1], len - 1);
+		break;
+	default:
+		ceci_dbg(HANDLE_CTX(handle), "ignoring adapter message %d", code);
+		break;
+	}
+}
+
+/*
+ * Run a chunk of adapter data through the parser, which keeps its state
+ * across chunks, as messages may straddle reads. Bytes outside of a
+ * message are skipped, and a start marker always begins a new message,
+ * so that the parser resynchronizes after a line error or an overflow.
+ * Must be called with the lock held.
+ */
+static void serial_cec_parse(libcec_device_handle* handle, const uint8_t* data, size_t length, uint64_t timestamp)
+{
+	serial_cec_device_handle_priv* priv = __device_handle_priv(handle);
+	const uint8_t *p = data, *end = data + length;
+	uint8_t b;
+
+	while (p < end) {
+		b = *p++;
+		if (b == SERIAL_CEC_MSGSTART) {
+			if (priv->in_msg && (priv->msg_len != 0)) {
+				priv->parse_errors++;
+			}
+			priv->in_msg = 1;
+			priv->msg_len = 0;
+			priv->escaped = 0;
+			continue;
+		}
+		if (!priv->in_msg) {
+			priv->parse_errors++;
+			continue;
+		}
+		if (b == SERIAL_CEC_MSGEND) {
+			if (priv->msg_len != 0) {
+				serial_cec_dispatch(handle, priv->msg, priv->msg_len, timestamp);
+			}
+			priv->in_msg = 0;
+			continue;
+		}
+		if (b == SERIAL_CEC_MSGESC) {
+			priv->escaped = 1;
+			continue;
+		}
+		if (priv->escaped) {
+			b += SERIAL_CEC_ESCOFFSET;
+			priv->escaped = 0;
+		}
+		if (priv->msg_len >= SERIAL_CEC_MSG_SIZE) {
+			priv->parse_errors++;
+			priv->in_msg = 0;
+			continue;
+		}
+		priv->msg[priv->msg_len++] = b;
+	}
+}
+
+static void* serial_cec_io_thread(void* arg)
+{
+	libcec_device_handle* handle = (libcec_device_handle*)arg;
+	serial_cec_device_handle_priv* priv = __device_handle_priv(handle);
+	uint8_t chunk[SERIAL_CEC_CHUNK_SIZE];
+	struct pollfd fds[2];
+	ssize_t n;
+	int r;
+
+	fds[0].fd = priv->fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = priv->wake_fd;
+	fds[1].events = POLLIN;
+	while (1) {
+		r = poll(fds, 2, -1);
+		if (r < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if (fds[1].revents & POLLIN) {
+			return NULL;
+		}
+		if (fds[0].revents & POLLIN) {
+			n = read(priv->fd, chunk, sizeof(chunk));
+			if (n > 0) {
+				pthread_mutex_lock(&priv->lock);
+				serial_cec_parse(handle, chunk, (size_t)n, serial_cec_now());
+				pthread_mutex_unlock(&priv->lock);
+				continue;
+			}
+			if ((n < 0) && ((errno == EAGAIN) || (errno == EINTR))) {
+				continue;
+			}
+			break;
+		}
+		if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			break;
+		}
+	}
+
+	ceci_error(HANDLE_CTX(handle), "serial CEC adapter was disconnected");
+	pthread_mutex_lock(&priv->lock);
+	priv->disconnected = 1;
+	serial_cec_signal(priv->poll_fd);
+	pthread_cond_broadcast(&priv->cond);
+	pthread_mutex_unlock(&priv->lock);
+	return NULL;
+}
+
+/* Escape and frame a command into buffer, which must have room for 2 + 2*(1+len) bytes */
+static size_t serial_cec_encode(const serial_cec_command* command, uint8_t* buffer)
+{
+	uint8_t b;
+	size_t n = 0;
+	int i;
+
+	buffer[n++] = SERIAL_CEC_MSGSTART;
+	for (i=-1; i<(int)command->len; i++) {
+		b = (i < 0) ? command->code : command->param[i];
+		if (b >= SERIAL_CEC_MSGESC) {
+			buffer[n++] = SERIAL_CEC_MSGESC;
+			b -= SERIAL_CEC_ESCOFFSET;
+		}
+		buffer[n++] = b;
+	}
+	buffer[n++] = SERIAL_CEC_MSGEND;
+	return n;
+}
+
+static int serial_cec_write_all(int fd, const uint8_t* buffer, size_t length)
+{
+	struct pollfd pfd;
+	ssize_t n;
+
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+	while (length > 0) {
+		n = write(fd, buffer, length);
+		if (n > 0) {
+			buffer += n;
+			length -= (size_t)n;
+			continue;
+		}
+		if ((n < 0) && (errno == EINTR)) {
+			continue;
+		}
+		if ((n < 0) && (errno == EAGAIN)) {
+			if (poll(&pfd, 1, SERIAL_CEC_ACK_TIMEOUT) <= 0) {
+				return LIBCEC_ERROR_TIMEOUT;
+			}
+			continue;
+		}
+		return LIBCEC_ERROR_IO;
+	}
+	return LIBCEC_SUCCESS;
+}
+
+/*
+ * Send a batch of commands with a single write, and wait until the adapter
+ * has acknowledged all of them. Must be called with tx_lock held.
+ */
+static int serial_cec_send_commands(libcec_device_handle* handle, const serial_cec_command* commands, unsigned int nb_commands)
+{
+	serial_cec_device_handle_priv* priv = __device_handle_priv(handle);
+	uint8_t buffer[(LIBCEC_MAX_FRAME_SIZE+2) * 8];
+	struct timespec deadline;
+	size_t length = 0;
+	unsigned int i;
+	int r = 0;
+
+	if (nb_commands > MIN(SERIAL_CEC_MAX_PENDING, LIBCEC_MAX_FRAME_SIZE+2)) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	for (i=0; i<nb_commands; i++) {
+		length += serial_cec_encode(&commands[i], &buffer[length]);
+	}
+
+	pthread_mutex_lock(&priv->lock);
+	if (priv->disconnected) {
+		pthread_mutex_unlock(&priv->lock);
+		return LIBCEC_ERROR_NO_DEVICE;
+	}
+	/* whatever a timed out batch left behind is stale now */
+	priv->pending_head = 0;
+	priv->pending_count = nb_commands;
+	for (i=0; i<nb_commands; i++) {
+		priv->pending[i] = commands[i].code;
+	}
+	priv->rejected = 0;
+	priv->tx_result = -1;
+	priv->reply_code = SERIAL_CEC_NOTHING;
+	pthread_mutex_unlock(&priv->lock);
+
+	r = serial_cec_write_all(priv->fd, buffer, length);
+	if (r != LIBCEC_SUCCESS) {
+		ceci_error(HANDLE_CTX(handle), "failed to write to serial CEC adapter - errno: %d", errno);
+		pthread_mutex_lock(&priv->lock);
+		priv->pending_count = 0;
+		pthread_mutex_unlock(&priv->lock);
+		return r;
+	}
+
+	serial_cec_deadline(&deadline, SERIAL_CEC_ACK_TIMEOUT);
+	pthread_mutex_lock(&priv->lock);
+	while ((priv->pending_count != 0) && !priv->disconnected && (r != ETIMEDOUT)) {
+		r = pthread_cond_timedwait(&priv->cond, &priv->lock, &deadline);
+	}
+	if (priv->disconnected) {
+		r = LIBCEC_ERROR_NO_DEVICE;
+	} else if (priv->pending_count != 0) {
+		ceci_warn(HANDLE_CTX(handle), "adapter did not acknowledge %d of %d commands", priv->pending_count, nb_commands);
+		priv->pending_count = 0;
+		r = LIBCEC_ERROR_TIMEOUT;
+	} else {
+		r = (priv->rejected != 0) ? LIBCEC_ERROR_IO : LIBCEC_SUCCESS;
+	}
+	pthread_mutex_unlock(&priv->lock);
+	return r;
+}
+
+static int serial_cec_send_command(libcec_device_handle* handle, uint8_t code, const uint8_t* param, uint8_t len)
+{
+	serial_cec_device_handle_priv* priv = __device_handle_priv(handle);
+	serial_cec_command command;
+	int r;
+
+	command.code = code;
+	command.len = len;
+	if (len != 0) {
+		memcpy(command.param, param, len);
+	}
+	pthread_mutex_lock(&priv->tx_lock);
+	r = serial_cec_send_commands(handle, &command, 1);
+	pthread_mutex_unlock(&priv->tx_lock);
+	return r;
+}
+
+static int serial_cec_configure_tty(int fd, speed_t speed)
+{
+	struct termios tio;
+
+	if (tcgetattr(fd, &tio) != 0) {
+		return -1;
+	}
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cflag &= ~CRTSCTS;
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+		return -1;
+	}
+	return tcflush(fd, TCIOFLUSH);
+}
+
+int serial_cec_close(libcec_device_handle* handle)
+{
+	serial_cec_device_handle_priv* priv = __device_handle_priv(handle);
+
+	if (priv->running) {
+		serial_cec_signal(priv->wake_fd);
+		pthread_join(priv->thread, NULL);
+		priv->running = 0;
+	}
+	if (priv->parse_errors != 0) {
+		ceci_dbg(HANDLE_CTX(handle), "%d framing errors on the serial link", priv->parse_errors);
+	}
+	if (priv->rx_dropped != 0) {
+		ceci_warn(HANDLE_CTX(handle), "%d received messages were dropped", priv->rx_dropped);
+	}
+	pthread_cond_destroy(&priv->cond);
+	pthread_mutex_destroy(&priv->tx_lock);
+	pthread_mutex_destroy(&priv->lock);
+	close(priv->poll_fd);
+	close(priv->wake_fd);
+	close(priv->fd);
+	return LIBCEC_SUCCESS;
+}
+
+int serial_cec_open(char* device_name, libcec_device_handle* handle)
+{
+	serial_cec_device_handle_priv* priv = __device_handle_priv(handle);
+	pthread_condattr_t attr;
+	char options[256], *path;
+	speed_t speed;
+	int r;
+
+	priv->fd = -1;
+	priv->wake_fd = -1;
+	priv->poll_fd = -1;
+	priv->physical_address = 0xFFFF;
+	priv->tx_result = -1;
+	strncpy(options, device_name, sizeof(options)-1);
+	options[sizeof(options)-1] = 0;
+	r = serial_cec_parse_options(handle, options, &path, &speed);
+	if (r != LIBCEC_SUCCESS) {
+		return r;
+	}
+
+	priv->fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (priv->fd < 0) {
+		ceci_error(HANDLE_CTX(handle), "cannot open serial device '%s' - errno: %d", path, errno);
+		return (errno == ENOENT) ? LIBCEC_ERROR_NOT_FOUND
+			: ((errno == EACCES) ? LIBCEC_ERROR_ACCESS : LIBCEC_ERROR_NO_DEVICE);
+	}
+	if (serial_cec_configure_tty(priv->fd, speed) != 0) {
+		ceci_error(HANDLE_CTX(handle), "cannot configure serial device '%s' - errno: %d", path, errno);
+		r = LIBCEC_ERROR_IO;
+		goto err_fds;
+	}
+	priv->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	priv->poll_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if ((priv->wake_fd < 0) || (priv->poll_fd < 0)) {
+		ceci_error(HANDLE_CTX(handle), "could not create eventfd - errno: %d", errno);
+		r = LIBCEC_ERROR_RESOURCE;
+		goto err_fds;
+	}
+
+	pthread_mutex_init(&priv->lock, NULL);
+	pthread_mutex_init(&priv->tx_lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&priv->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	if (pthread_create(&priv->thread, NULL, serial_cec_io_thread, handle) != 0) {
+		ceci_error(HANDLE_CTX(handle), "could not start serial I/O thread");
+		r = LIBCEC_ERROR_RESOURCE;
+		goto err_sync;
+	}
+	priv->running = 1;
+
+	/* make sure there is an adapter at the other end, and that it speaks our protocol */
+	r = serial_cec_send_command(handle, SERIAL_CEC_PING, NULL, 0);
+	if (r != LIBCEC_SUCCESS) {
+		ceci_error(HANDLE_CTX(handle), "no answer from serial CEC adapter on '%s'", path);
+		r = LIBCEC_ERROR_NO_DEVICE;
+		goto err_thread;
+	}
+	if ( (serial_cec_send_command(handle, SERIAL_CEC_FIRMWARE_VERSION, NULL, 0) == LIBCEC_SUCCESS)
+	  && (priv->reply_code == SERIAL_CEC_FIRMWARE_VERSION) && (priv->reply_len >= 2) ) {
+		priv->firmware_version = (priv->reply[0] << 8) | priv->reply[1];
+		ceci_dbg(HANDLE_CTX(handle), "serial CEC adapter firmware version %d", priv->firmware_version);
+	}
+	return LIBCEC_SUCCESS;
+
+	/* undo only what was set up, and leave nothing behind that could be used after */
+err_thread:
+	serial_cec_signal(priv->wake_fd);
+	pthread_join(priv->thread, NULL);
+	priv->running = 0;
+err_sync:
+	pthread_cond_destroy(&priv->cond);
+	pthread_mutex_destroy(&priv->tx_lock);
+	pthread_mutex_destroy(&priv->lock);
+err_fds:
+	if (priv->poll_fd >= 0) {
+		close(priv->poll_fd);
+		priv->poll_fd = -1;
+	}
+	if (priv->wake_fd >= 0) {
+		close(priv->wake_fd);
+		priv->wake_fd = -1;
+	}
+	close(priv->fd);
+	priv->fd = -1;
+	return r;
+}
+
+int serial_cec_set_logical_address(libcec_device_handle* handle, uint8_t logical_address)
+{
+	uint16_t mask = (logical_address < 15) ? (1 << logical_address) : 0;
+	uint8_t param[2] = { mask >> 8, mask & 0xFF };
+	int r;
+
+	r = serial_cec_send_command(handle, SERIAL_CEC_SET_ACK_MASK, param, 2);
+	if (r != LIBCEC_SUCCESS) {
+		ceci_error(HANDLE_CTX(handle), "failed to set CEC logical address");
+	}
+	return r;
+}
+
+int serial_cec_read_edid(libcec_device_handle* handle, uint8_t* buffer, size_t length)
+{
+	ceci_dbg(HANDLE_CTX(handle), "the EDID is not accessible through a serial CEC adapter");
+	return LIBCEC_ERROR_NOT_SUPPORTED;
+}
+
+int serial_cec_get_physical_address(libcec_device_handle* handle, uint16_t* physical_address)
+{
+	serial_cec_device_handle_priv* priv = __device_handle_priv(handle);
+
+	if (priv->physical_address == 0xFFFF) {
+		ceci_error(HANDLE_CTX(handle), "physical address unknown - use the 'pa=' device option");
+		return LIBCEC_ERROR_NOT_FOUND;
+	}
+	*physical_address = priv->physical_address;
+	return LIBCEC_SUCCESS;
+}
+
+int serial_cec_read_message(libcec_device_handle* handle, uint8_t* buffer, size_t length, int32_t timeout, uint64_t* timestamp)
+{
+	serial_cec_device_handle_priv* priv = __device_handle_priv(handle);
+	serial_cec_frame* frame;
+	struct timespec deadline;
+	int r = 0;
+
+	if (timeout > 0) {
+		serial_cec_deadline(&deadline, timeout);
+	}
+	pthread_mutex_lock(&priv->lock);
+	while (1) {
+		if (priv->rx_count != 0) {
+			frame = &priv->rx[priv->rx_head];
+			priv->rx_head = (priv->rx_head + 1) % SERIAL_CEC_RX_SLOTS;
+			if ((--priv->rx_count == 0) && !priv->cancelled && !priv->disconnected) {
+				serial_cec_unsignal(priv->poll_fd);
+			}
+			if (frame->length > length) {
+				r = LIBCEC_ERROR_OVERFLOW;
+				break;
+			}
+			memcpy(buffer, frame->data, frame->length);
+			*timestamp = frame->timestamp;
+			r = (int)frame->length;
+			break;
+		}
+		if (priv->cancelled) {
+			r = LIBCEC_ERROR_INTERRUPTED;
+			break;
+		}
+		if (priv->disconnected) {
+			r = LIBCEC_ERROR_NO_DEVICE;
+			break;
+		}
+		if ((timeout == 0) || (r == ETIMEDOUT)) {
+			r = LIBCEC_ERROR_TIMEOUT;
+			break;
+		}
+		if (timeout < 0) {
+			pthread_cond_wait(&priv->cond, &priv->lock);
+		} else {
+			r = pthread_cond_timedwait(&priv->cond, &priv->lock, &deadline);
+		}
+	}
+	pthread_mutex_unlock(&priv->lock);
+	return r;
+}
+
+/*
+ * The frame goes out as one command per byte, which the adapter accepts
+ * one by one, before it reports the outcome of the transmission
+ */
+int serial_cec_write_message(libcec_device_handle* handle, uint8_t* buffer, size_t length, libcec_tx_status* status)
+{
+	serial_cec_device_handle_priv* priv = __device_handle_priv(handle);
+	serial_cec_command commands[LIBCEC_MAX_FRAME_SIZE+1];
+	struct timespec deadline;
+	unsigned int i;
+	int r;
+
+	if ((length == 0) || (length > LIBCEC_MAX_FRAME_SIZE)) {
+		return LIBCEC_ERROR_INVALID_PARAM;
+	}
+	/* broadcasts are acknowledged by the absence of a NACK */
+	commands[0].code = SERIAL_CEC_TRANSMIT_ACK_POLARITY;
+	commands[0].len = 1;
+	commands[0].param[0] = ((buffer[0] & 0x0F) == 0x0F) ? 1 : 0;
+	for (i=0; i<length; i++) {
+		commands[i+1].code = (i == length-1) ? SERIAL_CEC_TRANSMIT_EOM : SERIAL_CEC_TRANSMIT;
+		commands[i+1].len = 1;
+		commands[i+1].param[0] = buffer[i];
+	}
+
+	pthread_mutex_lock(&priv->tx_lock);
+	r = serial_cec_send_commands(handle, commands, (unsigned int)length+1);
+	if (r != LIBCEC_SUCCESS) {
+		pthread_mutex_unlock(&priv->tx_lock);
+		status->result = (r == LIBCEC_ERROR_TIMEOUT) ? LIBCEC_TX_TIMEOUT : LIBCEC_TX_ERROR;
+		return r;
+	}
+	serial_cec_deadline(&deadline, SERIAL_CEC_TX_TIMEOUT);
+	pthread_mutex_lock(&priv->lock);
+	while ((priv->tx_result < 0) && !priv->disconnected && (r != ETIMEDOUT)) {
+		r = pthread_cond_timedwait(&priv->cond, &priv->lock, &deadline);
+	}
+	switch (priv->tx_result) {
+	case SERIAL_CEC_TRANSMIT_SUCCEEDED:
+		r = LIBCEC_SUCCESS;
+		break;
+	case SERIAL_CEC_TRANSMIT_FAILED_ACK:
+		status->result = LIBCEC_TX_NACK;
+		r = LIBCEC_ERROR_IO;
+		break;
+	case SERIAL_CEC_TRANSMIT_FAILED_LINE:
+		status->result = LIBCEC_TX_ARB_LOST;
+		r = LIBCEC_ERROR_BUSY;
+		break;
+	case SERIAL_CEC_TRANSMIT_FAILED_TIMEOUT_DATA:
+	case SERIAL_CEC_TRANSMIT_FAILED_TIMEOUT_LINE:
+		status->result = LIBCEC_TX_TIMEOUT;
+		r = LIBCEC_ERROR_TIMEOUT;
+		break;
+	default:
+		if (priv->disconnected) {
+			status->result = LIBCEC_TX_ERROR;
+			r = LIBCEC_ERROR_NO_DEVICE;
+		} else {
+			ceci_warn(HANDLE_CTX(handle), "adapter did not report the outcome of the transmission");
+			status->result = LIBCEC_TX_TIMEOUT;
+			r = LIBCEC_ERROR_TIMEOUT;
+		}
+		break;
+	}
+	pthread_mutex_unlock(&priv->lock);
+	pthread_mutex_unlock(&priv->tx_lock);
+	return r;
+}
+
+int serial_cec_get_pollfd(libcec_device_handle* handle)
+{
+	return __device_handle_priv(handle)->poll_fd;
+}
+
+int serial_cec_cancel(libcec_device_handle* handle)
+{
+	serial_cec_device_handle_priv* priv = __device_handle_priv(handle);
+
+	pthread_mutex_lock(&priv->lock);
+	priv->cancelled = 1;
+	serial_cec_signal(priv->poll_fd);
+	pthread_cond_broadcast(&priv->cond);
+	pthread_mutex_unlock(&priv->lock);
+	return LIBCEC_SUCCESS;
+}
+
+const _ceci_backend serial_cec_backend = {
+	"USB-serial CEC adapter",
+	"serial",
+	serial_cec_init,
+	serial_cec_exit,
+	serial_cec_open,
+	serial_cec_close,
+	serial_cec_set_logical_address,
+	serial_cec_read_edid,
+	NULL,
+	serial_cec_read_message,
+	serial_cec_write_message,
+	serial_cec_get_pollfd,
+	serial_cec_cancel,
+	NULL,
+	serial_cec_get_physical_address,
+	NULL,
+
+	sizeof(serial_cec_device_handle_priv),
+};
@@ -0,0 +1,130 @@
+/*
+ * libcec - USB-serial CEC adapter functions
+ *
+ * Copyright (c) 2010-2011 Pete Batard <pete@akeo.ie>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+
+#define SERIAL_CEC_DEFAULT_DEV	"/dev/ttyACM0"
+#define SERIAL_CEC_BAUDRATE		38400
+
+/*
+ * Adapter protocol, as used by the Pulse-Eight USB-CEC family of dongles.
+ * Each message is framed as MSGSTART <code> [<param>...] MSGEND, where any
+ * byte of the code or parameters that is MSGESC or above is sent as MSGESC
+ * followed by the byte minus SERIAL_CEC_ESCOFFSET. The code byte holds the
+ * message code in its low 6 bits, and for received CEC data, whether the
+ * byte was ACKed and whether it was the last one of the frame.
+ */
+#define SERIAL_CEC_MSGSTART		0xFF
+#define SERIAL_CEC_MSGEND		0xFE
+#define SERIAL_CEC_MSGESC		0xFD
+#define SERIAL_CEC_ESCOFFSET	3
+#define SERIAL_CEC_CODE_MASK	0x3F
+#define SERIAL_CEC_FRAME_ACK	0x40
+#define SERIAL_CEC_FRAME_EOM	0x80
+#define SERIAL_CEC_MSG_SIZE		32		/* longest message we accept, unescaped */
+
+enum serial_cec_code {
+	SERIAL_CEC_NOTHING = 0,
+	SERIAL_CEC_PING,
+	SERIAL_CEC_TIMEOUT_ERROR,
+	SERIAL_CEC_HIGH_ERROR,
+	SERIAL_CEC_LOW_ERROR,
+	SERIAL_CEC_FRAME_START,
+	SERIAL_CEC_FRAME_DATA,
+	SERIAL_CEC_RECEIVE_FAILED,
+	SERIAL_CEC_COMMAND_ACCEPTED,
+	SERIAL_CEC_COMMAND_REJECTED,
+	SERIAL_CEC_SET_ACK_MASK,
+	SERIAL_CEC_TRANSMIT,
+	SERIAL_CEC_TRANSMIT_EOM,
+	SERIAL_CEC_TRANSMIT_IDLETIME,
+	SERIAL_CEC_TRANSMIT_ACK_POLARITY,
+	SERIAL_CEC_TRANSMIT_LINE_TIMEOUT,
+	SERIAL_CEC_TRANSMIT_SUCCEEDED,
+	SERIAL_CEC_TRANSMIT_FAILED_LINE,
+	SERIAL_CEC_TRANSMIT_FAILED_ACK,
+	SERIAL_CEC_TRANSMIT_FAILED_TIMEOUT_DATA,
+	SERIAL_CEC_TRANSMIT_FAILED_TIMEOUT_LINE,
+	SERIAL_CEC_FIRMWARE_VERSION,
+};
+
+/* Received frames waiting to be read */
+#define SERIAL_CEC_RX_SLOTS		32
+/* Commands that may be awaiting their acknowledgement at once */
+#define SERIAL_CEC_MAX_PENDING	64
+/* How long the adapter may take to acknowledge a command, in ms */
+#define SERIAL_CEC_ACK_TIMEOUT	1000
+/* How long a transmission may take, retries included, in ms */
+#define SERIAL_CEC_TX_TIMEOUT	3000
+
+typedef struct {
+	uint8_t		data[LIBCEC_MAX_FRAME_SIZE];
+	uint8_t		length;
+	uint64_t	timestamp;
+} serial_cec_frame;
+
+/*
+ * An I/O thread reads whatever the adapter sent in large chunks and runs
+ * them through an incremental parser. Received CEC frames are queued for
+ * read_message, while acknowledgements are matched in order against the
+ * commands that are pending, so that a whole frame's worth of commands
+ * can be written at once rather than one round trip per byte.
+ */
+typedef struct {
+	int				fd;
+	int				wake_fd;		/* eventfd, stops the I/O thread */
+	int				poll_fd;		/* eventfd, readable while frames are queued */
+	pthread_t		thread;
+	int				running;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	pthread_mutex_t	tx_lock;		/* one command batch at a time */
+	int				cancelled;
+	int				disconnected;
+	uint16_t		firmware_version;
+	uint16_t		physical_address;	/* from the options, the adapter has no EDID access */
+
+	/* parser, only used by the I/O thread */
+	uint8_t			msg[SERIAL_CEC_MSG_SIZE];
+	unsigned int	msg_len;
+	int				in_msg;
+	int				escaped;
+	serial_cec_frame	partial;
+	unsigned int	parse_errors;
+
+	/* commands awaiting their acknowledgement, oldest first */
+	uint8_t			pending[SERIAL_CEC_MAX_PENDING];
+	unsigned int	pending_head;
+	unsigned int	pending_count;
+	unsigned int	rejected;
+	int				tx_result;		/* result code of the last transmission, or -1 */
+	uint8_t			reply[SERIAL_CEC_MSG_SIZE];	/* last answer to a query */
+	unsigned int	reply_len;
+	uint8_t			reply_code;
+
+	serial_cec_frame	rx[SERIAL_CEC_RX_SLOTS];
+	unsigned int	rx_head;
+	unsigned int	rx_count;
+	unsigned int	rx_dropped;
+} serial_cec_device_handle_priv;
+
+static inline serial_cec_device_handle_priv* __device_handle_priv(libcec_device_handle *handle)
+{
+	return (serial_cec_device_handle_priv*) handle->priv;
+}
@@ -0,0 +1,109 @@
+/*
+ * libcec - backend statistics
+ *
+ * Copyright (c) 2010-2011 Pete Batard <pete@akeo.ie>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "libceci.h"
+
+/* Current CLOCK_MONOTONIC time in us, to pass to ceci_stats_record() */
+uint64_t ceci_stats_start(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+/* log2 bucket of a duration in us */
+static unsigned int ceci_stats_bucket(uint64_t time)
+{
+	unsigned int i = 0;
+
+	while ((time >>= 1) != 0) {
+		i++;
+	}
+	return MIN(i, LIBCEC_STATS_BUCKETS - 1);
+}
+
+/*
+ * Record the outcome of a backend call that started at 'start', and
+ * returned r. For reads, timeouts and interruptions are the normal way
+ * for a call to end when nothing was received, so they are not errors.
+ */
+void ceci_stats_record(libcec_device_handle* handle, enum libcec_stats_op op, uint64_t start, int r)
+{
+	libcec_op_stats* stats = &handle->stats.ops[op];
+	uint64_t time, max;
+
+	time = ceci_stats_start() - start;
+	ceci_atomic_add(&stats->calls, 1);
+	if ( (op == LIBCEC_STATS_READ_MESSAGE)
+	  && ((r == LIBCEC_ERROR_TIMEOUT) || (r == LIBCEC_ERROR_INTERRUPTED)) ) {
+		ceci_atomic_add(&stats->timeouts, 1);
+		return;
+	}
+	if (r < 0) {
+		ceci_atomic_add(&stats->errors, 1);
+	}
+	ceci_atomic_add(&stats->total_time, time);
+	ceci_atomic_add(&stats->histogram[ceci_stats_bucket(time)], 1);
+	max = ceci_atomic_load(&stats->max_time);
+	while ( (time > max) && !__atomic_compare_exchange_n(&stats->max_time, &max, time,
+		1, __ATOMIC_RELAXED, __ATOMIC_RELAXED) );
+}
+
+/* Count a frame the driver delivered, or that was transmitted successfully */
+void ceci_stats_frame(libcec_device_handle* handle, int out, size_t length)
+{
+	if (out) {
+		ceci_atomic_add(&handle->stats.frames_out, 1);
+		ceci_atomic_add(&handle->stats.bytes_out, length);
+	} else {
+		ceci_atomic_add(&handle->stats.frames_in, 1);
+		ceci_atomic_add(&handle->stats.bytes_in, length);
+	}
+}
+
+/*
+ * Take a snapshot of the statistics. Each counter is read atomically, but
+ * the snapshot as a whole isn't, so counters of a call that is being
+ * recorded may not all agree.
+ */
+void ceci_stats_get(libcec_device_handle* handle, libcec_stats* stats)
+{
+	libcec_op_stats *src, *dst;
+	unsigned int i, j;
+
+	for (i=0; i<LIBCEC_STATS_OP_COUNT; i++) {
+		src = &handle->stats.ops[i];
+		dst = &stats->ops[i];
+		dst->calls = ceci_atomic_load(&src->calls);
+		dst->errors = ceci_atomic_load(&src->errors);
+		dst->timeouts = ceci_atomic_load(&src->timeouts);
+		dst->total_time = ceci_atomic_load(&src->total_time);
+		dst->max_time = ceci_atomic_load(&src->max_time);
+		for (j=0; j<LIBCEC_STATS_BUCKETS; j++) {
+			dst->histogram[j] = ceci_atomic_load(&src->histogram[j]);
+		}
+	}
+	stats->frames_in = ceci_atomic_load(&handle->stats.frames_in);
+	stats->bytes_in = ceci_atomic_load(&handle->stats.bytes_in);
+	stats->frames_out = ceci_atomic_load(&handle->stats.frames_out);
+	stats->bytes_out = ceci_atomic_load(&handle->stats.bytes_out);
+}
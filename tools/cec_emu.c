@@ -0,0 +1,651 @@
+/*
+ * cec_emu - userspace stand-in for an adapter of the Linux CEC framework
+ *
+ * Copyright (c) 2010-2011 Pete Batard <pete@akeo.ie>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This module is meant to be LD_PRELOADed into a program using the "cec:"
+ * backend, on a machine that has no CEC adapter. It intercepts open(), close()
+ * and ioctl() on the CEC device node, and answers the CEC_ADAP_G_CAPS,
+ * CEC_ADAP_G_PHYS_ADDR, CEC_ADAP_S_PHYS_ADDR, CEC_ADAP_G_LOG_ADDRS,
+ * CEC_ADAP_S_LOG_ADDRS, CEC_G_MODE, CEC_S_MODE, CEC_TRANSMIT, CEC_RECEIVE
+ * and CEC_DQEVENT requests the way the framework does, so that the production
+ * backend code runs unmodified. For instance:
+ *   CEC_EMU="nack=5,arb=10" LD_PRELOAD=cec_emu.so cecd -d cec:/dev/cec0
+ * Each open() gets a file handle of its own, with its own mode, and a
+ * descriptor that polls readable when CEC_RECEIVE has a message for it.
+ * Followers get all the messages for us, as with CEC_MODE_EXCL_FOLLOWER_PASSTHRU,
+ * transmissions always block, and no event is ever raised.
+ * The CEC_EMU environment variable is a comma separated list of options:
+ *   dev=<path>            CEC device node to emulate (default /dev/cec0)
+ *   devices=<hex digits>  logical addresses of the simulated devices (default "045")
+ *   pa=<a.b.c.d>          our physical address (default 1.0.0.0)
+ *   set_pa=<0|1>          the physical address is set from userspace, with
+ *                         CEC_ADAP_S_PHYS_ADDR, rather than known to the adapter (default 0)
+ *   busy=<0|1>            another process is the exclusive follower (default 0)
+ *   nack=<percent>        probability of a directed frame not being ACKed, per attempt
+ *   arb=<percent>         probability of losing arbitration, per attempt
+ *   retries=<n>           retransmissions after a failed attempt (default 2)
+ *   latency=<ms>          delay added to our transmissions and to device replies
+ *   wire=<0|1>            simulate the nominal CEC bit timings (default 0)
+ *   traffic=<n>           frames per second of background traffic from the devices
+ *   seed=<n>              seed for the fault injection generator (default 1)
+ *   log=<0|1>             trace the intercepted requests on stderr (default 0)
+ */
+
+#define _GNU_SOURCE
+#undef _FORTIFY_SOURCE		/* we provide our own open() */
+#include <config.h>
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <linux/cec.h>
+
+#include "libceci.h"
+#include "emu_bus.h"
+
+#define EMU_MAX_FH				8
+#define EMU_QUEUE_SIZE			32
+#define EMU_PATH_SIZE			128
+
+/* A file handle on the device, and the messages delivered to it */
+typedef struct {
+	int				fd;			/* timerfd handed out as the descriptor, -1 if unused */
+	int				nonblock;
+	uint32_t		mode;
+	emu_frame		rx[EMU_QUEUE_SIZE];
+	unsigned int	rx_head;
+	unsigned int	rx_count;
+} emu_fh;
+
+static struct {
+	pthread_once_t	once;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	int (*real_open)(const char*, int, ...);
+	int (*real_close)(int);
+	int (*real_ioctl)(int, unsigned long, ...);
+
+	emu_bus			bus;
+
+	/* options */
+	char			path[EMU_PATH_SIZE];
+	int				set_pa;
+	int				busy;
+	unsigned int	retries;
+
+	/* state */
+	emu_fh			fh[EMU_MAX_FH];
+	unsigned int	nb_fh;
+	struct cec_log_addrs	log_addrs;	/* no logical address while num_log_addrs is 0 */
+} emu = { PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER };
+
+/* The options of the driver, the ones of the bus being parsed by emu_bus_parse_options() */
+static int emu_option(const char* token, const char* value)
+{
+	if (strcmp(token, "dev") == 0) {
+		snprintf(emu.path, sizeof(emu.path), "%s", value);
+	} else if (strcmp(token, "set_pa") == 0) {
+		emu.set_pa = atoi(value);
+	} else if (strcmp(token, "busy") == 0) {
+		emu.busy = atoi(value);
+	} else if (strcmp(token, "retries") == 0) {
+		emu.retries = atoi(value);
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+static void emu_init(void)
+{
+	pthread_condattr_t attr;
+	int i;
+
+	emu.real_open = dlsym(RTLD_NEXT, "open");
+	emu.real_close = dlsym(RTLD_NEXT, "close");
+	emu.real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&emu.cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	emu_bus_init(&emu.bus, "cec_emu");
+	snprintf(emu.path, sizeof(emu.path), "/dev/cec0");
+	emu.retries = 2;
+	for (i=0; i<EMU_MAX_FH; i++) {
+		emu.fh[i].fd = -1;
+	}
+	emu_bus_parse_options(&emu.bus, getenv("CEC_EMU"), emu_option);
+	if (emu.set_pa) {
+		emu.bus.physical_address = CEC_PHYS_ADDR_INVALID;
+	}
+}
+
+/* Looks up a handle by descriptor, or a free one for -1. Must be called with the lock held */
+static emu_fh* emu_find_fh(int fd)
+{
+	int i;
+
+	for (i=0; i<EMU_MAX_FH; i++) {
+		if (emu.fh[i].fd == fd) {
+			return &emu.fh[i];
+		}
+	}
+	return NULL;
+}
+
+/* Whether a file handle gets a message, given its follower mode. Must be called with the lock held */
+static int emu_fh_wants(emu_fh* fh, const emu_frame* frame, int transmitted)
+{
+	uint8_t dst = frame->buf[0] & 0x0F;
+
+	switch (fh->mode & CEC_MODE_FOLLOWER_MSK) {
+	case CEC_MODE_NO_FOLLOWER:
+		return 0;
+	case CEC_MODE_MONITOR_ALL:
+		return 1;
+	case CEC_MODE_MONITOR:
+		return transmitted || (dst == 0x0F) || (dst == emu.bus.logical_address);
+	default:
+		return !transmitted && (emu.log_addrs.num_log_addrs != 0)
+			&& ((dst == 0x0F) || (dst == emu.bus.logical_address));
+	}
+}
+
+/* Must be called with the lock held */
+static void emu_deliver(const emu_frame* frame, int transmitted)
+{
+	emu_fh* fh;
+	int i;
+
+	for (i=0; i<EMU_MAX_FH; i++) {
+		fh = &emu.fh[i];
+		if ((fh->fd < 0) || !emu_fh_wants(fh, frame, transmitted)) {
+			continue;
+		}
+		/* like the framework, drop the oldest message when the handle doesn't keep up */
+		if (fh->rx_count >= EMU_QUEUE_SIZE) {
+			fh->rx_head = (fh->rx_head + 1) % EMU_QUEUE_SIZE;
+			fh->rx_count--;
+			emu_bus_log(&emu.bus, "fd %d: dropping message, queue full", fh->fd);
+		}
+		fh->rx[(fh->rx_head + fh->rx_count) % EMU_QUEUE_SIZE] = *frame;
+		fh->rx_count++;
+	}
+	pthread_cond_broadcast(&emu.cond);
+}
+
+/* Deliver the device replies and the background traffic that are due. Must be called with the lock held */
+static void emu_pump(uint64_t now)
+{
+	emu_frame frame;
+
+	while ((emu.bus.queued != 0) && (emu.bus.queue[0].due <= now)) {
+		emu_bus_queue_pop(&emu.bus, &frame);
+		emu_deliver(&frame, 0);
+	}
+	while ((emu.bus.traffic != 0) && (emu.bus.next_traffic <= now)) {
+		emu_bus_traffic_frame(&emu.bus, &frame);
+		if (frame.len != 0) {
+			emu_deliver(&frame, 0);
+		}
+	}
+}
+
+/* Time of the next frame to deliver, or UINT64_MAX if there is none. Must be called with the lock held */
+static uint64_t emu_next_due(void)
+{
+	uint64_t due = UINT64_MAX;
+
+	if (emu.bus.queued != 0) {
+		due = emu.bus.queue[0].due;
+	}
+	if ((emu.bus.traffic != 0) && (emu.bus.next_traffic < due)) {
+		due = emu.bus.next_traffic;
+	}
+	return due;
+}
+
+/*
+ * Have the descriptor of every receiving file handle poll readable when it
+ * has a message, or when the next one could be due, which is when it will
+ * pick it up. Must be called with the lock held.
+ */
+static void emu_arm(void)
+{
+	struct itimerspec its;
+	uint64_t due, next_due;
+	emu_fh* fh;
+	int i;
+
+	next_due = emu_next_due();
+	for (i=0; i<EMU_MAX_FH; i++) {
+		fh = &emu.fh[i];
+		if (fh->fd < 0) {
+			continue;
+		}
+		memset(&its, 0, sizeof(its));
+		due = (fh->rx_count != 0) ? 1 : next_due;
+		if ((fh->mode & CEC_MODE_FOLLOWER_MSK) == CEC_MODE_NO_FOLLOWER) {
+			due = UINT64_MAX;
+		}
+		/* a time in the past fires at once, and a zero one disarms */
+		if (due != UINT64_MAX) {
+			its.it_value.tv_sec = due / 1000000;
+			its.it_value.tv_nsec = (due % 1000000) * 1000;
+		}
+		timerfd_settime(fh->fd, TFD_TIMER_ABSTIME, &its, NULL);
+	}
+}
+
+static int emu_set_mode(emu_fh* fh, uint32_t mode)
+{
+	uint32_t initiator = mode & CEC_MODE_INITIATOR_MSK, follower = mode & CEC_MODE_FOLLOWER_MSK;
+	int i;
+
+	if ( (mode & ~(CEC_MODE_INITIATOR_MSK | CEC_MODE_FOLLOWER_MSK)) || (initiator > CEC_MODE_EXCL_INITIATOR)
+	  || ((follower > CEC_MODE_EXCL_FOLLOWER_PASSTHRU) && (follower < CEC_MODE_MONITOR))
+	  || ((follower >= CEC_MODE_MONITOR) && (initiator != CEC_MODE_NO_INITIATOR)) ) {
+		errno = EINVAL;
+		return -1;
+	}
+	pthread_mutex_lock(&emu.lock);
+	if ((follower == CEC_MODE_EXCL_FOLLOWER) || (follower == CEC_MODE_EXCL_FOLLOWER_PASSTHRU)) {
+		for (i=0; i<EMU_MAX_FH; i++) {
+			if ( (emu.fh[i].fd >= 0) && (&emu.fh[i] != fh)
+			  && ((emu.fh[i].mode & CEC_MODE_FOLLOWER_MSK) >= CEC_MODE_EXCL_FOLLOWER)
+			  && ((emu.fh[i].mode & CEC_MODE_FOLLOWER_MSK) <= CEC_MODE_EXCL_FOLLOWER_PASSTHRU) ) {
+				break;
+			}
+		}
+		if (emu.busy || (i < EMU_MAX_FH)) {
+			pthread_mutex_unlock(&emu.lock);
+			emu_bus_log(&emu.bus, "fd %d: mode %02X -> %s", fh->fd, mode, strerror(EBUSY));
+			errno = EBUSY;
+			return -1;
+		}
+	}
+	fh->mode = mode;
+	emu_arm();
+	pthread_mutex_unlock(&emu.lock);
+	emu_bus_log(&emu.bus, "fd %d: mode %02X", fh->fd, mode);
+	return 0;
+}
+
+/* Claim the first free address of the requested type, polling the candidates on the bus */
+static int emu_set_log_addrs(emu_fh* fh, struct cec_log_addrs* log_addrs)
+{
+	static const uint8_t candidates[CEC_LOG_ADDR_TYPE_UNREGISTERED+1][5] = {
+		{ 0, 0x0F }, { 1, 2, 9, 0x0F }, { 3, 6, 7, 10, 0x0F }, { 4, 8, 11, 0x0F },
+		{ 5, 0x0F }, { 14, 0x0F }, { 0x0F }
+	};
+	const uint8_t* candidate;
+	uint8_t la = 0x0F;
+	int taken;
+
+	if ((fh->mode & CEC_MODE_INITIATOR_MSK) == CEC_MODE_NO_INITIATOR) {
+		errno = EPERM;
+		return -1;
+	}
+	pthread_mutex_lock(&emu.lock);
+	if (log_addrs->num_log_addrs == 0) {
+		memset(&emu.log_addrs, 0, sizeof(emu.log_addrs));
+		emu.bus.logical_address = 0x0F;
+		*log_addrs = emu.log_addrs;
+		pthread_mutex_unlock(&emu.lock);
+		emu_bus_log(&emu.bus, "fd %d: logical addresses cleared", fh->fd);
+		return 0;
+	}
+	if (emu.log_addrs.num_log_addrs != 0) {
+		pthread_mutex_unlock(&emu.lock);
+		errno = EBUSY;
+		return -1;
+	}
+	pthread_mutex_unlock(&emu.lock);
+	if ((log_addrs->num_log_addrs > 1) || (log_addrs->log_addr_type[0] > CEC_LOG_ADDR_TYPE_UNREGISTERED)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* a poll that loses arbitration is retried, one that is ACKed means the address is taken */
+	for (candidate = candidates[log_addrs->log_addr_type[0]]; *candidate != 0x0F; ) {
+		emu_bus_sleep_us((uint64_t)emu.bus.latency * 1000 + emu_bus_wire_time(&emu.bus, 1));
+		pthread_mutex_lock(&emu.lock);
+		if (emu_bus_chance(&emu.bus, emu.bus.arb)) {
+			pthread_mutex_unlock(&emu.lock);
+			continue;
+		}
+		taken = (emu.bus.devices >> *candidate) & 1;
+		pthread_mutex_unlock(&emu.lock);
+		emu_bus_log(&emu.bus, "fd %d: poll %X -> %s", fh->fd, *candidate, taken ? "taken" : "free");
+		if (!taken) {
+			la = *candidate;
+			break;
+		}
+		candidate++;
+	}
+
+	pthread_mutex_lock(&emu.lock);
+	if ((la == 0x0F) && !(log_addrs->flags & CEC_LOG_ADDRS_FL_ALLOW_UNREG_FALLBACK)) {
+		log_addrs->log_addr[0] = CEC_LOG_ADDR_INVALID;
+		log_addrs->log_addr_mask = 0;
+	} else {
+		log_addrs->log_addr[0] = la;
+		log_addrs->log_addr_mask = 1 << la;
+		emu.log_addrs = *log_addrs;
+		emu.bus.logical_address = la;
+	}
+	emu_arm();
+	pthread_mutex_unlock(&emu.lock);
+	emu_bus_log(&emu.bus, "fd %d: claimed logical address %X", fh->fd, log_addrs->log_addr[0]);
+	return 0;
+}
+
+/* Blocking transmission, whatever the mode of the handle, with the outcome in tx_status */
+static int emu_transmit(emu_fh* fh, struct cec_msg* msg)
+{
+	emu_frame frame;
+	uint8_t src, dst, reply[CEC_MAX_MSG_SIZE];
+	size_t reply_len;
+	unsigned int attempt;
+	int err = 0, acked = 0;
+
+	if ((msg->len == 0) || (msg->len > CEC_MAX_MSG_SIZE)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((fh->mode & CEC_MODE_INITIATOR_MSK) == CEC_MODE_NO_INITIATOR) {
+		errno = EPERM;
+		return -1;
+	}
+	src = msg->msg[0] >> 4;
+	dst = msg->msg[0] & 0x0F;
+	pthread_mutex_lock(&emu.lock);
+	if (emu.log_addrs.num_log_addrs == 0) {
+		/* an unconfigured adapter can only poll the TV */
+		if (msg->msg[0] != 0xF0) {
+			err = ENONET;
+		}
+	} else if ((src != emu.bus.logical_address) || ((dst != 0x0F) && (dst == emu.bus.logical_address))) {
+		err = EINVAL;
+	}
+	pthread_mutex_unlock(&emu.lock);
+	if (err != 0) {
+		emu_bus_log(&emu.bus, "fd %d: send %02X -> %s", fh->fd, msg->msg[0], strerror(err));
+		errno = err;
+		return -1;
+	}
+
+	/* every attempt adds to the status and to the counters, as with the framework */
+	msg->tx_status = 0;
+	msg->tx_arb_lost_cnt = msg->tx_nack_cnt = msg->tx_low_drive_cnt = msg->tx_error_cnt = 0;
+	emu_bus_sleep_us((uint64_t)emu.bus.latency * 1000);
+	for (attempt=0; !acked && (attempt<=emu.retries); attempt++) {
+		pthread_mutex_lock(&emu.lock);
+		if (emu_bus_chance(&emu.bus, emu.bus.arb)) {
+			msg->tx_status |= CEC_TX_STATUS_ARB_LOST;
+			msg->tx_arb_lost_cnt++;
+		} else if (!emu_bus_acked(&emu.bus, dst)) {
+			msg->tx_status |= CEC_TX_STATUS_NACK;
+			msg->tx_nack_cnt++;
+		} else {
+			acked = 1;
+		}
+		pthread_mutex_unlock(&emu.lock);
+		emu_bus_sleep_us(emu_bus_wire_time(&emu.bus, msg->len));
+	}
+	msg->tx_status |= acked ? CEC_TX_STATUS_OK : CEC_TX_STATUS_MAX_RETRIES;
+	msg->tx_ts = emu_bus_now() * 1000;
+	emu_bus_log(&emu.bus, "fd %d: send %02X%s%02X (%d bytes) -> status %02X after %d attempts", fh->fd, msg->msg[0],
+		(msg->len > 1) ? ":" : "", (msg->len > 1) ? msg->msg[1] : 0, msg->len, msg->tx_status, attempt);
+
+	if (acked) {
+		frame.due = msg->tx_ts / 1000;
+		frame.len = (uint8_t)msg->len;
+		memcpy(frame.buf, msg->msg, msg->len);
+		pthread_mutex_lock(&emu.lock);
+		emu_deliver(&frame, 1);
+		reply_len = emu_bus_device_reply(&emu.bus, msg->msg, msg->len, reply);
+		if (reply_len != 0) {
+			emu_bus_queue_push(&emu.bus, reply, reply_len, frame.due + (uint64_t)emu.bus.latency * 1000);
+		}
+		emu_arm();
+		pthread_mutex_unlock(&emu.lock);
+	}
+	return 0;
+}
+
+/* Return the oldest message for the handle, waiting up to msg->timeout ms (0 = forever) if blocking */
+static int emu_receive(emu_fh* fh, struct cec_msg* msg)
+{
+	uint64_t now, due, deadline;
+	struct timespec ts;
+	emu_frame frame;
+	int fd = fh->fd;
+
+	pthread_mutex_lock(&emu.lock);
+	deadline = (msg->timeout == 0) ? UINT64_MAX : emu_bus_now() + (uint64_t)msg->timeout * 1000;
+	while (1) {
+		if (fh->fd != fd) {
+			pthread_mutex_unlock(&emu.lock);
+			errno = EBADF;
+			return -1;
+		}
+		now = emu_bus_now();
+		emu_pump(now);
+		if (fh->rx_count != 0) {
+			break;
+		}
+		if (fh->nonblock || (now >= deadline)) {
+			emu_arm();
+			pthread_mutex_unlock(&emu.lock);
+			errno = fh->nonblock ? EAGAIN : ETIMEDOUT;
+			return -1;
+		}
+		due = MIN(emu_next_due(), deadline);
+		if (due == UINT64_MAX) {
+			pthread_cond_wait(&emu.cond, &emu.lock);
+		} else {
+			ts.tv_sec = due / 1000000;
+			ts.tv_nsec = (due % 1000000) * 1000;
+			pthread_cond_timedwait(&emu.cond, &emu.lock, &ts);
+		}
+	}
+	frame = fh->rx[fh->rx_head];
+	fh->rx_head = (fh->rx_head + 1) % EMU_QUEUE_SIZE;
+	fh->rx_count--;
+	emu_arm();
+	pthread_mutex_unlock(&emu.lock);
+
+	msg->len = frame.len;
+	memcpy(msg->msg, frame.buf, frame.len);
+	msg->rx_ts = frame.due * 1000;
+	msg->rx_status = CEC_RX_STATUS_OK;
+	msg->sequence = 0;
+	msg->tx_status = 0;
+	emu_bus_log(&emu.bus, "fd %d: receive %02X%s%02X (%d bytes)", fd, frame.buf[0], (frame.len > 1) ? ":" : "",
+		(frame.len > 1) ? frame.buf[1] : 0, frame.len);
+	return 0;
+}
+
+static int emu_cec_ioctl(emu_fh* fh, unsigned long request, unsigned long arg)
+{
+	struct cec_caps* caps;
+
+	switch (request) {
+	case CEC_ADAP_G_CAPS:
+		caps = (struct cec_caps*)arg;
+		memset(caps, 0, sizeof(*caps));
+		snprintf(caps->driver, sizeof(caps->driver), "cec_emu");
+		snprintf(caps->name, sizeof(caps->name), "CEC emulator");
+		caps->available_log_addrs = 1;
+		caps->capabilities = CEC_CAP_LOG_ADDRS | CEC_CAP_TRANSMIT | CEC_CAP_PASSTHROUGH
+			| CEC_CAP_RC | CEC_CAP_MONITOR_ALL | (emu.set_pa ? CEC_CAP_PHYS_ADDR : 0);
+		return 0;
+	case CEC_ADAP_G_PHYS_ADDR:
+		pthread_mutex_lock(&emu.lock);
+		*(__u16*)arg = emu.bus.physical_address;
+		pthread_mutex_unlock(&emu.lock);
+		return 0;
+	case CEC_ADAP_S_PHYS_ADDR:
+		if (!emu.set_pa) {
+			errno = ENOTTY;
+			return -1;
+		}
+		pthread_mutex_lock(&emu.lock);
+		emu.bus.physical_address = *(__u16*)arg;
+		pthread_mutex_unlock(&emu.lock);
+		emu_bus_log(&emu.bus, "fd %d: physical address %04X", fh->fd, *(__u16*)arg);
+		return 0;
+	case CEC_ADAP_G_LOG_ADDRS:
+		pthread_mutex_lock(&emu.lock);
+		*(struct cec_log_addrs*)arg = emu.log_addrs;
+		pthread_mutex_unlock(&emu.lock);
+		return 0;
+	case CEC_ADAP_S_LOG_ADDRS:
+		return emu_set_log_addrs(fh, (struct cec_log_addrs*)arg);
+	case CEC_G_MODE:
+		pthread_mutex_lock(&emu.lock);
+		*(__u32*)arg = fh->mode;
+		pthread_mutex_unlock(&emu.lock);
+		return 0;
+	case CEC_S_MODE:
+		return emu_set_mode(fh, *(__u32*)arg);
+	case CEC_TRANSMIT:
+		return emu_transmit(fh, (struct cec_msg*)arg);
+	case CEC_RECEIVE:
+		return emu_receive(fh, (struct cec_msg*)arg);
+	case CEC_DQEVENT:
+		errno = EAGAIN;
+		return -1;
+	default:
+		errno = ENOTTY;
+		return -1;
+	}
+}
+
+static int emu_open(const char* path, int flags, mode_t mode)
+{
+	emu_fh* fh;
+	int fd;
+
+	pthread_once(&emu.once, emu_init);
+	if (strcmp(path, emu.path) != 0) {
+		return emu.real_open(path, flags, mode);
+	}
+
+	pthread_mutex_lock(&emu.lock);
+	fh = emu_find_fh(-1);
+	if (fh == NULL) {
+		pthread_mutex_unlock(&emu.lock);
+		errno = EMFILE;
+		return -1;
+	}
+	/* Hand out a real descriptor, which polls readable when the handle has a message */
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | ((flags & O_CLOEXEC) ? TFD_CLOEXEC : 0));
+	if (fd >= 0) {
+		memset(fh, 0, sizeof(*fh));
+		fh->fd = fd;
+		fh->nonblock = (flags & O_NONBLOCK) != 0;
+		fh->mode = CEC_MODE_INITIATOR;
+		if ((emu.nb_fh++ == 0) && (emu.bus.traffic != 0)) {
+			emu.bus.next_traffic = emu_bus_now() + 1000000 / emu.bus.traffic;
+		}
+	}
+	pthread_mutex_unlock(&emu.lock);
+	emu_bus_log(&emu.bus, "open '%s' -> %d", path, fd);
+	return fd;
+}
+
+int open(const char* path, int flags, ...)
+{
+	va_list args;
+	mode_t mode = 0;
+
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_start(args, flags);
+		mode = va_arg(args, mode_t);
+		va_end(args);
+	}
+	return emu_open(path, flags, mode);
+}
+
+int open64(const char* path, int flags, ...)
+{
+	va_list args;
+	mode_t mode = 0;
+
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_start(args, flags);
+		mode = va_arg(args, mode_t);
+		va_end(args);
+	}
+	return emu_open(path, flags | O_LARGEFILE, mode);
+}
+
+int close(int fd)
+{
+	emu_fh* fh;
+
+	pthread_once(&emu.once, emu_init);
+	pthread_mutex_lock(&emu.lock);
+	fh = (fd >= 0) ? emu_find_fh(fd) : NULL;
+	if (fh != NULL) {
+		fh->fd = -1;
+		/* the adapter keeps its configuration, but nobody is left to answer */
+		if (--emu.nb_fh == 0) {
+			emu.bus.queued = 0;
+		}
+		/* wake up blocked readers, as the framework does on release */
+		pthread_cond_broadcast(&emu.cond);
+		emu_bus_log(&emu.bus, "close %d", fd);
+	}
+	pthread_mutex_unlock(&emu.lock);
+	return emu.real_close(fd);
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	va_list args;
+	unsigned long arg;
+	emu_fh* fh;
+
+	va_start(args, request);
+	arg = va_arg(args, unsigned long);
+	va_end(args);
+
+	pthread_once(&emu.once, emu_init);
+	pthread_mutex_lock(&emu.lock);
+	fh = (fd >= 0) ? emu_find_fh(fd) : NULL;
+	pthread_mutex_unlock(&emu.lock);
+	if (fh != NULL) {
+		return emu_cec_ioctl(fh, request, arg);
+	}
+	return emu.real_ioctl(fd, request, arg);
+}
@@ -0,0 +1,586 @@
+/*
+ * cecbench - backend conformance checks and timing measurements
+ *
+ * Copyright (c) 2010-2011 Pete Batard <pete@akeo.ie>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This program opens a CEC device with any backend, checks that it follows
+ * the rules every backend must obey, and measures how long the calls take.
+ * Run it against the loopback bus, or against the stand-in drivers of the
+ * real backends, e.g.:
+ *   cecbench loop:traffic=10
+ *   REALTEK_EMU="latency=2" LD_PRELOAD=realtek_emu.so cecbench realtek:/dev/cec/0
+ *   cecbench serial:/tmp/cec-tty,pa=0x1000
+ * The exit code is non zero if any check failed, or if a measurement is above
+ * the limit given on the command line, so that it can gate latency regressions.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libcec.h"
+
+#define BENCH_MAX_SAMPLES		10000
+
+static int nb_failed = 0;
+static int nb_checks = 0;
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void check(int ok, const char* name, const char* format, ...)
+{
+	va_list args;
+
+	nb_checks++;
+	if (!ok) {
+		nb_failed++;
+	}
+	printf("  [%s] %-28s ", ok ? "PASS" : "FAIL", name);
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf("\n");
+}
+
+/* For checks that cannot be run on this device, which count as neither passed nor failed */
+static void skip(const char* name, const char* format, ...)
+{
+	va_list args;
+
+	printf("  [SKIP] %-28s ", name);
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf("\n");
+}
+
+static int compare_double(const void* a, const void* b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Sort the samples and return the given percentile */
+static double percentile(double* samples, int nb_samples, int pc)
+{
+	int i;
+
+	if (nb_samples == 0) {
+		return 0.0;
+	}
+	qsort(samples, nb_samples, sizeof(double), compare_double);
+	i = (nb_samples * pc + 99) / 100 - 1;
+	return samples[(i < 0) ? 0 : i];
+}
+
+static void print_distribution(const char* name, double* samples, int nb_samples)
+{
+	printf("  %-35s n=%-5d min %8.3f  p50 %8.3f  p90 %8.3f  p99 %8.3f  max %8.3f ms\n", name, nb_samples,
+		percentile(samples, nb_samples, 0), percentile(samples, nb_samples, 50),
+		percentile(samples, nb_samples, 90), percentile(samples, nb_samples, 99),
+		percentile(samples, nb_samples, 100));
+}
+
+/* The cost of bringing a handle up and down */
+static void bench_open_close(char* device, int cycles)
+{
+	libcec_device_handle* handle;
+	double *open_time, *close_time, t;
+	int i, r = LIBCEC_SUCCESS;
+
+	open_time = calloc(cycles, sizeof(double));
+	close_time = calloc(cycles, sizeof(double));
+	if ((open_time == NULL) || (close_time == NULL)) {
+		exit(1);
+	}
+	for (i=0; i<cycles; i++) {
+		t = bench_now();
+		r = libcec_open(device, &handle);
+		open_time[i] = bench_now() - t;
+		if (r != LIBCEC_SUCCESS) {
+			break;
+		}
+		t = bench_now();
+		r = libcec_close(handle);
+		close_time[i] = bench_now() - t;
+		if (r != LIBCEC_SUCCESS) {
+			break;
+		}
+	}
+	check(r == LIBCEC_SUCCESS, "open/close cycles", "%d of %d: %s", i, cycles, libcec_strerror(r));
+	print_distribution("open", open_time, i);
+	print_distribution("close", close_time, i);
+	free(open_time);
+	free(close_time);
+}
+
+/* Calls with invalid parameters must fail cleanly, without reaching the driver */
+static void check_parameters(libcec_device_handle* handle)
+{
+	uint8_t buffer[LIBCEC_MAX_FRAME_SIZE+1];
+	int r;
+
+	memset(buffer, 0, sizeof(buffer));
+	r = libcec_write_message(handle, buffer, 0);
+	check(r == LIBCEC_ERROR_INVALID_PARAM, "empty frame rejected", "%s", libcec_strerror(r));
+	r = libcec_write_message(handle, buffer, LIBCEC_MAX_FRAME_SIZE+1);
+	check(r == LIBCEC_ERROR_INVALID_PARAM, "oversized frame rejected", "%s", libcec_strerror(r));
+	r = libcec_read_message(handle, NULL, LIBCEC_MAX_FRAME_SIZE, 0);
+	check(r == LIBCEC_ERROR_INVALID_PARAM, "NULL read buffer rejected", "%s", libcec_strerror(r));
+}
+
+/*
+ * Poll every other logical address. A write must succeed if and only if its
+ * result is LIBCEC_TX_OK, and a NACK must be reported as LIBCEC_ERROR_IO.
+ * Returns the mask of the addresses that answered.
+ */
+static uint16_t check_polling(libcec_device_handle* handle, uint8_t logical_address)
+{
+	libcec_tx_status status;
+	uint16_t present = 0;
+	uint8_t la, poll;
+	int r, consistent = 1;
+
+	for (la=0; la<15; la++) {
+		if (la == logical_address) {
+			continue;
+		}
+		poll = (logical_address << 4) | la;
+		memset(&status, 0, sizeof(status));
+		r = libcec_write_message_ex(handle, &poll, 1, &status);
+		if (r == LIBCEC_SUCCESS) {
+			present |= 1 << la;
+		}
+		if ( ((r == LIBCEC_SUCCESS) != (status.result == LIBCEC_TX_OK))
+		  || ((status.result == LIBCEC_TX_NACK) && (r != LIBCEC_ERROR_IO)) ) {
+			printf("         poll of %X: %s with result %d\n", la, libcec_strerror(r), status.result);
+			consistent = 0;
+		}
+	}
+	check(consistent, "poll results consistent", "devices present: %04X", present);
+	return present;
+}
+
+/*
+ * A read must time out, and never early, while every frame is filtered out.
+ * Report how late the timeouts are.
+ */
+static void check_read_timeouts(libcec_device_handle* handle, double max_drift)
+{
+	const int32_t timeouts[] = {0, 10, 50, 100, 250};
+	const uint8_t nothing[LIBCEC_RX_FILTER_SIZE] = { 0 };
+	uint8_t buffer[LIBCEC_MAX_FRAME_SIZE];
+	double samples[8], t, elapsed;
+	char name[32];
+	int i, j, n, r, valid = 1, early = 0, frames = 0;
+	double worst = 0.0;
+
+	/* so that bus traffic doesn't take the samples */
+	libcec_set_rx_filter(handle, nothing, 0);
+	for (i=0; i<(int)(sizeof(timeouts)/sizeof(timeouts[0])); i++) {
+		for (j=0, n=0; j<(int)(sizeof(samples)/sizeof(samples[0])); j++) {
+			t = bench_now();
+			r = libcec_read_message(handle, buffer, sizeof(buffer), timeouts[i]);
+			elapsed = bench_now() - t;
+			if (r > 0) {
+				frames++;
+				if (r > LIBCEC_MAX_FRAME_SIZE) {
+					valid = 0;
+				}
+				continue;
+			}
+			if (r != LIBCEC_ERROR_TIMEOUT) {
+				printf("         read(%d): %s\n", timeouts[i], libcec_strerror(r));
+				valid = 0;
+				continue;
+			}
+			/* allow for the clock granularity */
+			if (elapsed < timeouts[i] - 1.0) {
+				early++;
+			}
+			samples[n++] = elapsed - timeouts[i];
+		}
+		if (n != 0) {
+			snprintf(name, sizeof(name), "read timeout %d ms", timeouts[i]);
+			printf("  %-35s n=%-5d min %8.3f  p50 %8.3f  max %8.3f ms late\n", name, n,
+				percentile(samples, n, 0), percentile(samples, n, 50), percentile(samples, n, 100));
+			if (percentile(samples, n, 100) > worst) {
+				worst = percentile(samples, n, 100);
+			}
+		}
+	}
+	libcec_set_rx_filter(handle, NULL, 0xFFFF);
+	check(valid && (frames == 0), "read times out when filtered", "%d frames got through", frames);
+	check(early == 0, "read never times out early", "%d early timeouts", early);
+	if (max_drift > 0.0) {
+		check(worst <= max_drift, "read timeout drift", "%.3f ms, limit %.3f ms", worst, max_drift);
+	}
+}
+
+/* Time synchronous writes to a device that is present, or broadcasts if there is none */
+static void bench_write(libcec_device_handle* handle, uint8_t logical_address, uint16_t present,
+	int count, double max_p99)
+{
+	uint8_t frame[2], buffer[LIBCEC_MAX_FRAME_SIZE];
+	double* samples, t, p99;
+	int i, r, failures = 0;
+	uint8_t la;
+
+	samples = calloc(count, sizeof(double));
+	if (samples == NULL) {
+		exit(1);
+	}
+	for (la=0; (la<15) && !(present & (1 << la)); la++);
+	/* Give Device Power Status, which a device answers, or Request Active Source */
+	frame[0] = (logical_address << 4) | la;
+	frame[1] = (la < 15) ? 0x8F : 0x85;
+	for (i=0; i<count; i++) {
+		t = bench_now();
+		r = libcec_write_message(handle, frame, 2);
+		samples[i] = bench_now() - t;
+		if (r != LIBCEC_SUCCESS) {
+			failures++;
+		}
+	}
+	/* let the answers come in, so that they don't skew the next tests, but don't wait on traffic */
+	t = bench_now();
+	while ((libcec_read_message(handle, buffer, sizeof(buffer), 100) > 0) && (bench_now() - t < 1000.0));
+
+	printf("  write to %X: %d of %d failed\n", la, failures, count);
+	print_distribution("write latency", samples, count);
+	if (max_p99 > 0.0) {
+		p99 = percentile(samples, count, 99);
+		check(p99 <= max_p99, "write latency p99", "%.3f ms, limit %.3f ms", p99, max_p99);
+	}
+	free(samples);
+}
+
+typedef struct {
+	libcec_device_handle* handle;
+	uint8_t request[2];
+	libcec_frame reply;
+	int result;
+	double elapsed;
+} transaction;
+
+static void* transact_thread(void* arg)
+{
+	transaction* t = (transaction*)arg;
+	double start;
+
+	start = bench_now();
+	t->result = libcec_transact(t->handle, t->request, sizeof(t->request), 0x47, 1000, &t->reply);
+	t->elapsed = bench_now() - start;
+	return NULL;
+}
+
+/*
+ * Query every device for its OSD name at once. Each answer must reach the
+ * thread that asked that device, and the whole lot should take about as
+ * long as the slowest query, rather than the sum of them.
+ */
+static void check_transact(libcec_device_handle* handle, uint8_t logical_address, uint16_t present)
+{
+	transaction t[15];
+	pthread_t thread[15];
+	int i, n = 0, routed = 1, started[15];
+	double start, elapsed, slowest = 0.0, sum = 0.0;
+
+	if (present == 0) {
+		return;
+	}
+	start = bench_now();
+	for (i=0; i<15; i++) {
+		started[i] = 0;
+		if (!(present & (1 << i))) {
+			continue;
+		}
+		t[i].handle = handle;
+		t[i].request[0] = (logical_address << 4) | i;
+		t[i].request[1] = 0x46;	/* Give OSD Name */
+		started[i] = (pthread_create(&thread[i], NULL, transact_thread, &t[i]) == 0);
+	}
+	for (i=0; i<15; i++) {
+		if (!started[i]) {
+			continue;
+		}
+		pthread_join(thread[i], NULL);
+		n++;
+		if ( ((t[i].result > 0) && ((t[i].reply.data[0] >> 4) != i || t[i].reply.data[1] != 0x47))
+		  || ((t[i].result < 0) && (t[i].result != LIBCEC_ERROR_NOT_SUPPORTED)) ) {
+			printf("         transact(%d): %s\n", i, (t[i].result < 0) ? libcec_strerror(t[i].result) : "wrong answer");
+			routed = 0;
+		}
+		sum += t[i].elapsed;
+		slowest = (t[i].elapsed > slowest) ? t[i].elapsed : slowest;
+	}
+	elapsed = bench_now() - start;
+	check(routed, "concurrent transactions", "%d devices in %.3f ms, slowest %.3f ms, sum %.3f ms",
+		n, elapsed, slowest, sum);
+}
+
+/*
+ * If the handle can be polled, it must report readiness when a frame comes
+ * in, and not unless a read would not time out. Answers to Give Device Power
+ * Status are asked for, so that there is something to receive without
+ * background traffic.
+ */
+static void check_pollfd(libcec_device_handle* handle, uint8_t logical_address, uint16_t present)
+{
+	uint8_t request[2], buffer[LIBCEC_MAX_FRAME_SIZE];
+	struct pollfd pfd;
+	double end;
+	int i, r, la, wakeups = 0, spurious = 0;
+
+	pfd.fd = libcec_get_pollfd(handle);
+	if (pfd.fd < 0) {
+		check(0, "pollable handle", "%s", libcec_strerror(pfd.fd));
+		return;
+	}
+	pfd.events = POLLIN;
+	for (la=0; (la<15) && !(present & (1 << la)); la++);
+	for (i=0; i<5; i++) {
+		if (la < 15) {
+			request[0] = (logical_address << 4) | la;
+			request[1] = 0x8F;	/* Give Device Power Status */
+			libcec_write_message(handle, request, sizeof(request));
+		}
+		for (end = bench_now() + 100.0; bench_now() < end; ) {
+			if (poll(&pfd, 1, 20) <= 0) {
+				continue;
+			}
+			wakeups++;
+			r = libcec_read_message(handle, buffer, sizeof(buffer), 0);
+			if (r == LIBCEC_ERROR_TIMEOUT) {
+				spurious++;
+			}
+		}
+	}
+	if ((wakeups == 0) && (la >= 15)) {
+		skip("pollfd readiness", "no device to answer, and no traffic");
+		return;
+	}
+	check((wakeups != 0) && (spurious == 0), "pollfd readiness", "%d wakeups, %d without a frame", wakeups, spurious);
+}
+
+typedef struct {
+	libcec_device_handle* handle;
+	int result;
+	double returned;
+} blocked_reader;
+
+static void* reader_thread(void* arg)
+{
+	blocked_reader* reader = (blocked_reader*)arg;
+	uint8_t buffer[LIBCEC_MAX_FRAME_SIZE];
+
+	/* a single call, as the handle is gone once it returns */
+	reader->result = libcec_read_message(reader->handle, buffer, sizeof(buffer), 10000);
+	reader->returned = bench_now();
+	return NULL;
+}
+
+/* Closing must wake up a blocked reader right away, rather than after its timeout */
+static void check_close(libcec_device_handle* handle)
+{
+	const uint8_t nothing[LIBCEC_RX_FILTER_SIZE] = { 0 };
+	blocked_reader reader = { handle, 0, 0.0 };
+	pthread_t thread;
+	double t, closed;
+	int r;
+
+	/* make sure that no frame gets the reader out first */
+	libcec_set_rx_filter(handle, nothing, 0);
+	if (pthread_create(&thread, NULL, reader_thread, &reader) != 0) {
+		check(0, "close wakes blocked reader", "could not create thread");
+		libcec_close(handle);
+		return;
+	}
+	usleep(100000);
+	t = bench_now();
+	r = libcec_close(handle);
+	closed = bench_now();
+	pthread_join(thread, NULL);
+	check(r == LIBCEC_SUCCESS, "close with blocked reader", "took %.3f ms", closed - t);
+	check((reader.result == LIBCEC_ERROR_INTERRUPTED) && (reader.returned - t < 1000.0),
+		"close wakes blocked reader", "%s after %.3f ms", libcec_strerror(reader.result), reader.returned - t);
+}
+
+/* Upper bound of the histogram bucket that holds the given percentile of the calls */
+static uint64_t histogram_percentile(const libcec_op_stats* op, uint64_t count, double p)
+{
+	uint64_t seen = 0, rank;
+	int i;
+
+	rank = (uint64_t)((count * p + 99.0) / 100.0);
+	for (i=0; i<LIBCEC_STATS_BUCKETS-1; i++) {
+		seen += op->histogram[i];
+		if (seen >= rank) {
+			break;
+		}
+	}
+	return (i == LIBCEC_STATS_BUCKETS-1) ? op->max_time : LIBCEC_STATS_BUCKET_LOW(i+1);
+}
+
+/* Report the library's own view of the backend calls, which must account for every write */
+static void check_stats(libcec_device_handle* handle, int writes)
+{
+	const char* op_name[LIBCEC_STATS_OP_COUNT] = { "read_message", "write_message", "read_edid", "set_logical_address" };
+	libcec_stats stats;
+	libcec_op_stats* op;
+	uint64_t count;
+	char name[32];
+	int i, r;
+
+	r = libcec_get_stats(handle, &stats);
+	if (r != LIBCEC_SUCCESS) {
+		check(0, "statistics", "%s", libcec_strerror(r));
+		return;
+	}
+	for (i=0; i<LIBCEC_STATS_OP_COUNT; i++) {
+		op = &stats.ops[i];
+		count = op->calls - op->timeouts;
+		if (count == 0) {
+			continue;
+		}
+		snprintf(name, sizeof(name), "stats %s", op_name[i]);
+		printf("  %-35s n=%-5llu err %-5llu p50 <%8llu  p99 <%8llu  max %8llu us\n", name,
+			(unsigned long long)count, (unsigned long long)op->errors,
+			(unsigned long long)histogram_percentile(op, count, 50),
+			(unsigned long long)histogram_percentile(op, count, 99),
+			(unsigned long long)op->max_time);
+	}
+	printf("  %-35s in %llu (%llu bytes), out %llu (%llu bytes)\n", "stats frames",
+		(unsigned long long)stats.frames_in, (unsigned long long)stats.bytes_in,
+		(unsigned long long)stats.frames_out, (unsigned long long)stats.bytes_out);
+	check(stats.ops[LIBCEC_STATS_WRITE_MESSAGE].calls >= (uint64_t)writes, "statistics account for writes",
+		"%llu backend writes", (unsigned long long)stats.ops[LIBCEC_STATS_WRITE_MESSAGE].calls);
+}
+
+static void usage(void)
+{
+	printf("Usage: cecbench [OPTION...] DEVICE\n");
+	printf("  -n, --writes=COUNT                      Number of timed writes (default 200)\n");
+	printf("  -c, --cycles=COUNT                      Number of open/close cycles (default 20)\n");
+	printf("  -t, --type=DEVICETYPE                   CEC device type to allocate (default 4)\n");
+	printf("  -W, --max-write-p99=MS                  Fail if the write latency p99 is above MS\n");
+	printf("  -D, --max-drift=MS                      Fail if a read times out more than MS late\n");
+	printf("  -l, --log-level=LOGLEVEL                Set libcec logging level (default 3)\n");
+	printf("  -h, --help                              Show this help message\n");
+}
+
+int main(int argc, char** argv)
+{
+	libcec_device_handle* handle;
+	uint16_t physical_address, present;
+	int c, r, writes = 200, cycles = 20, device_type = 4, log_level = 3, logical_address;
+	double max_p99 = 0.0, max_drift = 0.0;
+	char* device;
+	static struct option long_options[] = {
+		{"writes", required_argument, 0, 'n'},
+		{"cycles", required_argument, 0, 'c'},
+		{"type", required_argument, 0, 't'},
+		{"max-write-p99", required_argument, 0, 'W'},
+		{"max-drift", required_argument, 0, 'D'},
+		{"log-level", required_argument, 0, 'l'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	while ((c = getopt_long(argc, argv, "n:c:t:W:D:l:h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			writes = atoi(optarg);
+			break;
+		case 'c':
+			cycles = atoi(optarg);
+			break;
+		case 't':
+			device_type = atoi(optarg);
+			break;
+		case 'W':
+			max_p99 = atof(optarg);
+			break;
+		case 'D':
+			max_drift = atof(optarg);
+			break;
+		case 'l':
+			log_level = atoi(optarg);
+			break;
+		default:
+			usage();
+			return (c == 'h') ? 0 : 2;
+		}
+	}
+	if ( (optind != argc-1) || (writes <= 0) || (writes > BENCH_MAX_SAMPLES)
+	  || (cycles <= 0) || (cycles > BENCH_MAX_SAMPLES) ) {
+		usage();
+		return 2;
+	}
+	device = argv[optind];
+
+	libcec_set_logging(log_level, stderr);
+	r = libcec_init();
+	if (r != LIBCEC_SUCCESS) {
+		fprintf(stderr, "cecbench: libcec_init failed: %s\n", libcec_strerror(r));
+		return 1;
+	}
+	printf("cecbench: %s\n", device);
+	bench_open_close(device, cycles);
+
+	r = libcec_open(device, &handle);
+	if (r != LIBCEC_SUCCESS) {
+		check(0, "open", "%s", libcec_strerror(r));
+		goto out;
+	}
+	check_parameters(handle);
+	logical_address = libcec_allocate_logical_address(handle, (uint8_t)device_type, &physical_address);
+	check(logical_address >= 0, "logical address allocation", "%d, physical address %04X",
+		logical_address, physical_address);
+	if (logical_address < 0) {
+		logical_address = 15;
+	}
+	present = check_polling(handle, (uint8_t)logical_address);
+	bench_write(handle, (uint8_t)logical_address, present, writes, max_p99);
+	check_read_timeouts(handle, max_drift);
+	check_transact(handle, (uint8_t)logical_address, present);
+	check_pollfd(handle, (uint8_t)logical_address, present);
+	check_stats(handle, writes);
+	check_close(handle);
+
+out:
+	libcec_exit();
+	printf("cecbench: %d of %d checks failed\n", nb_failed, nb_checks);
+	return (nb_failed != 0) ? 1 : 0;
+}
@@ -0,0 +1,323 @@
+/*
+ * emu_bus - simulated CEC bus, shared by the driver emulators
+ *
+ * Copyright (c) 2010-2011 Pete Batard <pete@akeo.ie>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <config.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "emu_bus.h"
+
+static const uint8_t emu_bus_device_type[15] = {0, 1, 1, 3, 4, 5, 3, 3, 4, 1, 3, 4, 2, 2, 0};
+
+void emu_bus_init(emu_bus* bus, const char* name)
+{
+	memset(bus, 0, sizeof(*bus));
+	bus->name = name;
+	bus->devices = (1 << 0) | (1 << 4) | (1 << 5);
+	bus->physical_address = 0x1000;
+	bus->seed = 1;
+	bus->logical_address = 0x0F;
+}
+
+void emu_bus_parse_options(emu_bus* bus, const char* options, int (*option)(const char* token, const char* value))
+{
+	char *str, *token, *value, *saveptr = NULL;
+	unsigned int a, b, c, d;
+	const char* p;
+
+	if (options == NULL) {
+		return;
+	}
+	str = strdup(options);
+	if (str == NULL) {
+		return;
+	}
+	for (token = strtok_r(str, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr)) {
+		value = strchr(token, '=');
+		if (value == NULL) {
+			fprintf(stderr, "%s: ignoring option '%s'\n", bus->name, token);
+			continue;
+		}
+		*value++ = 0;
+		if ((option != NULL) && option(token, value)) {
+			continue;
+		}
+		if (strcmp(token, "devices") == 0) {
+			bus->devices = 0;
+			for (p=value; *p != 0; p++) {
+				if (isxdigit((unsigned char)*p) && (toupper((unsigned char)*p) != 'F')) {
+					bus->devices |= 1 << (isdigit((unsigned char)*p) ? *p - '0' : toupper((unsigned char)*p) - 'A' + 10);
+				}
+			}
+		} else if (strcmp(token, "pa") == 0) {
+			if (sscanf(value, "%x.%x.%x.%x", &a, &b, &c, &d) == 4) {
+				bus->physical_address = ((a & 0xF) << 12) | ((b & 0xF) << 8) | ((c & 0xF) << 4) | (d & 0xF);
+			}
+		} else if (strcmp(token, "nack") == 0) {
+			bus->nack = atoi(value);
+		} else if (strcmp(token, "arb") == 0) {
+			bus->arb = atoi(value);
+		} else if (strcmp(token, "latency") == 0) {
+			bus->latency = atoi(value);
+		} else if (strcmp(token, "wire") == 0) {
+			bus->wire = atoi(value);
+		} else if (strcmp(token, "traffic") == 0) {
+			bus->traffic = atoi(value);
+		} else if (strcmp(token, "seed") == 0) {
+			bus->seed = (unsigned int)strtoul(value, NULL, 0);
+		} else if (strcmp(token, "log") == 0) {
+			bus->log = atoi(value);
+		} else {
+			fprintf(stderr, "%s: ignoring option '%s'\n", bus->name, token);
+		}
+	}
+	free(str);
+}
+
+void emu_bus_log(emu_bus* bus, const char* format, ...)
+{
+	va_list args;
+
+	if (!bus->log) {
+		return;
+	}
+	va_start(args, format);
+	fprintf(stderr, "%s: ", bus->name);
+	vfprintf(stderr, format, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+}
+
+uint64_t emu_bus_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void emu_bus_sleep_us(uint64_t us)
+{
+	struct timespec ts;
+
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000;
+	while ((nanosleep(&ts, &ts) != 0) && (errno == EINTR));
+}
+
+int emu_bus_chance(emu_bus* bus, unsigned int percent)
+{
+	return (percent != 0) && ((unsigned int)(rand_r(&bus->seed) % 100) < percent);
+}
+
+/* Nominal duration of a frame on the wire: start bit, then 10 bits of 2.4 ms per block */
+uint64_t emu_bus_wire_time(emu_bus* bus, size_t length)
+{
+	return bus->wire ? 4500 + length * 24000 : 0;
+}
+
+uint16_t emu_bus_device_pa(uint8_t device)
+{
+	return (device == 0) ? 0x0000 : (uint16_t)(((device % 4) + 1) << 12);
+}
+
+/* Whether a frame that won arbitration is ACKed, which broadcasts always are */
+int emu_bus_acked(emu_bus* bus, uint8_t destination)
+{
+	return (destination == 0x0F) || ((bus->devices & (1 << destination)) && !emu_bus_chance(bus, bus->nack));
+}
+
+/*
+ * Build the answer of a simulated device to a request that went through,
+ * if it has one. Returns the length of the reply, or 0.
+ */
+size_t emu_bus_device_reply(emu_bus* bus, const uint8_t* buf, size_t len, uint8_t* reply)
+{
+	uint8_t src = buf[0] & 0x0F, dst = buf[0] >> 4;		/* of the reply */
+	size_t reply_len = 2;
+
+	if ((len < 2) || (src == 0x0F) || !(bus->devices & (1 << src))) {
+		return 0;
+	}
+	reply[0] = (src << 4) | dst;
+	switch (buf[1]) {
+	case 0x83:	/* Give Physical Address */
+		reply[0] = (src << 4) | 0x0F;
+		reply[1] = 0x84;
+		reply[2] = emu_bus_device_pa(src) >> 8;
+		reply[3] = emu_bus_device_pa(src) & 0xFF;
+		reply[4] = emu_bus_device_type[src];
+		reply_len = 5;
+		break;
+	case 0x8F:	/* Give Device Power Status */
+		reply[1] = 0x90;
+		reply[2] = 0x00;
+		reply_len = 3;
+		break;
+	case 0x9F:	/* Get CEC Version */
+		reply[1] = 0x9E;
+		reply[2] = 0x04;
+		reply_len = 3;
+		break;
+	case 0x8C:	/* Give Device Vendor ID */
+		reply[0] = (src << 4) | 0x0F;
+		reply[1] = 0x87;
+		reply[2] = reply[3] = reply[4] = 0x00;
+		reply_len = 5;
+		break;
+	case 0x46:	/* Give OSD Name */
+		reply[1] = 0x47;
+		reply_len += snprintf((char*)&reply[2], LIBCEC_MAX_FRAME_SIZE-2, "Emu %X", src);
+		break;
+	default:
+		return 0;
+	}
+	return reply_len;
+}
+
+void emu_bus_queue_push(emu_bus* bus, const uint8_t* buf, size_t len, uint64_t due)
+{
+	unsigned int i;
+
+	if ((bus->queued >= EMU_BUS_QUEUE_SIZE) || (len > LIBCEC_MAX_FRAME_SIZE)) {
+		emu_bus_log(bus, "dropping reply, queue full");
+		return;
+	}
+	for (i=bus->queued; (i>0) && (bus->queue[i-1].due > due); i--) {
+		bus->queue[i] = bus->queue[i-1];
+	}
+	bus->queue[i].due = due;
+	bus->queue[i].len = (uint8_t)len;
+	memcpy(bus->queue[i].buf, buf, len);
+	bus->queued++;
+}
+
+/* Remove the earliest reply from the queue, whether it is due or not. Returns 0 if there is none */
+int emu_bus_queue_pop(emu_bus* bus, emu_frame* frame)
+{
+	if (bus->queued == 0) {
+		return 0;
+	}
+	*frame = bus->queue[0];
+	memmove(&bus->queue[0], &bus->queue[1], (--bus->queued) * sizeof(emu_frame));
+	return 1;
+}
+
+/*
+ * Background traffic, from a random device other than us, to us or to
+ * everyone, and when the next frame is due. The frame is empty if no
+ * device can send it.
+ */
+void emu_bus_traffic_frame(emu_bus* bus, emu_frame* frame)
+{
+	uint8_t device, i;
+
+	frame->due = bus->next_traffic;
+	bus->next_traffic += 1000000 / bus->traffic;
+	for (device=0, i=rand_r(&bus->seed)%15; device<15; device++, i=(i+1)%15) {
+		if ((bus->devices & (1 << i)) && (i != bus->logical_address)) {
+			break;
+		}
+	}
+	if (device >= 15) {
+		frame->len = 0;
+		return;
+	}
+	if ((bus->logical_address < 0x0F) && (rand_r(&bus->seed) & 1)) {
+		frame->buf[0] = (i << 4) | bus->logical_address;
+		frame->buf[1] = 0x8F;	/* Give Device Power Status */
+		frame->len = 2;
+	} else {
+		frame->buf[0] = (i << 4) | 0x0F;
+		frame->buf[1] = 0x84;	/* Report Physical Address */
+		frame->buf[2] = emu_bus_device_pa(i) >> 8;
+		frame->buf[3] = emu_bus_device_pa(i) & 0xFF;
+		frame->buf[4] = 0x00;
+		frame->len = 5;
+	}
+}
+
+static void emu_bus_edid_checksum(uint8_t* block)
+{
+	uint8_t checksum;
+	int i;
+
+	for (checksum=0, i=0; i<0x7F; i++) {
+		checksum += block[i];
+	}
+	block[0x7F] = -checksum;
+}
+
+/*
+ * Build an EDID of 1 + extensions blocks, the last extension with an HDMI
+ * VSDB holding our physical address, into a buffer of at least that size.
+ */
+void emu_bus_build_edid(emu_bus* bus, uint8_t* edid, unsigned int extensions, const char* monitor_name)
+{
+	const uint8_t edid_marker[] = {0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00};
+	uint8_t* block;
+	unsigned int i;
+
+	memset(edid, 0, (extensions+1)*128);
+
+	/* Base block: header, "REA" manufacturer ID, EDID 1.3, monitor name */
+	memcpy(edid, edid_marker, sizeof(edid_marker));
+	edid[0x08] = 0x48;
+	edid[0x09] = 0xA1;
+	edid[0x0A] = 0x01;
+	edid[0x12] = 0x01;
+	edid[0x13] = 0x03;
+	edid[0x4B] = 0xFC;
+	/* up to 13 characters, terminated by a line feed and padded with spaces */
+	memset(&edid[0x4D], ' ', 13);
+	for (i=0; (i<12) && (monitor_name[i] != 0); i++) {
+		edid[0x4D+i] = monitor_name[i];
+	}
+	edid[0x4D+i] = '\n';
+	edid[0x7E] = (uint8_t)extensions;
+	emu_bus_edid_checksum(edid);
+
+	/* CEA-861 extensions, the last one with an HDMI VSDB holding our physical address */
+	for (i=1; i<=extensions; i++) {
+		block = &edid[i*128];
+		block[0x00] = 0x02;
+		block[0x01] = 0x03;
+		block[0x02] = 0x04;
+		block[0x03] = 0x40;
+		if (i == extensions) {
+			block[0x02] = 0x0C;
+			block[0x04] = 0x67;
+			block[0x05] = 0x03;
+			block[0x06] = 0x0C;
+			block[0x07] = 0x00;
+			block[0x08] = bus->physical_address >> 8;
+			block[0x09] = bus->physical_address & 0xFF;
+			block[0x0A] = 0x80;
+			block[0x0B] = 0x2D;
+		}
+		emu_bus_edid_checksum(block);
+	}
+}
@@ -0,0 +1,91 @@
+/*
+ * emu_bus - simulated CEC bus, shared by the driver emulators
+ *
+ * Copyright (c) 2010-2011 Pete Batard <pete@akeo.ie>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __EMU_BUS_H__
+#define __EMU_BUS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libcec.h"
+
+#define EMU_BUS_QUEUE_SIZE		32
+
+typedef struct {
+	uint64_t	due;			/* monotonic time of delivery, in us */
+	uint8_t		len;
+	uint8_t		buf[LIBCEC_MAX_FRAME_SIZE];
+} emu_frame;
+
+/*
+ * The simulated devices, the faults of the bus and the replies on their way.
+ * The emulators only add the framing of their driver. Apart from the options,
+ * which are parsed before any device is opened, the bus is protected by the
+ * lock of the emulator.
+ */
+typedef struct {
+	const char*		name;		/* of the emulator, for the traces */
+
+	/* options */
+	uint16_t		devices;
+	uint16_t		physical_address;
+	unsigned int	nack;
+	unsigned int	arb;
+	unsigned int	latency;
+	int				wire;
+	unsigned int	traffic;
+	unsigned int	seed;
+	int				log;
+
+	/* state */
+	uint8_t			logical_address;	/* 0x0F while we have none */
+	uint64_t		next_traffic;
+	emu_frame		queue[EMU_BUS_QUEUE_SIZE];	/* device replies, sorted by due time */
+	unsigned int	queued;
+} emu_bus;
+
+/*
+ * Options common to all the emulators, in the comma separated list:
+ *   devices=<hex digits>  logical addresses of the simulated devices (default "045")
+ *   pa=<a.b.c.d>          our physical address (default 1.0.0.0)
+ *   nack=<percent>        probability of a directed frame not being ACKed
+ *   arb=<percent>         probability of losing arbitration on transmit
+ *   latency=<ms>          delay added to our transmissions and to device replies
+ *   wire=<0|1>            simulate the nominal CEC bit timings (default 0)
+ *   traffic=<n>           frames per second of background traffic from the devices
+ *   seed=<n>              seed for the fault injection generator (default 1)
+ *   log=<0|1>             trace the emulated requests on stderr (default 0)
+ * The other options are handed to option(), which returns nonzero if it knows them.
+ */
+void emu_bus_init(emu_bus* bus, const char* name);
+void emu_bus_parse_options(emu_bus* bus, const char* options, int (*option)(const char* token, const char* value));
+void emu_bus_log(emu_bus* bus, const char* format, ...);
+uint64_t emu_bus_now(void);
+void emu_bus_sleep_us(uint64_t us);
+int emu_bus_chance(emu_bus* bus, unsigned int percent);
+uint64_t emu_bus_wire_time(emu_bus* bus, size_t length);
+uint16_t emu_bus_device_pa(uint8_t device);
+int emu_bus_acked(emu_bus* bus, uint8_t destination);
+size_t emu_bus_device_reply(emu_bus* bus, const uint8_t* buf, size_t len, uint8_t* reply);
+void emu_bus_queue_push(emu_bus* bus, const uint8_t* buf, size_t len, uint64_t due);
+int emu_bus_queue_pop(emu_bus* bus, emu_frame* frame);
+void emu_bus_traffic_frame(emu_bus* bus, emu_frame* frame);
+void emu_bus_build_edid(emu_bus* bus, uint8_t* edid, unsigned int extensions, const char* monitor_name);
+
+#endif
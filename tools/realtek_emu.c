@@ -0,0 +1,567 @@
+/*
+ * realtek_emu - userspace stand-in for the Realtek SoC CEC and I2C drivers
+ *
+ * Copyright (c) 2010-2011 Pete Batard <pete@akeo.ie>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This module is meant to be LD_PRELOADed into a program using the "realtek:"
+ * backend, on a machine that has no RTD SoC. It intercepts open(), close() and
+ * ioctl() on the CEC and I2C device nodes, and answers the CEC_ENABLE,
+ * CEC_SET_LOGICAL_ADDRESS, CEC_SET_POWER_STATUS, CEC_SEND_MESSAGE,
+ * CEC_RCV_MESSAGE and I2C_RDWR requests the way the vendor drivers do, so
+ * that the production backend code runs unmodified. For instance:
+ *   REALTEK_EMU="nack=5,junk=3" LD_PRELOAD=realtek_emu.so cecd -d realtek:/dev/cec/0
+ * The REALTEK_EMU environment variable is a comma separated list of options:
+ *   cec=<path>            CEC device node to emulate (default /dev/cec/0)
+ *   i2c=<path>            I2C device node to emulate (default /dev/i2c/0)
+ *   devices=<hex digits>  logical addresses of the simulated devices (default "045")
+ *   pa=<a.b.c.d>          our physical address, as reported in the EDID (default 1.0.0.0)
+ *   ext=<n>               number of EDID extension blocks, the last one with the VSDB (default 1)
+ *   eddc=<0|1>            whether the sink acknowledges the E-DDC segment pointer (default 1)
+ *   junk=<n>              parasitic bytes ahead of an EDID read with no offset set (default 0)
+ *   i2c_fail=<percent>    probability of an I2C transfer failing with EIO
+ *   enable_fail=<0|1>     make CEC_ENABLE fail with EIO (default 0)
+ *   nack=<percent>        probability of a directed frame not being ACKed (EIO)
+ *   arb=<percent>         probability of losing arbitration on transmit (EBUSY)
+ *   timeout=<percent>     probability of a transmission timing out (ETIME)
+ *   latency=<ms>          delay added to our transmissions and to device replies
+ *   wire=<0|1>            simulate the nominal CEC and DDC bit timings (default 0)
+ *   traffic=<n>           frames per second of background traffic from the devices
+ *   script=<file>         frames to deliver, one "<ms> <hex bytes>" line each, with
+ *                         ms counted from CEC_ENABLE, or from the previous line if
+ *                         prefixed with '+'. Empty lines and '#' comments are skipped
+ *   seed=<n>              seed for the fault injection generator (default 1)
+ *   log=<0|1>             trace the intercepted requests on stderr (default 0)
+ */
+
+#define _GNU_SOURCE
+#undef _FORTIFY_SOURCE		/* we provide our own open() */
+#include <config.h>
+
+#include <ctype.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "libceci.h"
+#include "linux_realtek_soc.h"
+#include "emu_bus.h"
+
+#define EMU_EDID_SEGMENTS		2
+#define EMU_EDID_SIZE			(EMU_EDID_SEGMENTS*256)
+#define EMU_EDID_ADDR			0x50
+#define EMU_EDID_SEGMENT_ADDR	0x30
+#define EMU_PATH_SIZE			128
+
+static struct {
+	pthread_once_t	once;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	int (*real_open)(const char*, int, ...);
+	int (*real_close)(int);
+	int (*real_ioctl)(int, unsigned long, ...);
+
+	emu_bus			bus;
+
+	/* options */
+	char			cec_path[EMU_PATH_SIZE];
+	char			i2c_path[EMU_PATH_SIZE];
+	unsigned int	edid_extensions;
+	int				eddc;
+	unsigned int	junk;
+	unsigned int	i2c_fail;
+	int				enable_fail;
+	unsigned int	timeout;
+
+	/* state */
+	int				cec_fd;
+	int				i2c_fd;
+	int				enabled;
+	uint64_t		enable_time;
+	emu_frame*		script;
+	unsigned int	script_len;
+	unsigned int	script_pos;
+	uint8_t			edid[EMU_EDID_SIZE];
+} emu = { PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER };
+
+/* Parse hex bytes, separated by spaces or colons, into a frame */
+static int emu_parse_frame(const char* str, emu_frame* frame)
+{
+	char* end;
+	unsigned long value;
+
+	frame->len = 0;
+	while (*str != 0) {
+		if (isspace((unsigned char)*str) || (*str == ':')) {
+			str++;
+			continue;
+		}
+		if (*str == '#') {
+			break;
+		}
+		value = strtoul(str, &end, 16);
+		if ((end == str) || (value > 0xFF) || (frame->len >= LIBCEC_MAX_FRAME_SIZE)) {
+			return -1;
+		}
+		frame->buf[frame->len++] = (uint8_t)value;
+		str = end;
+	}
+	return (frame->len == 0) ? -1 : 0;
+}
+
+static void emu_load_script(const char* path)
+{
+	FILE* fd;
+	char line[256], *p, *end;
+	unsigned long ms, at = 0;
+	unsigned int nb_line = 0;
+	emu_frame frame, *script;
+
+	fd = fopen(path, "r");
+	if (fd == NULL) {
+		fprintf(stderr, "realtek_emu: cannot open script '%s' - errno: %d\n", path, errno);
+		return;
+	}
+	while (fgets(line, sizeof(line), fd) != NULL) {
+		nb_line++;
+		for (p=line; isspace((unsigned char)*p); p++);
+		if ((*p == 0) || (*p == '#')) {
+			continue;
+		}
+		ms = strtoul((*p == '+') ? p+1 : p, &end, 10);
+		if ((end == p) || (emu_parse_frame(end, &frame) != 0)) {
+			fprintf(stderr, "realtek_emu: %s:%d: invalid line\n", path, nb_line);
+			continue;
+		}
+		at = (*p == '+') ? at + ms : ms;
+		frame.due = (uint64_t)at * 1000;
+		script = realloc(emu.script, (emu.script_len+1) * sizeof(emu_frame));
+		if (script == NULL) {
+			break;
+		}
+		emu.script = script;
+		emu.script[emu.script_len++] = frame;
+	}
+	fclose(fd);
+}
+
+/* The options of the driver, the ones of the bus being parsed by emu_bus_parse_options() */
+static int emu_option(const char* token, const char* value)
+{
+	if (strcmp(token, "cec") == 0) {
+		snprintf(emu.cec_path, sizeof(emu.cec_path), "%s", value);
+	} else if (strcmp(token, "i2c") == 0) {
+		snprintf(emu.i2c_path, sizeof(emu.i2c_path), "%s", value);
+	} else if (strcmp(token, "ext") == 0) {
+		emu.edid_extensions = MIN((unsigned int)atoi(value), EMU_EDID_SEGMENTS*2 - 1);
+	} else if (strcmp(token, "eddc") == 0) {
+		emu.eddc = atoi(value);
+	} else if (strcmp(token, "junk") == 0) {
+		emu.junk = MIN((unsigned int)atoi(value), 255);
+	} else if (strcmp(token, "i2c_fail") == 0) {
+		emu.i2c_fail = atoi(value);
+	} else if (strcmp(token, "enable_fail") == 0) {
+		emu.enable_fail = atoi(value);
+	} else if (strcmp(token, "timeout") == 0) {
+		emu.timeout = atoi(value);
+	} else if (strcmp(token, "script") == 0) {
+		emu_load_script(value);
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+static void emu_init(void)
+{
+	pthread_condattr_t attr;
+
+	emu.real_open = dlsym(RTLD_NEXT, "open");
+	emu.real_close = dlsym(RTLD_NEXT, "close");
+	emu.real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&emu.cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	emu_bus_init(&emu.bus, "realtek_emu");
+	snprintf(emu.cec_path, sizeof(emu.cec_path), "/dev/cec/0");
+	snprintf(emu.i2c_path, sizeof(emu.i2c_path), "/dev/i2c/0");
+	emu.edid_extensions = 1;
+	emu.eddc = 1;
+	emu.cec_fd = -1;
+	emu.i2c_fd = -1;
+	emu_bus_parse_options(&emu.bus, getenv("REALTEK_EMU"), emu_option);
+	memset(emu.edid, 0xFF, sizeof(emu.edid));
+	emu_bus_build_edid(&emu.bus, emu.edid, emu.edid_extensions, "Realtek Emu");
+}
+
+/*
+ * Find the next frame to deliver, whether due or not, out of the device
+ * replies, the script and the background traffic. Returns its source
+ * (1, 2 or 3) and due time, or 0 if nothing is pending. Must be called
+ * with the lock held.
+ */
+static int emu_next_frame(uint64_t* due)
+{
+	int source = 0;
+
+	*due = UINT64_MAX;
+	if (emu.bus.queued != 0) {
+		*due = emu.bus.queue[0].due;
+		source = 1;
+	}
+	if ((emu.script_pos < emu.script_len)
+	  && (emu.enable_time + emu.script[emu.script_pos].due < *due)) {
+		*due = emu.enable_time + emu.script[emu.script_pos].due;
+		source = 2;
+	}
+	if ((emu.bus.traffic != 0) && (emu.bus.next_traffic < *due)) {
+		*due = emu.bus.next_traffic;
+		source = 3;
+	}
+	return source;
+}
+
+static int emu_cec_send(cec_msg* msg)
+{
+	uint8_t dst, reply[LIBCEC_MAX_FRAME_SIZE];
+	size_t reply_len;
+	uint64_t now;
+	int err = 0;
+
+	if ((msg == NULL) || (msg->buf == NULL) || (msg->len == 0) || (msg->len > LIBCEC_MAX_FRAME_SIZE)) {
+		errno = EINVAL;
+		return -1;
+	}
+	dst = msg->buf[0] & 0x0F;
+
+	pthread_mutex_lock(&emu.lock);
+	if (!emu.enabled) {
+		err = ENODEV;
+	} else if (emu_bus_chance(&emu.bus, emu.bus.arb)) {
+		err = EBUSY;
+	} else if (emu_bus_chance(&emu.bus, emu.timeout)) {
+		err = ETIME;
+	} else if (!emu_bus_acked(&emu.bus, dst)) {
+		err = EIO;
+	}
+	pthread_mutex_unlock(&emu.lock);
+
+	/* The driver only returns once the frame, and its retries, are off the wire */
+	emu_bus_sleep_us((uint64_t)emu.bus.latency * 1000 + emu_bus_wire_time(&emu.bus, msg->len));
+	emu_bus_log(&emu.bus, "send %02X%s%02X (%d bytes) -> %s", msg->buf[0], (msg->len > 1) ? ":" : "",
+		(msg->len > 1) ? msg->buf[1] : 0, msg->len, (err == 0) ? "ok" : strerror(err));
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+
+	now = emu_bus_now();
+	pthread_mutex_lock(&emu.lock);
+	reply_len = emu_bus_device_reply(&emu.bus, msg->buf, msg->len, reply);
+	if (reply_len != 0) {
+		emu_bus_queue_push(&emu.bus, reply, reply_len, now + (uint64_t)emu.bus.latency * 1000);
+		pthread_cond_broadcast(&emu.cond);
+	}
+	pthread_mutex_unlock(&emu.lock);
+	return 0;
+}
+
+static int emu_cec_receive(cec_msg* msg)
+{
+	uint64_t now, due, deadline;
+	struct timespec ts;
+	emu_frame frame;
+	int source, len;
+
+	if ((msg == NULL) || (msg->buf == NULL)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&emu.lock);
+	deadline = (msg->timeout < 0) ? UINT64_MAX : emu_bus_now() + (uint64_t)msg->timeout * 1000;
+	while (1) {
+		if (emu.cec_fd < 0) {
+			pthread_mutex_unlock(&emu.lock);
+			errno = EBADF;
+			return -1;
+		}
+		now = emu_bus_now();
+		source = emu.enabled ? emu_next_frame(&due) : 0;
+		if ((source != 0) && (due <= now)) {
+			break;
+		}
+		if (now >= deadline) {
+			pthread_mutex_unlock(&emu.lock);
+			errno = ETIME;
+			return -1;
+		}
+		due = MIN((source != 0) ? due : UINT64_MAX, deadline);
+		if (due == UINT64_MAX) {
+			pthread_cond_wait(&emu.cond, &emu.lock);
+		} else {
+			ts.tv_sec = due / 1000000;
+			ts.tv_nsec = (due % 1000000) * 1000;
+			pthread_cond_timedwait(&emu.cond, &emu.lock, &ts);
+		}
+	}
+
+	switch (source) {
+	case 1:
+		emu_bus_queue_pop(&emu.bus, &frame);
+		break;
+	case 2:
+		frame = emu.script[emu.script_pos++];
+		break;
+	default:
+		emu_bus_traffic_frame(&emu.bus, &frame);
+		break;
+	}
+	pthread_mutex_unlock(&emu.lock);
+
+	if (frame.len == 0) {
+		errno = ETIME;
+		return -1;
+	}
+	len = MIN(frame.len, msg->len);
+	memcpy(msg->buf, frame.buf, len);
+	emu_bus_log(&emu.bus, "receive %02X%s%02X (%d bytes)", frame.buf[0], (frame.len > 1) ? ":" : "",
+		(frame.len > 1) ? frame.buf[1] : 0, frame.len);
+	return len;
+}
+
+static int emu_cec_ioctl(unsigned long request, unsigned long arg)
+{
+	int r = 0;
+
+	/* integer arguments are passed as int through the variadic ioctl() */
+	if ((request == CEC_ENABLE) || (request == CEC_SET_LOGICAL_ADDRESS)) {
+		arg = (unsigned int)arg;
+	}
+
+	switch (request) {
+	case CEC_ENABLE:
+		pthread_mutex_lock(&emu.lock);
+		if (emu.enable_fail) {
+			errno = EIO;
+			r = -1;
+		} else if (arg && !emu.enabled) {
+			emu.enable_time = emu_bus_now();
+			emu.bus.next_traffic = emu.enable_time + ((emu.bus.traffic != 0) ? 1000000 / emu.bus.traffic : 0);
+			emu.script_pos = 0;
+		}
+		if (r == 0) {
+			emu.enabled = (arg != 0);
+		}
+		pthread_cond_broadcast(&emu.cond);
+		pthread_mutex_unlock(&emu.lock);
+		emu_bus_log(&emu.bus, "enable %lu -> %d", arg, r);
+		return r;
+	case CEC_SET_LOGICAL_ADDRESS:
+		if (arg > 0x0F) {
+			errno = EINVAL;
+			return -1;
+		}
+		pthread_mutex_lock(&emu.lock);
+		emu.bus.logical_address = (uint8_t)arg;
+		pthread_mutex_unlock(&emu.lock);
+		emu_bus_log(&emu.bus, "logical address %lX", arg);
+		return 0;
+	case CEC_SET_POWER_STATUS:
+		return 0;
+	case CEC_SEND_MESSAGE:
+		return emu_cec_send((cec_msg*)arg);
+	case CEC_RCV_MESSAGE:
+		return emu_cec_receive((cec_msg*)arg);
+	default:
+		errno = ENOTTY;
+		return -1;
+	}
+}
+
+static int emu_i2c_transfer(struct i2c_rdwr_ioctl_data* data)
+{
+	struct i2c_msg* msg;
+	unsigned int segment = 0, pointer, bytes = 0, i, j;
+	int addressed = 0, err = 0;
+
+	if ((data == NULL) || (data->msgs == NULL) || (data->nmsgs <= 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&emu.lock);
+	if (emu_bus_chance(&emu.bus, emu.i2c_fail)) {
+		err = EIO;
+	}
+	/* Like the vendor driver, a read with no word offset starts at the beginning
+	   of segment 0, and the segment pointer resets at the end of each transfer */
+	pointer = 0;
+	for (i=0; (err == 0) && (i<(unsigned int)data->nmsgs); i++) {
+		msg = &data->msgs[i];
+		bytes += msg->len + 1;
+		if ((msg->addr == EMU_EDID_SEGMENT_ADDR) && !(msg->flags & I2C_M_RD)) {
+			if (!emu.eddc) {
+				err = ENXIO;
+			} else if (msg->len >= 1) {
+				segment = msg->buf[0];
+			}
+		} else if ((msg->addr == EMU_EDID_ADDR) && !(msg->flags & I2C_M_RD)) {
+			if (msg->len >= 1) {
+				pointer = msg->buf[0];
+				addressed = 1;
+			}
+		} else if (msg->addr == EMU_EDID_ADDR) {
+			j = 0;
+			if (!addressed) {
+				/* a sink that was just plugged in may prepend garbage to the first bytes */
+				for (; (j<emu.junk) && (j<msg->len); j++) {
+					msg->buf[j] = (uint8_t)(rand_r(&emu.bus.seed) | 0x01);
+				}
+			}
+			for (; j<msg->len; j++, pointer = (pointer+1) & 0xFF) {
+				msg->buf[j] = (segment < EMU_EDID_SEGMENTS) ? emu.edid[segment*256 + pointer] : 0xFF;
+			}
+		} else {
+			err = ENXIO;
+		}
+	}
+	pthread_mutex_unlock(&emu.lock);
+
+	/* 9 bits per byte at 100 kHz */
+	if (emu.bus.wire) {
+		emu_bus_sleep_us(bytes * 90);
+	}
+	emu_bus_log(&emu.bus, "i2c transfer of %d messages -> %s", data->nmsgs, (err == 0) ? "ok" : strerror(err));
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+	return data->nmsgs;
+}
+
+static int emu_open(const char* path, int flags, mode_t mode)
+{
+	int fd, *emu_fd;
+
+	pthread_once(&emu.once, emu_init);
+	if (strcmp(path, emu.cec_path) == 0) {
+		emu_fd = &emu.cec_fd;
+	} else if (strcmp(path, emu.i2c_path) == 0) {
+		emu_fd = &emu.i2c_fd;
+	} else {
+		return emu.real_open(path, flags, mode);
+	}
+
+	pthread_mutex_lock(&emu.lock);
+	if (*emu_fd >= 0) {
+		pthread_mutex_unlock(&emu.lock);
+		errno = EBUSY;
+		return -1;
+	}
+	/* Hand out a real descriptor, so that the caller can close it or poll it */
+	fd = emu.real_open("/dev/null", O_RDWR | (flags & O_CLOEXEC));
+	if (fd >= 0) {
+		*emu_fd = fd;
+	}
+	pthread_mutex_unlock(&emu.lock);
+	emu_bus_log(&emu.bus, "open '%s' -> %d", path, fd);
+	return fd;
+}
+
+int open(const char* path, int flags, ...)
+{
+	va_list args;
+	mode_t mode = 0;
+
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_start(args, flags);
+		mode = va_arg(args, mode_t);
+		va_end(args);
+	}
+	return emu_open(path, flags, mode);
+}
+
+int open64(const char* path, int flags, ...)
+{
+	va_list args;
+	mode_t mode = 0;
+
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_start(args, flags);
+		mode = va_arg(args, mode_t);
+		va_end(args);
+	}
+	return emu_open(path, flags | O_LARGEFILE, mode);
+}
+
+int close(int fd)
+{
+	pthread_once(&emu.once, emu_init);
+	if (fd >= 0) {
+		pthread_mutex_lock(&emu.lock);
+		if (fd == emu.cec_fd) {
+			emu.cec_fd = -1;
+			emu.enabled = 0;
+			emu.bus.logical_address = 0x0F;
+			emu.bus.queued = 0;
+			/* wake up blocked readers, as the driver does on release */
+			pthread_cond_broadcast(&emu.cond);
+			emu_bus_log(&emu.bus, "close CEC device");
+		} else if (fd == emu.i2c_fd) {
+			emu.i2c_fd = -1;
+			emu_bus_log(&emu.bus, "close I2C device");
+		}
+		pthread_mutex_unlock(&emu.lock);
+	}
+	return emu.real_close(fd);
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	va_list args;
+	unsigned long arg;
+
+	va_start(args, request);
+	arg = va_arg(args, unsigned long);
+	va_end(args);
+
+	pthread_once(&emu.once, emu_init);
+	if ((fd >= 0) && (fd == emu.cec_fd)) {
+		return emu_cec_ioctl(request, arg);
+	}
+	if ((fd >= 0) && (fd == emu.i2c_fd)) {
+		if (request != I2C_RDWR) {
+			errno = ENOTTY;
+			return -1;
+		}
+		return emu_i2c_transfer((struct i2c_rdwr_ioctl_data*)arg);
+	}
+	return emu.real_ioctl(fd, request, arg);
+}
@@ -0,0 +1,439 @@
+/*
+ * serial_emu - pseudo-terminal stand-in for a USB-serial CEC adapter
+ *
+ * Copyright (c) 2010-2011 Pete Batard <pete@akeo.ie>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This program creates a pseudo-terminal, prints the name of its slave
+ * side, and then behaves as a USB-serial CEC adapter on a bus populated
+ * with simulated devices, so that the "serial:" backend can be run and
+ * benchmarked without a dongle. For instance:
+ *   serial_emu link=/tmp/cec-tty,traffic=50 &
+ *   cecd -d serial:/tmp/cec-tty,pa=0x1000
+ * It takes a single argument, which is a comma separated list of options:
+ *   link=<path>           symlink to create to the slave side of the pty
+ *   devices=<hex digits>  logical addresses of the simulated devices (default "045")
+ *   nack=<percent>        probability of a directed frame not being ACKed
+ *   arb=<percent>         probability of losing arbitration on transmit
+ *   reject=<percent>      probability of a command being rejected
+ *   noecho=<0|1>          acknowledge commands without echoing their code (default 0)
+ *   garbage=<percent>     probability of noise bytes between two messages
+ *   latency=<ms>          delay added to our transmissions and to device replies
+ *   wire=<0|1>            simulate the nominal CEC bit timing (default 0)
+ *   traffic=<n>           frames per second of background traffic from the devices
+ *   seed=<n>              seed for the fault injection generator (default 1)
+ *   log=<0|1>             trace the commands on stderr (default 0)
+ */
+
+#define _GNU_SOURCE
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "libceci.h"
+#include "serial_cec.h"
+#include "emu_bus.h"
+
+#define EMU_QUEUE_SIZE		256
+#define EMU_OUTPUT_SIZE		((LIBCEC_MAX_FRAME_SIZE+1) * 8)
+
+/* Adapter output scheduled for later */
+typedef struct {
+	uint64_t	due;		/* monotonic time, in us */
+	size_t		len;
+	uint8_t		buf[EMU_OUTPUT_SIZE];
+} emu_output;
+
+static struct {
+	emu_bus			bus;
+
+	/* options */
+	char			link[256];
+	unsigned int	reject;
+	int				noecho;
+	unsigned int	garbage;
+
+	/* state */
+	int				master;
+	uint16_t		ack_mask;
+	uint8_t			frame[LIBCEC_MAX_FRAME_SIZE];
+	unsigned int	frame_len;
+	uint8_t			msg[SERIAL_CEC_MSG_SIZE];
+	unsigned int	msg_len;
+	int				in_msg;
+	int				escaped;
+	uint64_t		bus_free;		/* when our last transmission is off the wire */
+	emu_output		queue[EMU_QUEUE_SIZE];	/* sorted by due time */
+	unsigned int	queued;
+	unsigned long	overruns;
+} emu;
+
+static volatile sig_atomic_t emu_exit;
+
+/* Append an adapter message to an output buffer, escaping it as needed */
+static void emu_encode(emu_output* out, uint8_t code, const uint8_t* param, size_t len)
+{
+	uint8_t b;
+	size_t i;
+
+	if (emu_bus_chance(&emu.bus, emu.garbage)) {
+		out->buf[out->len++] = (uint8_t)(rand_r(&emu.bus.seed) % SERIAL_CEC_MSGESC);
+	}
+	out->buf[out->len++] = SERIAL_CEC_MSGSTART;
+	for (i=0; i<=len; i++) {
+		b = (i == 0) ? code : param[i-1];
+		if (b >= SERIAL_CEC_MSGESC) {
+			out->buf[out->len++] = SERIAL_CEC_MSGESC;
+			b -= SERIAL_CEC_ESCOFFSET;
+		}
+		out->buf[out->len++] = b;
+	}
+	out->buf[out->len++] = SERIAL_CEC_MSGEND;
+}
+
+/* Encode a CEC frame, as the adapter reports the frames it receives */
+static void emu_encode_frame(emu_output* out, const uint8_t* frame, size_t len)
+{
+	uint8_t code;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		code = ((i == 0) ? SERIAL_CEC_FRAME_START : SERIAL_CEC_FRAME_DATA) | SERIAL_CEC_FRAME_ACK;
+		if (i == len-1) {
+			code |= SERIAL_CEC_FRAME_EOM;
+		}
+		emu_encode(out, code, &frame[i], 1);
+	}
+}
+
+static void emu_schedule(const emu_output* out, uint64_t due)
+{
+	unsigned int i;
+
+	if (emu.queued >= EMU_QUEUE_SIZE) {
+		emu.overruns++;
+		return;
+	}
+	for (i=emu.queued; (i>0) && (emu.queue[i-1].due > due); i--) {
+		emu.queue[i] = emu.queue[i-1];
+	}
+	emu.queue[i] = *out;
+	emu.queue[i].due = due;
+	emu.queued++;
+}
+
+static void emu_write(const uint8_t* buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(emu.master, buf, len);
+		if (n > 0) {
+			buf += n;
+			len -= (size_t)n;
+		} else if ((n < 0) && (errno == EINTR)) {
+			continue;
+		} else {
+			/* nobody is reading the slave side */
+			emu.overruns++;
+			return;
+		}
+	}
+}
+
+/* Schedule the answer of a simulated device to a directed request, if it has one */
+static void emu_device_reply(const uint8_t* buf, size_t len, uint64_t due)
+{
+	uint8_t reply[LIBCEC_MAX_FRAME_SIZE];
+	size_t reply_len;
+	emu_output out;
+
+	reply_len = emu_bus_device_reply(&emu.bus, buf, len, reply);
+	if (reply_len == 0) {
+		return;
+	}
+	out.len = 0;
+	emu_encode_frame(&out, reply, reply_len);
+	emu_schedule(&out, due);
+}
+
+/* The frame is complete: schedule the outcome of its transmission, and any reply */
+static void emu_transmit(uint64_t now)
+{
+	uint8_t dst = emu.frame[0] & 0x0F, result;
+	uint64_t done;
+	emu_output out;
+
+	done = MAX(now, emu.bus_free) + (uint64_t)emu.bus.latency * 1000 + emu_bus_wire_time(&emu.bus, emu.frame_len);
+	emu.bus_free = done;
+	if (emu_bus_chance(&emu.bus, emu.bus.arb)) {
+		result = SERIAL_CEC_TRANSMIT_FAILED_LINE;
+	} else if (!emu_bus_acked(&emu.bus, dst)) {
+		result = SERIAL_CEC_TRANSMIT_FAILED_ACK;
+	} else {
+		result = SERIAL_CEC_TRANSMIT_SUCCEEDED;
+	}
+	emu_bus_log(&emu.bus, "transmit %02X%s%02X (%d bytes) -> %d", emu.frame[0], (emu.frame_len > 1) ? ":" : "",
+		(emu.frame_len > 1) ? emu.frame[1] : 0, emu.frame_len, result);
+	out.len = 0;
+	emu_encode(&out, result, NULL, 0);
+	emu_schedule(&out, done);
+	if (result == SERIAL_CEC_TRANSMIT_SUCCEEDED) {
+		emu_device_reply(emu.frame, emu.frame_len, done + (uint64_t)emu.bus.latency * 1000);
+	}
+	emu.frame_len = 0;
+}
+
+/* Handle a command from the host, answering to it in out */
+static void emu_command(const uint8_t* msg, unsigned int len, emu_output* out, uint64_t now)
+{
+	uint8_t code = msg[0] & SERIAL_CEC_CODE_MASK;
+	uint8_t version[2] = { 0x00, 0x02 };
+	uint8_t la;
+	int accepted = !emu_bus_chance(&emu.bus, emu.reject);
+
+	switch (code) {
+	case SERIAL_CEC_PING:
+		break;
+	case SERIAL_CEC_FIRMWARE_VERSION:
+		if (accepted) {
+			emu_encode(out, SERIAL_CEC_FIRMWARE_VERSION, version, sizeof(version));
+		}
+		break;
+	case SERIAL_CEC_SET_ACK_MASK:
+		if (len < 3) {
+			accepted = 0;
+		} else if (accepted) {
+			emu.ack_mask = (msg[1] << 8) | msg[2];
+			/* the device traffic is for the first address we ACK */
+			for (la=0; (la<0x0F) && !(emu.ack_mask & (1 << la)); la++);
+			emu.bus.logical_address = la;
+			emu_bus_log(&emu.bus, "ack mask %04X", emu.ack_mask);
+		}
+		break;
+	case SERIAL_CEC_TRANSMIT_IDLETIME:
+	case SERIAL_CEC_TRANSMIT_LINE_TIMEOUT:
+		break;
+	case SERIAL_CEC_TRANSMIT_ACK_POLARITY:
+		emu.frame_len = 0;
+		break;
+	case SERIAL_CEC_TRANSMIT:
+	case SERIAL_CEC_TRANSMIT_EOM:
+		if ((len < 2) || (emu.frame_len >= LIBCEC_MAX_FRAME_SIZE)) {
+			accepted = 0;
+		}
+		if (!accepted) {
+			emu.frame_len = 0;
+			break;
+		}
+		emu.frame[emu.frame_len++] = msg[1];
+		break;
+	default:
+		accepted = 0;
+		break;
+	}
+	if (emu.noecho) {
+		emu_encode(out, accepted ? SERIAL_CEC_COMMAND_ACCEPTED : SERIAL_CEC_COMMAND_REJECTED, NULL, 0);
+	} else {
+		emu_encode(out, accepted ? SERIAL_CEC_COMMAND_ACCEPTED : SERIAL_CEC_COMMAND_REJECTED, &code, 1);
+	}
+	if ((code == SERIAL_CEC_TRANSMIT_EOM) && accepted) {
+		emu_transmit(now);
+	}
+}
+
+/* Parse what the host sent, and write the acknowledgements right away */
+static void emu_parse(const uint8_t* data, size_t length)
+{
+	emu_output out;
+	uint64_t now = emu_bus_now();
+	uint8_t b;
+	size_t i;
+
+	out.len = 0;
+	for (i=0; i<length; i++) {
+		b = data[i];
+		if (b == SERIAL_CEC_MSGSTART) {
+			emu.in_msg = 1;
+			emu.msg_len = 0;
+			emu.escaped = 0;
+			continue;
+		}
+		if (!emu.in_msg) {
+			continue;
+		}
+		if (b == SERIAL_CEC_MSGEND) {
+			if (emu.msg_len != 0) {
+				emu_command(emu.msg, emu.msg_len, &out, now);
+			}
+			emu.in_msg = 0;
+			/* flush before the buffer can overflow */
+			if (out.len > EMU_OUTPUT_SIZE - 32) {
+				emu_write(out.buf, out.len);
+				out.len = 0;
+			}
+			continue;
+		}
+		if (b == SERIAL_CEC_MSGESC) {
+			emu.escaped = 1;
+			continue;
+		}
+		if (emu.escaped) {
+			b += SERIAL_CEC_ESCOFFSET;
+			emu.escaped = 0;
+		}
+		if (emu.msg_len >= SERIAL_CEC_MSG_SIZE) {
+			emu.in_msg = 0;
+			continue;
+		}
+		emu.msg[emu.msg_len++] = b;
+	}
+	if (out.len != 0) {
+		emu_write(out.buf, out.len);
+	}
+}
+
+/* Background traffic, from a random device to us or to everyone */
+static void emu_traffic(void)
+{
+	emu_frame frame;
+	emu_output out;
+
+	emu_bus_traffic_frame(&emu.bus, &frame);
+	if (frame.len == 0) {
+		return;
+	}
+	out.len = 0;
+	emu_encode_frame(&out, frame.buf, frame.len);
+	emu_schedule(&out, frame.due);
+}
+
+/* The options of the adapter, the ones of the bus being parsed by emu_bus_parse_options() */
+static int emu_option(const char* token, const char* value)
+{
+	if (strcmp(token, "link") == 0) {
+		snprintf(emu.link, sizeof(emu.link), "%s", value);
+	} else if (strcmp(token, "reject") == 0) {
+		emu.reject = atoi(value);
+	} else if (strcmp(token, "noecho") == 0) {
+		emu.noecho = atoi(value);
+	} else if (strcmp(token, "garbage") == 0) {
+		emu.garbage = atoi(value);
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+static void emu_signal(int sig)
+{
+	emu_exit = 1;
+}
+
+int main(int argc, char** argv)
+{
+	struct sigaction sa;
+	struct termios tio;
+	struct pollfd pfd;
+	uint8_t chunk[4096];
+	uint64_t now, next;
+	char* slave_name;
+	int slave, timeout;
+	ssize_t n;
+
+	emu_bus_init(&emu.bus, "serial_emu");
+	if (argc > 1) {
+		emu_bus_parse_options(&emu.bus, argv[1], emu_option);
+	}
+
+	emu.master = posix_openpt(O_RDWR | O_NOCTTY);
+	if ( (emu.master < 0) || (grantpt(emu.master) != 0) || (unlockpt(emu.master) != 0)
+	  || ((slave_name = ptsname(emu.master)) == NULL) ) {
+		perror("serial_emu: cannot create pseudo-terminal");
+		return 1;
+	}
+	/* Keep the slave side open, so that the host can come and go, and make
+	   it raw until the host configures it, so that nothing gets mangled */
+	slave = open(slave_name, O_RDWR | O_NOCTTY);
+	if ((slave < 0) || (tcgetattr(slave, &tio) != 0)) {
+		perror("serial_emu: cannot open pseudo-terminal");
+		return 1;
+	}
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+	fcntl(emu.master, F_SETFL, fcntl(emu.master, F_GETFL) | O_NONBLOCK);
+
+	if (emu.link[0] != 0) {
+		unlink(emu.link);
+		if (symlink(slave_name, emu.link) != 0) {
+			perror("serial_emu: cannot create link");
+			return 1;
+		}
+	}
+	printf("%s\n", slave_name);
+	fflush(stdout);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = emu_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	pfd.fd = emu.master;
+	pfd.events = POLLIN;
+	emu.bus.next_traffic = emu_bus_now() + ((emu.bus.traffic != 0) ? 1000000 / emu.bus.traffic : 0);
+	while (!emu_exit) {
+		now = emu_bus_now();
+		while ((emu.queued != 0) && (emu.queue[0].due <= now)) {
+			emu_write(emu.queue[0].buf, emu.queue[0].len);
+			memmove(&emu.queue[0], &emu.queue[1], (--emu.queued) * sizeof(emu_output));
+		}
+		if ((emu.bus.traffic != 0) && (emu.bus.next_traffic <= now)) {
+			emu_traffic();
+			continue;
+		}
+		next = (emu.queued != 0) ? emu.queue[0].due : UINT64_MAX;
+		if (emu.bus.traffic != 0) {
+			next = MIN(next, emu.bus.next_traffic);
+		}
+		timeout = (next == UINT64_MAX) ? -1 : (int)((next - now + 999) / 1000);
+		if (poll(&pfd, 1, timeout) <= 0) {
+			continue;
+		}
+		n = read(emu.master, chunk, sizeof(chunk));
+		if (n > 0) {
+			emu_parse(chunk, (size_t)n);
+		}
+	}
+
+	if (emu.overruns != 0) {
+		fprintf(stderr, "serial_emu: %lu messages could not be delivered\n", emu.overruns);
+	}
+	if (emu.link[0] != 0) {
+		unlink(emu.link);
+	}
+	close(slave);
+	close(emu.master);
+	return 0;
+}